@@ -806,11 +806,14 @@ static int tag__check_id_drift(const struct tag *tag,
 static int32_t btf_encoder__add_struct_type(struct btf_encoder *encoder, struct tag *tag, uint32_t type_id_off)
 {
 	struct type *type = tag__type(tag);
-	struct class_member *pos;
+	const struct class_member_layout *pos;
 	const char *name = type__name(type);
 	int32_t type_id;
 	uint8_t kind;
 
+	if (type__layout_members(type))
+		return -1;
+
 	kind = (tag->tag == DW_TAG_union_type) ?
 		BTF_KIND_UNION : BTF_KIND_STRUCT;
 
@@ -818,14 +821,15 @@ static int32_t btf_encoder__add_struct_type(struct btf_encoder *encoder, struct
 	if (type_id < 0)
 		return type_id;
 
-	type__for_each_data_member(type, pos) {
+	type__for_each_member_layout(type, pos) {
+		if (pos->is_inheritance)
+			continue;
 		/*
 		 * dwarf_loader uses DWARF's recommended bit offset addressing
 		 * scheme, which conforms to BTF requirement, so no conversion
 		 * is required.
 		 */
-		name = class_member__name(pos);
-		if (btf_encoder__add_field(encoder, name, type_id_off + pos->tag.type, pos->bitfield_size, pos->bit_offset))
+		if (btf_encoder__add_field(encoder, pos->name, type_id_off + pos->type, pos->bitfield_size, pos->bit_offset))
 			return -1;
 	}
 
@@ -10,6 +10,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <byteswap.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -20,6 +21,7 @@
 #include <string.h>
 #include <limits.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <linux/btf.h>
 #include <bpf/btf.h>
 #include <bpf/libbpf.h>
@@ -29,15 +31,35 @@
 
 #include "dutil.h"
 #include "dwarves.h"
+#include "hash.h"
+
+struct btf_name_index;
+
+/*
+ * struct btf_cu - what BTF CUs keep in cu->priv
+ *
+ * @conf - for the bitfield fixups done as types get loaded with cu->lazy_types
+ * @loaded - with cu->lazy_types, bitmap of the type ids already looked at
+ * @names - index of the BTF types by name, built on the first lookup by name
+ */
+struct btf_cu {
+	struct btf		*btf;
+	const struct conf_load	*conf;
+	uint8_t			*loaded;
+	struct btf_name_index	*names;
+};
 
 static const char *cu__btf_str(struct cu *cu, uint32_t offset)
 {
-	return offset ? btf__str_by_offset(cu->priv, offset) : NULL;
+	struct btf_cu *bcu = cu->priv;
+
+	return offset ? btf__str_by_offset(bcu->btf, offset) : NULL;
 }
 
-static void *tag__alloc(const size_t size)
+// Allocated from the cu obstack, freed all at once in cu__delete()
+static void *tag__alloc(struct cu *cu, const size_t size)
 {
-	struct tag *tag = zalloc(size);
+	struct tag *tag = cu__zalloc(cu, size);
 
 	if (tag != NULL)
 		tag->top_level = 1;
@@ -58,10 +80,10 @@ static int cu__load_ftype(struct cu *cu, struct ftype *proto, uint32_t tag, cons
 		if (param->type == 0)
 			proto->unspec_parms = 1;
 		else {
-			struct parameter *p = tag__alloc(sizeof(*p));
+			struct parameter *p = tag__alloc(cu, sizeof(*p));
 
 			if (p == NULL)
-				goto out_free_parameters;
+				return -ENOMEM;
 			p->tag.tag  = DW_TAG_formal_parameter;
 			p->tag.type = param->type;
 			p->name	    = cu__btf_str(cu, param->name_off);
@@ -72,14 +94,11 @@ static int cu__load_ftype(struct cu *cu, struct ftype *proto, uint32_t tag, cons
 	cu__add_tag_with_id(cu, &proto->tag, id);
 
 	return 0;
-out_free_parameters:
-	ftype__delete(proto);
-	return -ENOMEM;
 }
 
 static int create_new_function(struct cu *cu, const struct btf_type *tp, uint32_t id)
 {
-	struct function *func = tag__alloc(sizeof(*func));
+	struct function *func = tag__alloc(cu, sizeof(*func));
 
 	if (func == NULL)
 		return -ENOMEM;
@@ -96,10 +115,10 @@ static int create_new_function(struct cu *cu, const struct btf_type *tp, uint32_
 	return 0;
 }
 
-static struct base_type *base_type__new(const char *name, uint32_t attrs,
+static struct base_type *base_type__new(struct cu *cu, const char *name, uint32_t attrs,
 					uint8_t float_type, size_t size)
 {
-        struct base_type *bt = tag__alloc(sizeof(*bt));
+        struct base_type *bt = tag__alloc(cu, sizeof(*bt));
 
 	if (bt != NULL) {
 		bt->name = name;
@@ -121,9 +140,9 @@ static void type__init(struct type *type, uint32_t tag, const char *name, size_t
 	type->namespace.name = name;
 }
 
-static struct type *type__new(uint16_t tag, const char *name, size_t size)
+static struct type *type__new(struct cu *cu, uint16_t tag, const char *name, size_t size)
 {
-        struct type *type = tag__alloc(sizeof(*type));
+        struct type *type = tag__alloc(cu, sizeof(*type));
 
 	if (type != NULL)
 		type__init(type, tag, name, size);
@@ -131,9 +150,9 @@ static struct type *type__new(uint16_t tag, const char *name, size_t size)
 	return type;
 }
 
-static struct class *class__new(const char *name, size_t size, bool is_union)
+static struct class *class__new(struct cu *cu, const char *name, size_t size, bool is_union)
 {
-	struct class *class = tag__alloc(sizeof(*class));
+	struct class *class = tag__alloc(cu, sizeof(*class));
 	uint32_t tag = is_union ? DW_TAG_union_type : DW_TAG_structure_type;
 
 	if (class != NULL) {
@@ -144,9 +163,9 @@ static struct class *class__new(const char *name, size_t size, bool is_union)
 	return class;
 }
 
-static struct variable *variable__new(const char *name, uint32_t linkage)
+static struct variable *variable__new(struct cu *cu, const char *name, uint32_t linkage)
 {
-	struct variable *var = tag__alloc(sizeof(*var));
+	struct variable *var = tag__alloc(cu, sizeof(*var));
 
 	if (var != NULL) {
 		var->external = linkage == BTF_VAR_GLOBAL_ALLOCATED;
@@ -161,7 +180,7 @@ static int create_new_int_type(struct cu *cu, const struct btf_type *tp, uint32_
 {
 	uint32_t attrs = btf_int_encoding(tp);
 	const char *name = cu__btf_str(cu, tp->name_off);
-	struct base_type *base = base_type__new(name, attrs, 0, btf_int_bits(tp));
+	struct base_type *base = base_type__new(cu, name, attrs, 0, btf_int_bits(tp));
 
 	if (base == NULL)
 		return -ENOMEM;
@@ -175,7 +194,7 @@ static int create_new_int_type(struct cu *cu, const struct btf_type *tp, uint32_
 static int create_new_float_type(struct cu *cu, const struct btf_type *tp, uint32_t id)
 {
 	const char *name = cu__btf_str(cu, tp->name_off);
-	struct base_type *base = base_type__new(name, 0, BT_FP_SINGLE, tp->size * 8);
+	struct base_type *base = base_type__new(cu, name, 0, BT_FP_SINGLE, tp->size * 8);
 
 	if (base == NULL)
 		return -ENOMEM;
@@ -189,7 +208,7 @@ static int create_new_float_type(struct cu *cu, const struct btf_type *tp, uint3
 static int create_new_array(struct cu *cu, const struct btf_type *tp, uint32_t id)
 {
 	struct btf_array *ap = btf_array(tp);
-	struct array_type *array = tag__alloc(sizeof(*array));
+	struct array_type *array = tag__alloc(cu, sizeof(*array));
 
 	if (array == NULL)
 		return -ENOMEM;
@@ -197,12 +216,10 @@ static int create_new_array(struct cu *cu, const struct btf_type *tp, uint32_t i
 	/* FIXME: where to get the number of dimensions?
 	 * it it flattened? */
 	array->dimensions = 1;
-	array->nr_entries = malloc(sizeof(uint32_t));
+	array->nr_entries = cu__malloc(cu, sizeof(uint32_t));
 
-	if (array->nr_entries == NULL) {
-		free(array);
+	if (array->nr_entries == NULL)
 		return -ENOMEM;
-	}
 
 	array->nr_entries[0] = ap->nelems;
 	array->tag.tag = DW_TAG_array_type;
@@ -219,7 +236,7 @@ static int create_members(struct cu *cu, const struct btf_type *tp, struct type
 	int i, vlen = btf_vlen(tp);
 
 	for (i = 0; i < vlen; i++) {
-		struct class_member *member = zalloc(sizeof(*member));
+		struct class_member *member = cu__zalloc(cu, sizeof(*member));
 
 		if (member == NULL)
 			return -ENOMEM;
@@ -239,39 +256,31 @@ static int create_members(struct cu *cu, const struct btf_type *tp, struct type
 
 static int create_new_class(struct cu *cu, const struct btf_type *tp, uint32_t id)
 {
-	struct class *class = class__new(cu__btf_str(cu, tp->name_off), tp->size, false);
-	int member_size = create_members(cu, tp, &class->type);
+	struct class *class = class__new(cu, cu__btf_str(cu, tp->name_off), tp->size, false);
 
-	if (member_size < 0)
-		goto out_free;
+	if (class == NULL || create_members(cu, tp, &class->type) < 0)
+		return -ENOMEM;
 
 	cu__add_tag_with_id(cu, &class->type.namespace.tag, id);
 
 	return 0;
-out_free:
-	class__delete(class);
-	return -ENOMEM;
 }
 
 static int create_new_union(struct cu *cu, const struct btf_type *tp, uint32_t id)
 {
-	struct type *un = type__new(DW_TAG_union_type, cu__btf_str(cu, tp->name_off), tp->size);
-	int member_size = create_members(cu, tp, un);
+	struct type *un = type__new(cu, DW_TAG_union_type, cu__btf_str(cu, tp->name_off), tp->size);
 
-	if (member_size < 0)
-		goto out_free;
+	if (un == NULL || create_members(cu, tp, un) < 0)
+		return -ENOMEM;
 
 	cu__add_tag_with_id(cu, &un->namespace.tag, id);
 
 	return 0;
-out_free:
-	type__delete(un);
-	return -ENOMEM;
 }
 
-static struct enumerator *enumerator__new(const char *name, uint32_t value)
+static struct enumerator *enumerator__new(struct cu *cu, const char *name, uint32_t value)
 {
-	struct enumerator *en = tag__alloc(sizeof(*en));
+	struct enumerator *en = tag__alloc(cu, sizeof(*en));
 
 	if (en != NULL) {
 		en->name = name;
@@ -286,7 +295,7 @@ static int create_new_enumeration(struct cu *cu, const struct btf_type *tp, uint
 {
 	struct btf_enum *ep = btf_enum(tp);
 	uint16_t i, vlen = btf_vlen(tp);
-	struct type *enumeration = type__new(DW_TAG_enumeration_type,
+	struct type *enumeration = type__new(cu, DW_TAG_enumeration_type,
 					     cu__btf_str(cu, tp->name_off),
 					     tp->size ? tp->size * 8 : (sizeof(int) * 8));
 
@@ -296,10 +305,10 @@ static int create_new_enumeration(struct cu *cu, const struct btf_type *tp, uint
 	for (i = 0; i < vlen; i++) {
 		const char *name = cu__btf_str(cu, ep[i].name_off);
 		uint32_t value = ep[i].val;
-		struct enumerator *enumerator = enumerator__new(name, value);
+		struct enumerator *enumerator = enumerator__new(cu, name, value);
 
 		if (enumerator == NULL)
-			goto out_free;
+			return -ENOMEM;
 
 		enumeration__add(enumeration, enumerator);
 	}
@@ -307,14 +316,11 @@ static int create_new_enumeration(struct cu *cu, const struct btf_type *tp, uint
 	cu__add_tag_with_id(cu, &enumeration->namespace.tag, id);
 
 	return 0;
-out_free:
-	enumeration__delete(enumeration);
-	return -ENOMEM;
 }
 
 static int create_new_subroutine_type(struct cu *cu, const struct btf_type *tp, uint32_t id)
 {
-	struct ftype *proto = tag__alloc(sizeof(*proto));
+	struct ftype *proto = tag__alloc(cu, sizeof(*proto));
 
 	if (proto == NULL)
 		return -ENOMEM;
@@ -324,7 +330,7 @@ static int create_new_subroutine_type(struct cu *cu, const struct btf_type *tp,
 
 static int create_new_forward_decl(struct cu *cu, const struct btf_type *tp, uint32_t id)
 {
-	struct class *fwd = class__new(cu__btf_str(cu, tp->name_off), 0, btf_kflag(tp));
+	struct class *fwd = class__new(cu, cu__btf_str(cu, tp->name_off), 0, btf_kflag(tp));
 
 	if (fwd == NULL)
 		return -ENOMEM;
@@ -335,7 +341,7 @@ static int create_new_forward_decl(struct cu *cu, const struct btf_type *tp, uin
 
 static int create_new_typedef(struct cu *cu, const struct btf_type *tp, uint32_t id)
 {
-	struct type *type = type__new(DW_TAG_typedef, cu__btf_str(cu, tp->name_off), 0);
+	struct type *type = type__new(cu, DW_TAG_typedef, cu__btf_str(cu, tp->name_off), 0);
 
 	if (type == NULL)
 		return -ENOMEM;
@@ -349,7 +355,7 @@ static int create_new_typedef(struct cu *cu, const struct btf_type *tp, uint32_t
 static int create_new_variable(struct cu *cu, const struct btf_type *tp, uint32_t id)
 {
 	struct btf_var *bvar = btf_var(tp);
-	struct variable *var = variable__new(cu__btf_str(cu, tp->name_off), bvar->linkage);
+	struct variable *var = variable__new(cu, cu__btf_str(cu, tp->name_off), bvar->linkage);
 
 	if (var == NULL)
 		return -ENOMEM;
@@ -372,7 +378,7 @@ static int create_new_datasec(struct cu *cu __maybe_unused, const struct btf_typ
 
 static int create_new_tag(struct cu *cu, int type, const struct btf_type *tp, uint32_t id)
 {
-	struct tag *tag = zalloc(sizeof(*tag));
+	struct tag *tag = cu__zalloc(cu, sizeof(*tag));
 
 	if (tag == NULL)
 		return -ENOMEM;
@@ -383,7 +389,6 @@ static int create_new_tag(struct cu *cu, int type, const struct btf_type *tp, ui
 	case BTF_KIND_RESTRICT:	tag->tag = DW_TAG_restrict_type; break;
 	case BTF_KIND_VOLATILE:	tag->tag = DW_TAG_volatile_type; break;
 	default:
-		free(tag);
 		printf("%s: Unknown type %d\n\n", __func__, type);
 		return 0;
 	}
@@ -394,71 +399,78 @@ static int create_new_tag(struct cu *cu, int type, const struct btf_type *tp, ui
 	return 0;
 }
 
+static int btf__load_type(struct btf *btf, struct cu *cu, uint32_t type_index)
+{
+	const struct btf_type *type_ptr = btf__type_by_id(btf, type_index);
+	uint32_t type = btf_kind(type_ptr);
+	int err;
+
+	switch (type) {
+	case BTF_KIND_INT:
+		err = create_new_int_type(cu, type_ptr, type_index);
+		break;
+	case BTF_KIND_ARRAY:
+		err = create_new_array(cu, type_ptr, type_index);
+		break;
+	case BTF_KIND_STRUCT:
+		err = create_new_class(cu, type_ptr, type_index);
+		break;
+	case BTF_KIND_UNION:
+		err = create_new_union(cu, type_ptr, type_index);
+		break;
+	case BTF_KIND_ENUM:
+		err = create_new_enumeration(cu, type_ptr, type_index);
+		break;
+	case BTF_KIND_FWD:
+		err = create_new_forward_decl(cu, type_ptr, type_index);
+		break;
+	case BTF_KIND_TYPEDEF:
+		err = create_new_typedef(cu, type_ptr, type_index);
+		break;
+	case BTF_KIND_VAR:
+		err = create_new_variable(cu, type_ptr, type_index);
+		break;
+	case BTF_KIND_DATASEC:
+		err = create_new_datasec(cu, type_ptr, type_index);
+		break;
+	case BTF_KIND_VOLATILE:
+	case BTF_KIND_PTR:
+	case BTF_KIND_CONST:
+	case BTF_KIND_RESTRICT:
+		err = create_new_tag(cu, type, type_ptr, type_index);
+		break;
+	case BTF_KIND_UNKN:
+		cu__table_nullify_type_entry(cu, type_index);
+		fprintf(stderr, "BTF: idx: %d, Unknown kind %d\n", type_index, type);
+		fflush(stderr);
+		err = 0;
+		break;
+	case BTF_KIND_FUNC_PROTO:
+		err = create_new_subroutine_type(cu, type_ptr, type_index);
+		break;
+	case BTF_KIND_FUNC:
+		// BTF_KIND_FUNC corresponding to a defined subprogram.
+		err = create_new_function(cu, type_ptr, type_index);
+		break;
+	case BTF_KIND_FLOAT:
+		err = create_new_float_type(cu, type_ptr, type_index);
+		break;
+	default:
+		fprintf(stderr, "BTF: idx: %d, Unknown kind %d\n", type_index, type);
+		fflush(stderr);
+		err = 0;
+		break;
+	}
+
+	return err;
+}
+
 static int btf__load_types(struct btf *btf, struct cu *cu)
 {
 	uint32_t type_index;
-	int err;
 
 	for (type_index = 1; type_index < btf__type_cnt(btf); type_index++) {
-		const struct btf_type *type_ptr = btf__type_by_id(btf, type_index);
-		uint32_t type = btf_kind(type_ptr);
-
-		switch (type) {
-		case BTF_KIND_INT:
-			err = create_new_int_type(cu, type_ptr, type_index);
-			break;
-		case BTF_KIND_ARRAY:
-			err = create_new_array(cu, type_ptr, type_index);
-			break;
-		case BTF_KIND_STRUCT:
-			err = create_new_class(cu, type_ptr, type_index);
-			break;
-		case BTF_KIND_UNION:
-			err = create_new_union(cu, type_ptr, type_index);
-			break;
-		case BTF_KIND_ENUM:
-			err = create_new_enumeration(cu, type_ptr, type_index);
-			break;
-		case BTF_KIND_FWD:
-			err = create_new_forward_decl(cu, type_ptr, type_index);
-			break;
-		case BTF_KIND_TYPEDEF:
-			err = create_new_typedef(cu, type_ptr, type_index);
-			break;
-		case BTF_KIND_VAR:
-			err = create_new_variable(cu, type_ptr, type_index);
-			break;
-		case BTF_KIND_DATASEC:
-			err = create_new_datasec(cu, type_ptr, type_index);
-			break;
-		case BTF_KIND_VOLATILE:
-		case BTF_KIND_PTR:
-		case BTF_KIND_CONST:
-		case BTF_KIND_RESTRICT:
-			err = create_new_tag(cu, type, type_ptr, type_index);
-			break;
-		case BTF_KIND_UNKN:
-			cu__table_nullify_type_entry(cu, type_index);
-			fprintf(stderr, "BTF: idx: %d, Unknown kind %d\n", type_index, type);
-			fflush(stderr);
-			err = 0;
-			break;
-		case BTF_KIND_FUNC_PROTO:
-			err = create_new_subroutine_type(cu, type_ptr, type_index);
-			break;
-		case BTF_KIND_FUNC:
-			// BTF_KIND_FUNC corresponding to a defined subprogram.
-			err = create_new_function(cu, type_ptr, type_index);
-			break;
-		case BTF_KIND_FLOAT:
-			err = create_new_float_type(cu, type_ptr, type_index);
-			break;
-		default:
-			fprintf(stderr, "BTF: idx: %d, Unknown kind %d\n", type_index, type);
-			fflush(stderr);
-			err = 0;
-			break;
-		}
+		int err = btf__load_type(btf, cu, type_index);
 
 		if (err < 0)
 			return err;
@@ -577,9 +589,129 @@ static int cu__fixup_btf_bitfields(const struct conf_load *conf, struct cu *cu)
 	return err;
 }
 
+/*
+ * struct btf_name_index - BTF type ids by name, open addressing
+ *
+ * @bits - for hash_64(), @nr_slots is 1 << @bits
+ * @entries - zero @id marks an empty slot, as the void type has no name
+ */
+struct btf_name_index {
+	uint32_t nr_slots;
+	uint8_t	 bits;
+	struct btf_name_index_entry {
+		uint32_t id;
+		uint32_t hash;
+	} entries[];
+};
+
+static uint32_t btf_name__hash(const char *name)
+{
+	return hash_str(HASH_BYTES__INIT, name);
+}
+
+static struct btf_name_index *btf__new_name_index(const struct btf *btf)
+{
+	const uint32_t nr_types = btf__type_cnt(btf);
+	struct btf_name_index *index;
+	uint32_t id, nr_named = 0;
+	uint8_t bits = 1;
+
+	for (id = 1; id < nr_types; ++id)
+		if (btf__type_by_id(btf, id)->name_off != 0)
+			++nr_named;
+
+	while ((1U << bits) < 2 * nr_named)
+		++bits;
+
+	index = zalloc(sizeof(*index) + (1U << bits) * sizeof(index->entries[0]));
+	if (index == NULL)
+		return NULL;
+
+	index->nr_slots = 1U << bits;
+	index->bits	= bits;
+
+	for (id = 1; id < nr_types; ++id) {
+		const struct btf_type *tp = btf__type_by_id(btf, id);
+		uint32_t hash, slot;
+
+		if (tp->name_off == 0)
+			continue;
+
+		hash = btf_name__hash(btf__name_by_offset(btf, tp->name_off));
+		slot = hash_64(hash, bits);
+		while (index->entries[slot].id != 0)
+			slot = (slot + 1) & (index->nr_slots - 1);
+
+		index->entries[slot].id	  = id;
+		index->entries[slot].hash = hash;
+	}
+
+	return index;
+}
+
+static int cu__load_btf_type(struct cu *cu, uint32_t id)
+{
+	struct btf_cu *bcu = cu->priv;
+
+	if (id >= btf__type_cnt(bcu->btf) || (bcu->loaded[id / 8] & (1 << (id % 8))))
+		return -ENOENT;
+
+	// Before loading, as the bitfield fixups may get back here for this type
+	bcu->loaded[id / 8] |= 1 << (id % 8);
+
+	int err = btf__load_type(bcu->btf, cu, id);
+	if (err < 0)
+		return err;
+
+	struct tag *tag = cu__type(cu, id);
+
+	if (tag && (tag__is_struct(tag) || tag__is_union(tag)))
+		err = class__fixup_btf_bitfields(bcu->conf, tag, cu);
+
+	return err;
+}
+
+static int cu__load_btf_types_by_name(struct cu *cu, const char *name)
+{
+	struct btf_cu *bcu = cu->priv;
+
+	if (bcu->names == NULL) {
+		bcu->names = btf__new_name_index(bcu->btf);
+		if (bcu->names == NULL)
+			return -ENOMEM;
+	}
+
+	const struct btf_name_index *index = bcu->names;
+	uint32_t hash = btf_name__hash(name);
+	uint32_t slot = hash_64(hash, index->bits);
+
+	for (; index->entries[slot].id != 0; slot = (slot + 1) & (index->nr_slots - 1)) {
+		uint32_t id = index->entries[slot].id;
+
+		if (index->entries[slot].hash != hash ||
+		    strcmp(btf__name_by_offset(bcu->btf, btf__type_by_id(bcu->btf, id)->name_off), name))
+			continue;
+
+		int err = cu__load_btf_type(cu, id);
+
+		if (err < 0 && err != -ENOENT)
+			return err;
+	}
+
+	return 0;
+}
+
 static void btf__cu_delete(struct cu *cu)
 {
-	btf__free(cu->priv);
+	struct btf_cu *bcu = cu->priv;
+
+	if (bcu == NULL)
+		return;
+
+	btf__free(bcu->btf);
+	free(bcu->loaded);
+	free(bcu->names);
+	free(bcu);
 	cu->priv = NULL;
 }
 
@@ -590,53 +722,229 @@ static int libbpf_log(enum libbpf_print_level level __maybe_unused, const char *
 
 struct debug_fmt_ops btf__ops;
 
-static int cus__load_btf(struct cus *cus, struct conf_load *conf, const char *filename)
+static int __cus__load_btf(struct cus *cus, struct conf_load *conf, const char *filename,
+			   uint32_t seq, void *thr_data, enum load_steal_kind *lsk)
 {
 	int err = -1;
 
 	// Pass a zero for addr_size, we'll get it after we load via btf__pointer_size()
-	struct cu *cu = cu__new(filename, 0, NULL, 0, filename, false);
+	struct cu *cu = cu__new(filename, 0, NULL, 0, filename, true);
 	if (cu == NULL)
 		return -1;
 
 	cu->language = LANG_C;
 	cu->uses_global_strings = false;
 	cu->dfops = &btf__ops;
+	cu->seq = seq;
 
 	libbpf_set_print(libbpf_log);
 
+	struct btf_cu *bcu = zalloc(sizeof(*bcu));
+	if (bcu == NULL)
+		goto out_free;
+
+	cu->priv = bcu;
+	bcu->conf = conf;
+
 	struct btf *btf = btf__parse_split(filename, conf->base_btf);
 
 	err = libbpf_get_error(btf);
 	if (err)
 		goto out_free;
 
-	cu->priv = btf;
+	bcu->btf = btf;
 	cu->little_endian = btf__endianness(btf) == BTF_LITTLE_ENDIAN;
 	cu->addr_size	  = btf__pointer_size(btf);
 
+	/*
+	 * Just the types looked up by name, and what is reachable from them, will
+	 * be loaded, e.g. for 'pahole -C task_struct /sys/kernel/btf/vmlinux'.
+	 */
+	if (conf->lazy_types) {
+		bcu->loaded = zalloc((btf__type_cnt(btf) + 7) / 8);
+		if (bcu->loaded == NULL) {
+			err = -ENOMEM;
+			goto out_free;
+		}
+		cu->lazy_types = 1;
+		goto steal;
+	}
+
 	err = btf__load_sections(btf, cu);
 	if (err != 0)
 		goto out_free;
 
 	err = cu__fixup_btf_bitfields(conf, cu);
+steal:
 	/*
 	 * The app stole this cu, possibly deleting it,
 	 * so forget about it
 	 */
-	if (conf && conf->steal && conf->steal(cu, conf, NULL))
+	*lsk = conf && conf->steal ? conf->steal(cu, conf, thr_data) : LSK__KEEPIT;
+	if (*lsk != LSK__KEEPIT)
 		return 0;
 
 	cus__add(cus, cu);
 	return err;
 
 out_free:
-	cu__delete(cu); // will call btf__free(cu->priv);
+	cu__delete(cu); // will call btf__cu_delete()
 	return err;
 }
 
+static int cus__load_btf(struct cus *cus, struct conf_load *conf, const char *filename)
+{
+	enum load_steal_kind lsk;
+
+	return __cus__load_btf(cus, conf, filename, 0, NULL, &lsk);
+}
+
+/*
+ * struct btf_files_loader - state shared by the threads loading BTF files
+ *
+ * @next - index in @filenames of the next file to load
+ * @failed - index of the first file that failed to load, when @error is set
+ * @stop - some file failed to load or the app asked to stop loading
+ */
+struct btf_files_loader {
+	struct cus	 *cus;
+	struct conf_load *conf;
+	char		 **filenames;
+	pthread_mutex_t	 lock;
+	int		 nr_files;
+	int		 next;
+	int		 failed;
+	int		 error;
+	bool		 stop;
+};
+
+struct btf_files_thread {
+	struct btf_files_loader *loader;
+	void			*data;
+};
+
+static void btf_files_loader__set_error(struct btf_files_loader *loader, int idx, int err)
+{
+	pthread_mutex_lock(&loader->lock);
+	loader->stop = true;
+	if (err != 0 && (loader->error == 0 || idx < loader->failed)) {
+		loader->error  = err;
+		loader->failed = idx;
+	}
+	pthread_mutex_unlock(&loader->lock);
+}
+
+static void *btf_files_loader__thread(void *arg)
+{
+	struct btf_files_thread *thread = arg;
+	struct btf_files_loader *loader = thread->loader;
+	struct conf_load *conf = loader->conf;
+
+	while (1) {
+		enum load_steal_kind lsk = LSK__KEEPIT;
+		int idx, err;
+
+		pthread_mutex_lock(&loader->lock);
+		idx = loader->stop ? loader->nr_files : loader->next++;
+		pthread_mutex_unlock(&loader->lock);
+
+		if (idx >= loader->nr_files)
+			break;
+
+		// The CU order is the file order, for tools keeping the output in order
+		err = __cus__load_btf(loader->cus, conf, loader->filenames[idx], idx, thread->data, &lsk);
+		if (err != 0 || lsk == LSK__STOP_LOADING)
+			btf_files_loader__set_error(loader, idx, err);
+	}
+
+	if (conf->thread_exit && conf->thread_exit(conf, thread->data) != 0)
+		btf_files_loader__set_error(loader, loader->nr_files - 1, -EINVAL);
+
+	return NULL;
+}
+
+static bool btf__is_raw_file(const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+	uint16_t magic;
+	bool is_raw;
+
+	if (fd < 0)
+		return false;
+
+	is_raw = read(fd, &magic, sizeof(magic)) == sizeof(magic) &&
+		 (magic == BTF_MAGIC || magic == bswap_16(BTF_MAGIC));
+	close(fd);
+	return is_raw;
+}
+
+/*
+ * Load raw BTF files, such as the ones in /sys/kernel/btf/, using up to
+ * conf->nr_jobs threads, each file in its own CU, all split against the
+ * already parsed conf->base_btf, if any.
+ */
+static int cus__load_btf_files(struct cus *cus, struct conf_load *conf, char *filenames[],
+			       int nr_files, int *failed)
+{
+	const int nr_threads = conf->nr_jobs < nr_files ? conf->nr_jobs : nr_files;
+	struct btf_files_loader loader = {
+		.cus	   = cus,
+		.conf	   = conf,
+		.filenames = filenames,
+		.nr_files  = nr_files,
+	};
+	struct btf_files_thread threads[nr_threads];
+	pthread_t thread_ids[nr_threads];
+	void *thread_data[nr_threads];
+	int i, err;
+
+	// ELF files may have DWARF as well, leave those to cus__load_file()
+	for (i = 0; i < nr_files; ++i)
+		if (!btf__is_raw_file(filenames[i]))
+			return -ENOTSUP;
+
+	if (conf->threads_prepare) {
+		err = conf->threads_prepare(conf, nr_threads, thread_data);
+		if (err != 0)
+			return err;
+	} else {
+		memset(thread_data, 0, sizeof(thread_data));
+	}
+
+	pthread_mutex_init(&loader.lock, NULL);
+
+	for (i = 0; i < nr_threads; ++i) {
+		threads[i].loader = &loader;
+		threads[i].data	  = thread_data[i];
+
+		err = pthread_create(&thread_ids[i], NULL, btf_files_loader__thread, &threads[i]);
+		if (err != 0) {
+			// Go on with the threads already created, if any
+			if (i == 0)
+				btf_files_loader__set_error(&loader, 0, -err);
+			break;
+		}
+	}
+
+	while (--i >= 0)
+		pthread_join(thread_ids[i], NULL);
+
+	if (conf->threads_collect) {
+		err = conf->threads_collect(conf, nr_threads, thread_data, loader.error);
+		if (loader.error == 0)
+			loader.error = err;
+	}
+
+	pthread_mutex_destroy(&loader.lock);
+	*failed = loader.failed;
+	return loader.error;
+}
+
 struct debug_fmt_ops btf__ops = {
-	.name		= "btf",
-	.load_file	= cus__load_btf,
-	.cu__delete	= btf__cu_delete,
+	.name			= "btf",
+	.load_file		= cus__load_btf,
+	.load_files		= cus__load_btf_files,
+	.cu__delete		= btf__cu_delete,
+	.cu__load_type		= cu__load_btf_type,
+	.cu__load_types_by_name	= cu__load_btf_types_by_name,
 };
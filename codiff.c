@@ -661,6 +661,13 @@ static int cu_show_diffs_iterator(struct cu *cu, void *cookie)
 	return 0;
 }
 
+static int cu_cache_tag_names(struct cu *cu, void *cookie __maybe_unused)
+{
+	// The same member and parameter types get their names compared over and over
+	cu__cache_tag_names(cu);
+	return 0;
+}
+
 static int cu_delete_priv(struct cu *cu, void *cookie __maybe_unused)
 {
 	struct class *c;
@@ -825,6 +832,8 @@ failure:
 		}
 	}
 
+	cus__for_each_cu(old_cus, cu_cache_tag_names, NULL, NULL);
+	cus__for_each_cu(new_cus, cu_cache_tag_names, NULL, NULL);
 	cus__for_each_cu(old_cus, cu_diff_iterator, new_cus, NULL);
 	cus__for_each_cu(new_cus, cu_find_new_tags_iterator, old_cus, NULL);
 	cus__for_each_cu(old_cus, cu_show_diffs_iterator, NULL, NULL);
@@ -69,6 +69,9 @@ struct ctf_full_type {
 #define CTF_GET_VLEN(VAL)	((VAL) & 0x3ff)
 #define CTF_ISROOT(VAL)		(((VAL) & 0x400) != 0)
 
+#define CTF_MAX_VLEN		0x3ff	/* Max members, enumerators or parameters */
+#define CTF_MAX_PTYPE		0x7fff	/* Max type id in a parent container */
+
 #define CTF_INFO_ENCODE(KIND, VLEN, ISROOT) \
 	(((ISROOT) ? 0x400 : 0) | ((KIND) << 11) | (VLEN))
 
@@ -8,280 +8,1011 @@
 #include "dwarves.h"
 #include "libctf.h"
 #include "ctf.h"
+#include "ctf_encoder.h"
+#include "gobuffer.h"
 #include "hash.h"
 #include "elf_symtab.h"
+#include <errno.h>
 #include <inttypes.h>
+#include <stdlib.h> /* for qsort() and bsearch() */
+#include <string.h>
 
-static int tag__check_id_drift(const struct tag *tag,
-			       uint32_t core_id, uint32_t ctf_id)
-{
-	if (ctf_id != core_id) {
-		fprintf(stderr, "%s: %s id drift, core: %u, libctf: %d\n",
-			__func__, dwarf_tag_name(tag->tag), core_id, ctf_id);
-		return -1;
-	}
-	return 0;
-}
+/*
+ * Types from all the CUs are deduplicated into a single table, in the spirit
+ * of what libbpf's btf__dedup() does for BTF: each type gets a structural
+ * hash that doesn't look past struct, union and enum boundaries, and types
+ * with the same hash are then compared deeply, assuming that the types being
+ * compared are equivalent when a cycle is found, i.e. hypothetically mapping
+ * the CU types to the already encoded ones, committing the mapping if the
+ * whole graph matches.
+ */
+
+/*
+ * struct ctf_encoder_member - member of a struct/union, enumerator or parameter
+ *
+ * @offset - bit offset for members, value for enumerators
+ * @name - offset in the encoder strings table
+ * @type - global CTF type id
+ */
+struct ctf_encoder_member {
+	uint64_t offset;
+	uint32_t name;
+	uint32_t type;
+};
+
+/*
+ * struct ctf_encoder_type - deduplicated type, with global CTF type ids
+ *
+ * @size - bytes for structs, unions and enums, bits for base types,
+ *	   number of elements for arrays
+ * @name - offset in the encoder strings table
+ * @type - pointed to, qualified, aliased, element or return type
+ * @hash - see ctf_encoder_cu__hash()
+ * @kind - CTF_TYPE_KIND_*
+ * @nr_members - number of entries in @members
+ * @varargs - function prototype with a variable number of arguments
+ * @complete - all its references were resolved, can be compared
+ * @members - members, enumerators or parameters
+ */
+struct ctf_encoder_type {
+	uint64_t		  size;
+	uint32_t		  name;
+	uint32_t		  type;
+	uint32_t		  hash;
+	uint16_t		  kind;
+	uint16_t		  nr_members;
+	bool			  varargs;
+	bool			  complete;
+	struct ctf_encoder_member *members;
+};
+
+struct ctf_encoder_function {
+	uint64_t  addr;
+	uint32_t  type;
+	uint16_t  nr_parms;
+	bool	  varargs;
+	uint32_t *parms;
+};
+
+struct ctf_encoder_variable {
+	uint64_t addr;
+	uint32_t type;
+};
+
+struct ctf_encoder_string {
+	uint32_t hash;
+	uint32_t offset;
+};
+
+struct ctf_encoder {
+	char			*filename;
+	struct gobuffer		strings;
+	bool			verbose;
+	int			nr_jobs;
+	struct {
+		struct ctf_encoder_string *entries;
+		uint32_t		  size;
+		uint32_t		  cnt;
+	} strings_table;
+	struct {
+		struct ctf_encoder_type	*entries;
+		uint32_t		allocated;
+		uint32_t		cnt;
+	} types;
+	struct {
+		uint32_t		*entries;
+		uint32_t		size;
+		uint32_t		cnt;
+	} types_table;
+	struct {
+		struct ctf_encoder_function *entries;
+		uint32_t		    allocated;
+		uint32_t		    cnt;
+	} functions;
+	struct {
+		struct ctf_encoder_variable *entries;
+		uint32_t		    allocated;
+		uint32_t		    cnt;
+	} variables;
+};
+
+/*
+ * struct ctf_encoder_cu - state for encoding one CU
+ *
+ * @ids - CU type id to global CTF type id, CTF_ENCODER__UNMAPPED if not
+ *	  resolved yet
+ * @hypot - tentative mapping while comparing a CU type to an encoded one
+ * @hypot_list - CU type ids with a @hypot entry, to commit or undo it
+ * @hashes - cached ctf_encoder_cu__hash() results, 0 if not computed yet
+ */
+struct ctf_encoder_cu {
+	struct ctf_encoder *encoder;
+	struct cu	   *cu;
+	uint32_t	   *ids;
+	uint32_t	   *hypot;
+	uint32_t	   *hypot_list;
+	uint32_t	   nr_hypot;
+	uint32_t	   *hashes;
+};
+
+#define CTF_ENCODER__UNMAPPED UINT32_MAX
 
-static int dwarf_to_ctf_type(uint16_t tag)
+static uint16_t tag__ctf_kind(const struct tag *tag)
 {
-	switch (tag) {
+	switch (tag->tag) {
+	case DW_TAG_base_type:		return CTF_TYPE_KIND_INT;
 	case DW_TAG_const_type:		return CTF_TYPE_KIND_CONST;
 	case DW_TAG_pointer_type:	return CTF_TYPE_KIND_PTR;
 	case DW_TAG_restrict_type:	return CTF_TYPE_KIND_RESTRICT;
 	case DW_TAG_volatile_type:	return CTF_TYPE_KIND_VOLATILE;
+	case DW_TAG_typedef:		return CTF_TYPE_KIND_TYPDEF;
+	case DW_TAG_array_type:		return CTF_TYPE_KIND_ARR;
+	case DW_TAG_subroutine_type:	return CTF_TYPE_KIND_FUNC;
 	case DW_TAG_class_type:
-	case DW_TAG_structure_type:	return CTF_TYPE_KIND_STR;
-	case DW_TAG_union_type:		return CTF_TYPE_KIND_UNION;
+	case DW_TAG_structure_type:
+		return tag__type(tag)->declaration ? CTF_TYPE_KIND_FWD : CTF_TYPE_KIND_STR;
+	case DW_TAG_union_type:
+		return tag__type(tag)->declaration ? CTF_TYPE_KIND_FWD : CTF_TYPE_KIND_UNION;
+	case DW_TAG_enumeration_type:
+		return tag__type(tag)->declaration ? CTF_TYPE_KIND_FWD : CTF_TYPE_KIND_ENUM;
 	}
-	return 0xffff;
+	return CTF_TYPE_KIND_UNKN;
 }
 
-static int base_type__encode(struct tag *tag, uint32_t core_id, struct ctf *ctf)
+static const char *tag__ctf_name(const struct tag *tag)
 {
-	struct base_type *bt = tag__base_type(tag);
-	uint32_t ctf_id = ctf__add_base_type(ctf, bt->name, bt->bit_size);
+	switch (tag->tag) {
+	case DW_TAG_base_type:
+		return tag__base_type(tag)->name;
+	case DW_TAG_typedef:
+	case DW_TAG_class_type:
+	case DW_TAG_structure_type:
+	case DW_TAG_union_type:
+	case DW_TAG_enumeration_type:
+		return tag__namespace(tag)->name;
+	}
+	return NULL;
+}
 
-	if (tag__check_id_drift(tag, core_id, ctf_id))
-		return -1;
+static uint32_t array_type__nelems(struct tag *tag)
+{
+	int i;
+	uint32_t nelem = 1;
+	struct array_type *array = tag__array_type(tag);
 
-	return 0;
+	for (i = array->dimensions - 1; i >= 0; --i)
+		nelem *= array->nr_entries[i];
+
+	return nelem;
 }
 
-static int pointer_type__encode(struct tag *tag, uint32_t core_id, struct ctf *ctf)
+static const char *ctf_encoder__string(const struct ctf_encoder *encoder, uint32_t offset)
 {
-	uint32_t ctf_id = ctf__add_short_type(ctf, dwarf_to_ctf_type(tag->tag), tag->type, 0);
+	return offset ? gobuffer__ptr(&encoder->strings, offset) : "";
+}
 
-	if (tag__check_id_drift(tag, core_id, ctf_id))
-		return -1;
+static int ctf_encoder__grow_strings_table(struct ctf_encoder *encoder)
+{
+	uint32_t size = encoder->strings_table.size ? encoder->strings_table.size * 2 : 1024, i;
+	struct ctf_encoder_string *entries = calloc(size, sizeof(*entries));
+
+	if (entries == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < encoder->strings_table.size; ++i) {
+		const struct ctf_encoder_string *s = &encoder->strings_table.entries[i];
+		uint32_t bucket = s->hash & (size - 1);
+
+		if (s->offset == 0)
+			continue;
 
+		while (entries[bucket].offset != 0)
+			bucket = (bucket + 1) & (size - 1);
+
+		entries[bucket] = *s;
+	}
+
+	free(encoder->strings_table.entries);
+	encoder->strings_table.entries = entries;
+	encoder->strings_table.size = size;
 	return 0;
 }
 
-static int typedef__encode(struct tag *tag, uint32_t core_id, struct ctf *ctf)
+/* Returns the offset of @s in the strings table, adding it if not there */
+static int ctf_encoder__add_string(struct ctf_encoder *encoder, const char *s)
 {
-	uint32_t ctf_id = ctf__add_short_type(ctf, CTF_TYPE_KIND_TYPDEF, tag->type, tag__namespace(tag)->name);
+	uint32_t hash, bucket;
+	int offset;
 
-	if (tag__check_id_drift(tag, core_id, ctf_id))
-		return -1;
+	if (s == NULL || s[0] == '\0')
+		return 0;
+
+	if ((encoder->strings_table.cnt + 1) * 2 > encoder->strings_table.size &&
+	    ctf_encoder__grow_strings_table(encoder))
+		return -ENOMEM;
+
+	hash = hash_str(HASH_BYTES__INIT, s);
+	bucket = hash & (encoder->strings_table.size - 1);
+
+	while (encoder->strings_table.entries[bucket].offset != 0) {
+		const struct ctf_encoder_string *entry = &encoder->strings_table.entries[bucket];
+
+		if (entry->hash == hash && strcmp(ctf_encoder__string(encoder, entry->offset), s) == 0)
+			return entry->offset;
+
+		bucket = (bucket + 1) & (encoder->strings_table.size - 1);
+	}
+
+	offset = gobuffer__add(&encoder->strings, s, strlen(s) + 1);
+	if (offset < 0)
+		return -ENOMEM;
 
+	encoder->strings_table.entries[bucket].hash = hash;
+	encoder->strings_table.entries[bucket].offset = offset;
+	++encoder->strings_table.cnt;
+	return offset;
+}
+
+static int ctf_encoder__grow_types_table(struct ctf_encoder *encoder)
+{
+	uint32_t size = encoder->types_table.size ? encoder->types_table.size * 2 : 1024, i;
+	uint32_t *entries = calloc(size, sizeof(*entries));
+
+	if (entries == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < encoder->types_table.size; ++i) {
+		const uint32_t id = encoder->types_table.entries[i];
+		uint32_t bucket;
+
+		if (id == 0)
+			continue;
+
+		bucket = encoder->types.entries[id].hash & (size - 1);
+		while (entries[bucket] != 0)
+			bucket = (bucket + 1) & (size - 1);
+
+		entries[bucket] = id;
+	}
+
+	free(encoder->types_table.entries);
+	encoder->types_table.entries = entries;
+	encoder->types_table.size = size;
 	return 0;
 }
 
-static int fwd_decl__encode(struct tag *tag, uint32_t core_id, struct ctf *ctf)
+static int ctf_encoder__hash_type(struct ctf_encoder *encoder, uint32_t id)
 {
-	uint32_t ctf_id = ctf__add_fwd_decl(ctf, tag__namespace(tag)->name);
+	uint32_t bucket;
 
-	if (tag__check_id_drift(tag, core_id, ctf_id))
-		return -1;
+	if ((encoder->types_table.cnt + 1) * 2 > encoder->types_table.size &&
+	    ctf_encoder__grow_types_table(encoder))
+		return -ENOMEM;
+
+	bucket = encoder->types.entries[id].hash & (encoder->types_table.size - 1);
+	while (encoder->types_table.entries[bucket] != 0)
+		bucket = (bucket + 1) & (encoder->types_table.size - 1);
 
+	encoder->types_table.entries[bucket] = id;
+	++encoder->types_table.cnt;
 	return 0;
 }
 
-static int structure_type__encode(struct tag *tag, uint32_t core_id, struct ctf *ctf)
+/* Reserves a global CTF type id, void, i.e. 0, is never stored */
+static int ctf_encoder__new_type(struct ctf_encoder *encoder)
 {
-	struct type *type = tag__type(tag);
-	int64_t position;
-	uint32_t ctf_id = ctf__add_struct(ctf, dwarf_to_ctf_type(tag->tag),
-				     type->namespace.name, type->size,
-				     type->nr_members, &position);
+	if (encoder->types.cnt == 0)
+		encoder->types.cnt = 1;
 
-	if (tag__check_id_drift(tag, core_id, ctf_id))
-		return -1;
+	if (encoder->types.cnt > CTF_MAX_PTYPE) {
+		fprintf(stderr, "pahole: more than %u types, can't encode it as CTF\n", CTF_MAX_PTYPE);
+		return -E2BIG;
+	}
 
-	const bool is_short = type->size < CTF_SHORT_MEMBER_LIMIT;
-	struct class_member *pos;
-	type__for_each_data_member(type, pos) {
-		if (is_short)
-			ctf__add_short_member(ctf, pos->name, pos->tag.type,
-					      pos->bit_offset, &position);
-		else
-			ctf__add_full_member(ctf, pos->name, pos->tag.type,
-					     pos->bit_offset, &position);
+	if (encoder->types.cnt == encoder->types.allocated) {
+		uint32_t allocated = encoder->types.allocated ? encoder->types.allocated * 3 / 2 : 1024;
+		struct ctf_encoder_type *entries = realloc(encoder->types.entries, allocated * sizeof(*entries));
+
+		if (entries == NULL)
+			return -ENOMEM;
+
+		encoder->types.entries = entries;
+		encoder->types.allocated = allocated;
 	}
 
-	return 0;
+	memset(&encoder->types.entries[encoder->types.cnt], 0, sizeof(encoder->types.entries[0]));
+	return encoder->types.cnt++;
 }
 
-static uint32_t array_type__nelems(struct tag *tag)
+/*
+ * The struct/union members encoded in CTF, i.e. not DW_TAG_inheritance entries
+ * nor static members, that don't take space in instances.
+ */
+static bool class_member_layout__is_ctf_member(const struct class_member_layout *member)
 {
-	int i;
-	uint32_t nelem = 1;
-	struct array_type *array = tag__array_type(tag);
+	return !member->is_inheritance && !member->is_static;
+}
 
-	for (i = array->dimensions - 1; i >= 0; --i)
-		nelem *= array->nr_entries[i];
+static uint32_t type__nr_ctf_members(const struct type *type)
+{
+	const struct class_member_layout *pos;
+	uint32_t nr_members = 0;
 
-	return nelem;
+	type__for_each_member_layout(type, pos) {
+		if (class_member_layout__is_ctf_member(pos))
+			++nr_members;
+	}
+
+	return nr_members;
 }
 
-static int array_type__encode(struct tag *tag, uint32_t core_id, struct ctf *ctf)
+/*
+ * Structural hash of a CU type, members of structs and unions are hashed by
+ * name and offset only, so that cycles are never followed, what is left to
+ * ctf_encoder_cu__equiv().
+ */
+static uint32_t ctf_encoder_cu__hash(struct ctf_encoder_cu *ecu, uint32_t id)
 {
-	const uint32_t nelems = array_type__nelems(tag);
-	uint32_t ctf_id = ctf__add_array(ctf, tag->type, 0, nelems);
+	struct tag *tag;
+	uint16_t kind;
+	uint64_t hash;
 
-	if (tag__check_id_drift(tag, core_id, ctf_id))
-		return -1;
+	if (id == 0)
+		return 0;
 
-	return 0;
+	if (ecu->hashes[id] != 0)
+		return ecu->hashes[id];
+
+	tag = cu__type(ecu->cu, id);
+	if (tag == NULL)
+		return 0;
+
+	kind = tag__ctf_kind(tag);
+	hash = hash_bytes(HASH_BYTES__INIT, &kind, sizeof(kind));
+	hash = hash_str(hash, tag__ctf_name(tag) ?: "");
+
+	switch (kind) {
+	case CTF_TYPE_KIND_INT: {
+		const uint16_t bit_size = tag__base_type(tag)->bit_size;
+
+		hash = hash_bytes(hash, &bit_size, sizeof(bit_size));
+		break;
+	}
+	case CTF_TYPE_KIND_ARR: {
+		const uint32_t nelems = array_type__nelems(tag);
+
+		hash = hash_bytes(hash, &nelems, sizeof(nelems));
+	}
+		/* fall thru */
+	case CTF_TYPE_KIND_PTR:
+	case CTF_TYPE_KIND_CONST:
+	case CTF_TYPE_KIND_VOLATILE:
+	case CTF_TYPE_KIND_RESTRICT:
+	case CTF_TYPE_KIND_TYPDEF: {
+		const uint32_t type_hash = ctf_encoder_cu__hash(ecu, tag->type);
+
+		hash = hash_bytes(hash, &type_hash, sizeof(type_hash));
+		break;
+	}
+	case CTF_TYPE_KIND_FUNC: {
+		const struct ftype *ftype = tag__ftype(tag);
+		const uint32_t type_hash = ctf_encoder_cu__hash(ecu, tag->type);
+		const uint16_t nr_parms = ftype->nr_parms;
+
+		hash = hash_bytes(hash, &type_hash, sizeof(type_hash));
+		hash = hash_bytes(hash, &nr_parms, sizeof(nr_parms));
+		hash = hash_bytes(hash, &ftype->unspec_parms, sizeof(ftype->unspec_parms));
+		break;
+	}
+	case CTF_TYPE_KIND_STR:
+	case CTF_TYPE_KIND_UNION: {
+		struct type *type = tag__type(tag);
+		const struct class_member_layout *pos;
+
+		hash = hash_bytes(hash, &type->size, sizeof(type->size));
+		type__for_each_member_layout(type, pos) {
+			if (!class_member_layout__is_ctf_member(pos))
+				continue;
+			hash = hash_str(hash, pos->name ?: "");
+			hash = hash_bytes(hash, &pos->bit_offset, sizeof(pos->bit_offset));
+		}
+		break;
+	}
+	case CTF_TYPE_KIND_ENUM: {
+		struct type *type = tag__type(tag);
+		struct enumerator *pos;
+
+		hash = hash_bytes(hash, &type->size, sizeof(type->size));
+		type__for_each_enumerator(type, pos) {
+			hash = hash_str(hash, pos->name ?: "");
+			hash = hash_bytes(hash, &pos->value, sizeof(pos->value));
+		}
+		break;
+	}
+	}
+
+	ecu->hashes[id] = (uint32_t)(hash ^ (hash >> 32)) ?: 1;
+	return ecu->hashes[id];
 }
 
-static int subroutine_type__encode(struct tag *tag, uint32_t core_id, struct ctf *ctf)
+static bool ctf_encoder_cu__equiv(struct ctf_encoder_cu *ecu, uint32_t id, uint32_t ctf_id);
+
+static bool ctf_encoder_cu__equiv_members(struct ctf_encoder_cu *ecu, struct tag *tag, uint32_t ctf_id)
 {
-	struct parameter *pos;
-	int64_t position;
-	struct ftype *ftype = tag__ftype(tag);
-	uint32_t ctf_id = ctf__add_function_type(ctf, tag->type, ftype->nr_parms, ftype->unspec_parms, &position);
+	const struct ctf_encoder *encoder = ecu->encoder;
+	uint32_t i = 0;
 
-	if (tag__check_id_drift(tag, core_id, ctf_id))
-		return -1;
+	switch (encoder->types.entries[ctf_id].kind) {
+	case CTF_TYPE_KIND_FUNC: {
+		struct parameter *pos;
+
+		ftype__for_each_parameter(tag__ftype(tag), pos) {
+			if (!ctf_encoder_cu__equiv(ecu, pos->tag.type, encoder->types.entries[ctf_id].members[i++].type))
+				return false;
+		}
+		break;
+	}
+	case CTF_TYPE_KIND_STR:
+	case CTF_TYPE_KIND_UNION: {
+		const struct class_member_layout *pos;
 
-	ftype__for_each_parameter(ftype, pos)
-		ctf__add_parameter(ctf, pos->tag.type, &position);
+		type__for_each_member_layout(tag__type(tag), pos) {
+			if (!class_member_layout__is_ctf_member(pos))
+				continue;
 
-	return 0;
+			const struct ctf_encoder_member *member = &encoder->types.entries[ctf_id].members[i++];
+
+			if (member->offset != pos->bit_offset ||
+			    strcmp(ctf_encoder__string(encoder, member->name), pos->name ?: "") ||
+			    !ctf_encoder_cu__equiv(ecu, pos->type, member->type))
+				return false;
+		}
+		break;
+	}
+	case CTF_TYPE_KIND_ENUM: {
+		struct enumerator *pos;
+
+		type__for_each_enumerator(tag__type(tag), pos) {
+			const struct ctf_encoder_member *member = &encoder->types.entries[ctf_id].members[i++];
+
+			if (member->offset != pos->value ||
+			    strcmp(ctf_encoder__string(encoder, member->name), pos->name ?: ""))
+				return false;
+		}
+		break;
+	}
+	}
+
+	return true;
 }
 
-static int enumeration_type__encode(struct tag *tag, uint32_t core_id, struct ctf *ctf)
+/*
+ * Checks if the CU type @id is equivalent to the already encoded @ctf_id,
+ * recording the assumptions made in ecu->hypot, to cope with cycles.
+ */
+static bool ctf_encoder_cu__equiv(struct ctf_encoder_cu *ecu, uint32_t id, uint32_t ctf_id)
 {
-	struct type *etype = tag__type(tag);
-	int64_t position;
-	uint32_t ctf_id = ctf__add_enumeration_type(ctf, etype->namespace.name,
-					       etype->size, etype->nr_members,
-					       &position);
+	const struct ctf_encoder_type *type;
+	struct tag *tag;
 
-	if (tag__check_id_drift(tag, core_id, ctf_id))
-		return -1;
+	if (id == 0)
+		return ctf_id == 0;
 
-	struct enumerator *pos;
-	type__for_each_enumerator(etype, pos)
-		ctf__add_enumerator(ctf, pos->name, pos->value, &position);
+	if (ecu->ids[id] != CTF_ENCODER__UNMAPPED)
+		return ecu->ids[id] == ctf_id;
 
-	return 0;
+	if (ecu->hypot[id] != CTF_ENCODER__UNMAPPED)
+		return ecu->hypot[id] == ctf_id;
+
+	/* Types that can't be encoded in CTF are resolved to void */
+	tag = cu__type(ecu->cu, id);
+	if (tag == NULL || tag__ctf_kind(tag) == CTF_TYPE_KIND_UNKN)
+		return ctf_id == 0;
+
+	if (ctf_id == 0)
+		return false;
+
+	type = &ecu->encoder->types.entries[ctf_id];
+	/* Still being encoded, only what was mapped to it can be equivalent */
+	if (!type->complete)
+		return false;
+
+	if (type->hash != ctf_encoder_cu__hash(ecu, id) ||
+	    type->kind != tag__ctf_kind(tag) ||
+	    strcmp(ctf_encoder__string(ecu->encoder, type->name), tag__ctf_name(tag) ?: ""))
+		return false;
+
+	ecu->hypot[id] = ctf_id;
+	ecu->hypot_list[ecu->nr_hypot++] = id;
+
+	switch (type->kind) {
+	case CTF_TYPE_KIND_INT:
+		return type->size == tag__base_type(tag)->bit_size;
+	case CTF_TYPE_KIND_FWD:
+		return true;
+	case CTF_TYPE_KIND_ARR:
+		if (type->size != array_type__nelems(tag))
+			return false;
+		/* fall thru */
+	case CTF_TYPE_KIND_PTR:
+	case CTF_TYPE_KIND_CONST:
+	case CTF_TYPE_KIND_VOLATILE:
+	case CTF_TYPE_KIND_RESTRICT:
+	case CTF_TYPE_KIND_TYPDEF:
+		return ctf_encoder_cu__equiv(ecu, tag->type, type->type);
+	case CTF_TYPE_KIND_FUNC:
+		if (type->nr_members != tag__ftype(tag)->nr_parms ||
+		    type->varargs != tag__ftype(tag)->unspec_parms ||
+		    !ctf_encoder_cu__equiv(ecu, tag->type, type->type))
+			return false;
+		break;
+	case CTF_TYPE_KIND_STR:
+	case CTF_TYPE_KIND_UNION:
+		if (type->size != tag__type(tag)->size ||
+		    type->nr_members != type__nr_ctf_members(tag__type(tag)))
+			return false;
+		break;
+	case CTF_TYPE_KIND_ENUM:
+		if (type->size != tag__type(tag)->size ||
+		    type->nr_members != tag__type(tag)->nr_members)
+			return false;
+		break;
+	}
+
+	return ctf_encoder_cu__equiv_members(ecu, tag, ctf_id);
 }
 
-static void tag__encode_ctf(struct tag *tag, uint32_t core_id, struct ctf *ctf)
+static void ctf_encoder_cu__end_hypot(struct ctf_encoder_cu *ecu, bool commit)
 {
-	switch (tag->tag) {
-	case DW_TAG_base_type:
-		base_type__encode(tag, core_id, ctf);
+	uint32_t i;
+
+	for (i = 0; i < ecu->nr_hypot; ++i) {
+		const uint32_t id = ecu->hypot_list[i];
+
+		if (commit)
+			ecu->ids[id] = ecu->hypot[id];
+		ecu->hypot[id] = CTF_ENCODER__UNMAPPED;
+	}
+
+	ecu->nr_hypot = 0;
+}
+
+static int64_t ctf_encoder_cu__resolve(struct ctf_encoder_cu *ecu, uint32_t id);
+
+static int ctf_encoder_cu__add_members(struct ctf_encoder_cu *ecu, struct tag *tag, uint32_t ctf_id)
+{
+	struct ctf_encoder *encoder = ecu->encoder;
+	struct ctf_encoder_member *members;
+	uint32_t i = 0;
+	int64_t type;
+	int name;
+
+	members = calloc(encoder->types.entries[ctf_id].nr_members, sizeof(*members));
+	if (members == NULL)
+		return -ENOMEM;
+	encoder->types.entries[ctf_id].members = members;
+
+	switch (encoder->types.entries[ctf_id].kind) {
+	case CTF_TYPE_KIND_FUNC: {
+		struct parameter *pos;
+
+		ftype__for_each_parameter(tag__ftype(tag), pos) {
+			type = ctf_encoder_cu__resolve(ecu, pos->tag.type);
+			if (type < 0)
+				return type;
+			members[i++].type = type;
+		}
 		break;
-	case DW_TAG_const_type:
-	case DW_TAG_pointer_type:
-	case DW_TAG_restrict_type:
-	case DW_TAG_volatile_type:
-		pointer_type__encode(tag, core_id, ctf);
+	}
+	case CTF_TYPE_KIND_STR:
+	case CTF_TYPE_KIND_UNION: {
+		const struct class_member_layout *pos;
+
+		type__for_each_member_layout(tag__type(tag), pos) {
+			if (!class_member_layout__is_ctf_member(pos))
+				continue;
+			name = ctf_encoder__add_string(encoder, pos->name);
+			if (name < 0)
+				return name;
+			type = ctf_encoder_cu__resolve(ecu, pos->type);
+			if (type < 0)
+				return type;
+			members[i].name	  = name;
+			members[i].offset = pos->bit_offset;
+			members[i++].type = type;
+		}
 		break;
-	case DW_TAG_typedef:
-		typedef__encode(tag, core_id, ctf);
+	}
+	case CTF_TYPE_KIND_ENUM: {
+		struct enumerator *pos;
+
+		type__for_each_enumerator(tag__type(tag), pos) {
+			name = ctf_encoder__add_string(encoder, pos->name);
+			if (name < 0)
+				return name;
+			members[i].name	    = name;
+			members[i++].offset = pos->value;
+		}
 		break;
-	case DW_TAG_structure_type:
-	case DW_TAG_union_type:
-	case DW_TAG_class_type:
-		if (tag__type(tag)->declaration)
-			fwd_decl__encode(tag, core_id, ctf);
-		else
-			structure_type__encode(tag, core_id, ctf);
+	}
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the global CTF type id for the CU type @id, either an already
+ * encoded equivalent one or a new one, or a negative errno.
+ */
+static int64_t ctf_encoder_cu__resolve(struct ctf_encoder_cu *ecu, uint32_t id)
+{
+	struct ctf_encoder *encoder = ecu->encoder;
+	uint32_t hash, bucket, mask;
+	struct ctf_encoder_type *type;
+	int64_t target;
+	struct tag *tag;
+	int ctf_id, name, err;
+
+	if (id == 0)
+		return 0;
+
+	if (ecu->ids[id] != CTF_ENCODER__UNMAPPED)
+		return ecu->ids[id];
+
+	tag = cu__type(ecu->cu, id);
+	if (tag == NULL || tag__ctf_kind(tag) == CTF_TYPE_KIND_UNKN) {
+		ecu->ids[id] = 0;
+		return 0;
+	}
+
+	hash = ctf_encoder_cu__hash(ecu, id);
+	mask = encoder->types_table.size - 1;
+	for (bucket = hash & mask; encoder->types_table.size != 0 &&
+				   encoder->types_table.entries[bucket] != 0; bucket = (bucket + 1) & mask) {
+		const uint32_t candidate = encoder->types_table.entries[bucket];
+
+		if (encoder->types.entries[candidate].hash != hash)
+			continue;
+
+		if (ctf_encoder_cu__equiv(ecu, id, candidate)) {
+			ctf_encoder_cu__end_hypot(ecu, true);
+			return candidate;
+		}
+
+		ctf_encoder_cu__end_hypot(ecu, false);
+	}
+
+	ctf_id = ctf_encoder__new_type(encoder);
+	if (ctf_id < 0)
+		return ctf_id;
+
+	name = ctf_encoder__add_string(encoder, tag__ctf_name(tag));
+	if (name < 0)
+		return name;
+
+	/* Set before resolving the references, that may point back to it */
+	ecu->ids[id] = ctf_id;
+
+	type = &encoder->types.entries[ctf_id];
+	type->kind = tag__ctf_kind(tag);
+	type->name = name;
+	type->hash = hash;
+
+	switch (type->kind) {
+	case CTF_TYPE_KIND_INT:
+		type->size = tag__base_type(tag)->bit_size;
 		break;
-	case DW_TAG_array_type:
-		array_type__encode(tag, core_id, ctf);
+	case CTF_TYPE_KIND_ARR:
+		type->size = array_type__nelems(tag);
 		break;
-	case DW_TAG_subroutine_type:
-		subroutine_type__encode(tag, core_id, ctf);
+	case CTF_TYPE_KIND_FUNC:
+		type->nr_members = tag__ftype(tag)->nr_parms;
+		type->varargs	 = tag__ftype(tag)->unspec_parms;
 		break;
-	case DW_TAG_enumeration_type:
-		enumeration_type__encode(tag, core_id, ctf);
+	case CTF_TYPE_KIND_STR:
+	case CTF_TYPE_KIND_UNION:
+	case CTF_TYPE_KIND_ENUM: {
+		const uint32_t nr_members = type->kind == CTF_TYPE_KIND_ENUM ?
+					    tag__type(tag)->nr_members :
+					    type__nr_ctf_members(tag__type(tag));
+
+		if (nr_members > CTF_MAX_VLEN) {
+			fprintf(stderr, "pahole: %s has more than %u members, can't encode it as CTF\n",
+				tag__ctf_name(tag) ?: "<anonymous>", CTF_MAX_VLEN);
+			return -E2BIG;
+		}
+		type->size	 = tag__type(tag)->size;
+		type->nr_members = nr_members;
+	}
+		break;
+	}
+
+	/* The resolves below may realloc encoder->types.entries, don't use 'type' after them */
+	switch (type->kind) {
+	case CTF_TYPE_KIND_ARR:
+	case CTF_TYPE_KIND_PTR:
+	case CTF_TYPE_KIND_CONST:
+	case CTF_TYPE_KIND_VOLATILE:
+	case CTF_TYPE_KIND_RESTRICT:
+	case CTF_TYPE_KIND_TYPDEF:
+	case CTF_TYPE_KIND_FUNC:
+		target = ctf_encoder_cu__resolve(ecu, tag->type);
+		if (target < 0)
+			return target;
+		encoder->types.entries[ctf_id].type = target;
 		break;
 	}
+
+	if (encoder->types.entries[ctf_id].nr_members != 0) {
+		err = ctf_encoder_cu__add_members(ecu, tag, ctf_id);
+		if (err)
+			return err;
+	}
+
+	encoder->types.entries[ctf_id].complete = true;
+
+	err = ctf_encoder__hash_type(encoder, ctf_id);
+	if (err)
+		return err;
+
+	return ctf_id;
 }
 
-#define HASHADDR__BITS 8
-#define HASHADDR__SIZE (1UL << HASHADDR__BITS)
-#define hashaddr__fn(key) hash_64(key, HASHADDR__BITS)
+static int ctf_encoder__add_function(struct ctf_encoder *encoder, struct ctf_encoder_cu *ecu,
+				     struct function *function)
+{
+	struct ctf_encoder_function *entry;
+	const struct ftype *ftype = &function->proto;
+	struct parameter *pos;
+	int64_t type;
+	int i = 0;
+
+	if (encoder->functions.cnt == encoder->functions.allocated) {
+		uint32_t allocated = encoder->functions.allocated ? encoder->functions.allocated * 3 / 2 : 1024;
+		struct ctf_encoder_function *entries = realloc(encoder->functions.entries,
+							       allocated * sizeof(*entries));
+		if (entries == NULL)
+			return -ENOMEM;
+
+		encoder->functions.entries = entries;
+		encoder->functions.allocated = allocated;
+	}
+
+	entry = &encoder->functions.entries[encoder->functions.cnt];
+	memset(entry, 0, sizeof(*entry));
+	entry->addr = function->lexblock.ip.addr;
+	entry->nr_parms = ftype->nr_parms;
+	entry->varargs = ftype->unspec_parms;
+
+	type = ctf_encoder_cu__resolve(ecu, ftype->tag.type);
+	if (type < 0)
+		return type;
+	entry->type = type;
 
-static struct function *hashaddr__find_function(const struct hlist_head hashtable[],
-						const uint64_t addr)
+	if (entry->nr_parms != 0) {
+		entry->parms = calloc(entry->nr_parms, sizeof(*entry->parms));
+		if (entry->parms == NULL)
+			return -ENOMEM;
+	}
+
+	++encoder->functions.cnt;
+
+	ftype__for_each_parameter(ftype, pos) {
+		type = ctf_encoder_cu__resolve(ecu, pos->tag.type);
+		if (type < 0)
+			return type;
+		entry->parms[i++] = type;
+	}
+
+	return 0;
+}
+
+static int ctf_encoder__add_variable(struct ctf_encoder *encoder, struct ctf_encoder_cu *ecu,
+				     struct variable *var)
+{
+	int64_t type;
+
+	if (encoder->variables.cnt == encoder->variables.allocated) {
+		uint32_t allocated = encoder->variables.allocated ? encoder->variables.allocated * 3 / 2 : 1024;
+		struct ctf_encoder_variable *entries = realloc(encoder->variables.entries,
+							       allocated * sizeof(*entries));
+		if (entries == NULL)
+			return -ENOMEM;
+
+		encoder->variables.entries = entries;
+		encoder->variables.allocated = allocated;
+	}
+
+	type = ctf_encoder_cu__resolve(ecu, var->ip.tag.type);
+	if (type < 0)
+		return type;
+
+	encoder->variables.entries[encoder->variables.cnt].addr = var->ip.addr;
+	encoder->variables.entries[encoder->variables.cnt].type = type;
+	++encoder->variables.cnt;
+	return 0;
+}
+
+int ctf_encoder__encode_cu(struct ctf_encoder *encoder, struct cu *cu)
 {
+	const uint32_t nr_types = cu->types_table.nr_entries;
+	struct ctf_encoder_cu ecu = {
+		.encoder    = encoder,
+		.cu	    = cu,
+		.ids	    = malloc(nr_types * sizeof(uint32_t)),
+		.hypot	    = malloc(nr_types * sizeof(uint32_t)),
+		.hypot_list = malloc(nr_types * sizeof(uint32_t)),
+		.hashes	    = calloc(nr_types, sizeof(uint32_t)),
+	};
 	struct function *function;
-	struct hlist_node *pos;
-	uint16_t bucket = hashaddr__fn(addr);
-	const struct hlist_head *head = &hashtable[bucket];
+	struct tag *pos;
+	int64_t ctf_id;
+	uint32_t id;
+	int err = -ENOMEM;
+
+	if (ecu.ids == NULL || ecu.hypot == NULL || ecu.hypot_list == NULL || ecu.hashes == NULL)
+		goto out;
+
+	memset(ecu.ids, 0xff, nr_types * sizeof(uint32_t));
+	memset(ecu.hypot, 0xff, nr_types * sizeof(uint32_t));
 
-	hlist_for_each_entry(function, pos, head, tool_hnode) {
-		if (function->lexblock.ip.addr == addr)
-			return function;
+	/*
+	 * Hashing, comparing and adding the struct/union members walk them
+	 * from the laid out arrays, build those before any of that.
+	 */
+	cu__for_each_type(cu, id, pos) {
+		const uint16_t kind = tag__ctf_kind(pos);
+
+		if ((kind == CTF_TYPE_KIND_STR || kind == CTF_TYPE_KIND_UNION) &&
+		    type__layout_members(tag__type(pos)))
+			goto out;
 	}
 
-	return NULL;
+	cu__for_each_type(cu, id, pos) {
+		ctf_id = ctf_encoder_cu__resolve(&ecu, id);
+		if (ctf_id < 0) {
+			err = ctf_id;
+			goto out;
+		}
+	}
+
+	cu__for_each_function(cu, id, function) {
+		if (function->declaration || function->lexblock.ip.addr == 0)
+			continue;
+
+		err = ctf_encoder__add_function(encoder, &ecu, function);
+		if (err)
+			goto out;
+	}
+
+	cu__for_each_variable(cu, id, pos) {
+		struct variable *var = tag__variable(pos);
+
+		if (variable__scope(var) != VSCOPE_GLOBAL)
+			continue;
+
+		err = ctf_encoder__add_variable(encoder, &ecu, var);
+		if (err)
+			goto out;
+	}
+
+	err = 0;
+out:
+	free(ecu.ids);
+	free(ecu.hypot);
+	free(ecu.hypot_list);
+	free(ecu.hashes);
+	return err;
 }
 
-static struct variable *hashaddr__find_variable(const struct hlist_head hashtable[],
-						const uint64_t addr)
+static int ctf_encoder__encode_type(struct ctf_encoder *encoder, uint32_t id, struct ctf *ctf)
 {
-	struct variable *variable;
-	struct hlist_node *pos;
-	uint16_t bucket = hashaddr__fn(addr);
-	const struct hlist_head *head = &hashtable[bucket];
+	const struct ctf_encoder_type *type = &encoder->types.entries[id];
+	uint32_t ctf_id, i;
+	int64_t position;
+
+	switch (type->kind) {
+	case CTF_TYPE_KIND_INT:
+		ctf_id = ctf__add_base_type(ctf, type->name, type->size);
+		break;
+	case CTF_TYPE_KIND_PTR:
+	case CTF_TYPE_KIND_CONST:
+	case CTF_TYPE_KIND_VOLATILE:
+	case CTF_TYPE_KIND_RESTRICT:
+	case CTF_TYPE_KIND_TYPDEF:
+		ctf_id = ctf__add_short_type(ctf, type->kind, type->type, type->name);
+		break;
+	case CTF_TYPE_KIND_FWD:
+		ctf_id = ctf__add_fwd_decl(ctf, type->name);
+		break;
+	case CTF_TYPE_KIND_ARR:
+		ctf_id = ctf__add_array(ctf, type->type, 0, type->size);
+		break;
+	case CTF_TYPE_KIND_FUNC:
+		ctf_id = ctf__add_function_type(ctf, type->type, type->nr_members, type->varargs, &position);
+		for (i = 0; i < type->nr_members; ++i)
+			ctf__add_parameter(ctf, type->members[i].type, &position);
+		break;
+	case CTF_TYPE_KIND_STR:
+	case CTF_TYPE_KIND_UNION: {
+		const bool is_short = type->size < CTF_SHORT_MEMBER_LIMIT;
 
-	hlist_for_each_entry(variable, pos, head, tool_hnode) {
-		if (variable->ip.addr == addr)
-			return variable;
+		ctf_id = ctf__add_struct(ctf, type->kind, type->name, type->size, type->nr_members, &position);
+		for (i = 0; i < type->nr_members; ++i) {
+			const struct ctf_encoder_member *member = &type->members[i];
+
+			if (is_short)
+				ctf__add_short_member(ctf, member->name, member->type, member->offset, &position);
+			else
+				ctf__add_full_member(ctf, member->name, member->type, member->offset, &position);
+		}
+		break;
+	}
+	case CTF_TYPE_KIND_ENUM:
+		ctf_id = ctf__add_enumeration_type(ctf, type->name, type->size, type->nr_members, &position);
+		for (i = 0; i < type->nr_members; ++i)
+			ctf__add_enumerator(ctf, type->members[i].name, type->members[i].offset, &position);
+		break;
+	default:
+		return -EINVAL;
 	}
 
-	return NULL;
+	if (ctf_id != id) {
+		fprintf(stderr, "%s: id drift, encoder: %u, libctf: %u\n", __func__, id, ctf_id);
+		return -1;
+	}
+
+	return 0;
 }
 
-/*
- * FIXME: Its in the DWARF loader, we have to find a better handoff
- * mechanizm...
- */
-extern struct strings *strings;
+static int ctf_encoder__addr_cmp(const void *a, const void *b)
+{
+	const uint64_t addr_a = *(const uint64_t *)a, addr_b = *(const uint64_t *)b;
 
-int cu__encode_ctf(struct cu *cu, int verbose)
+	return addr_a < addr_b ? -1 : addr_a > addr_b;
+}
+
+int ctf_encoder__encode(struct ctf_encoder *encoder)
 {
+	struct ctf *ctf = ctf__new(encoder->filename, NULL);
+	uint32_t id;
+	GElf_Sym sym;
 	int err = -1;
-	struct ctf *ctf = ctf__new(cu->filename, cu->elf);
 
 	if (ctf == NULL)
-		goto out;
+		return -ENOMEM;
 
-	if (cu__cache_symtab(cu) < 0)
+	if (ctf__load_symtab(ctf) < 0)
 		goto out_delete;
 
-	ctf__set_strings(ctf, strings);
-
-	uint32_t id;
-	struct tag *pos;
-	cu__for_each_type(cu, id, pos)
-		tag__encode_ctf(pos, id, ctf);
-
-	struct hlist_head hash_addr[HASHADDR__SIZE];
-
-	for (id = 0; id < HASHADDR__SIZE; ++id)
-		INIT_HLIST_HEAD(&hash_addr[id]);
+	ctf__set_strings(ctf, &encoder->strings);
 
-	struct function *function;
-	cu__for_each_function(cu, id, function) {
-		uint64_t addr = function->lexblock.ip.addr;
-		struct hlist_head *head = &hash_addr[hashaddr__fn(addr)];
-		hlist_add_head(&function->tool_hnode, head);
+	for (id = 1; id < encoder->types.cnt; ++id) {
+		err = ctf_encoder__encode_type(encoder, id, ctf);
+		if (err)
+			goto out_delete;
 	}
 
-	uint64_t addr;
-	GElf_Sym sym;
-	const char *sym_name;
-	cu__for_each_cached_symtab_entry(cu, id, sym, sym_name) {
-		if (ctf__ignore_symtab_function(&sym, sym_name))
-			continue;
+	/* The function and object sections are in symtab order, look them up by address */
+	qsort(encoder->functions.entries, encoder->functions.cnt,
+	      sizeof(encoder->functions.entries[0]), ctf_encoder__addr_cmp);
+	qsort(encoder->variables.entries, encoder->variables.cnt,
+	      sizeof(encoder->variables.entries[0]), ctf_encoder__addr_cmp);
 
-		addr = elf_sym__value(&sym);
+	ctf__for_each_symtab_function(ctf, id, sym) {
+		uint64_t addr = elf_sym__value(&sym);
+		const struct ctf_encoder_function *function = bsearch(&addr, encoder->functions.entries,
+								      encoder->functions.cnt,
+								      sizeof(encoder->functions.entries[0]),
+								      ctf_encoder__addr_cmp);
 		int64_t position;
-		function = hashaddr__find_function(hash_addr, addr);
+		uint16_t i;
+
 		if (function == NULL) {
-			if (verbose)
+			if (encoder->verbose)
 				fprintf(stderr,
 					"function %4d: %-20s %#" PRIx64 " %5u NOT FOUND!\n",
-					id, sym_name, addr,
+					id, elf_sym__name(&sym, ctf->symtab), addr,
 					elf_sym__size(&sym));
 			err = ctf__add_function(ctf, 0, 0, 0, &position);
 			if (err != 0)
@@ -289,65 +1020,87 @@ int cu__encode_ctf(struct cu *cu, int verbose)
 			continue;
 		}
 
-		const struct ftype *ftype = &function->proto;
-		err = ctf__add_function(ctf, function->proto.tag.type,
-					ftype->nr_parms,
-					ftype->unspec_parms, &position);
-
+		err = ctf__add_function(ctf, function->type, function->nr_parms,
+					function->varargs, &position);
 		if (err != 0)
 			goto out_err_ctf;
 
-		struct parameter *pos;
-		ftype__for_each_parameter(ftype, pos)
-			ctf__add_function_parameter(ctf, pos->tag.type, &position);
+		for (i = 0; i < function->nr_parms; ++i)
+			ctf__add_function_parameter(ctf, function->parms[i], &position);
 	}
 
-	for (id = 0; id < HASHADDR__SIZE; ++id)
-		INIT_HLIST_HEAD(&hash_addr[id]);
-
-	struct variable *var;
-	cu__for_each_variable(cu, id, pos) {
-		var = tag__variable(pos);
-		if (variable__scope(var) != VSCOPE_GLOBAL)
-			continue;
-		struct hlist_head *head = &hash_addr[hashaddr__fn(var->ip.addr)];
-		hlist_add_head(&var->tool_hnode, head);
-	}
+	ctf__for_each_symtab_object(ctf, id, sym) {
+		uint64_t addr = elf_sym__value(&sym);
+		const struct ctf_encoder_variable *var = bsearch(&addr, encoder->variables.entries,
+								 encoder->variables.cnt,
+								 sizeof(encoder->variables.entries[0]),
+								 ctf_encoder__addr_cmp);
 
-	cu__for_each_cached_symtab_entry(cu, id, sym, sym_name) {
-		if (ctf__ignore_symtab_object(&sym, sym_name))
-			continue;
-		addr = elf_sym__value(&sym);
+		if (var == NULL && encoder->verbose)
+			fprintf(stderr,
+				"variable %4d: %-20s %#" PRIx64 " %5u NOT FOUND!\n",
+				id, elf_sym__name(&sym, ctf->symtab), addr,
+				elf_sym__size(&sym));
 
-		var = hashaddr__find_variable(hash_addr, addr);
-		if (var == NULL) {
-			if (verbose)
-				fprintf(stderr,
-					"variable %4d: %-20s %#" PRIx64 " %5u NOT FOUND!\n",
-					id, sym_name, addr,
-					elf_sym__size(&sym));
-			err = ctf__add_object(ctf, 0);
-			if (err != 0)
-				goto out_err_ctf;
-			continue;
-		}
-
-		err = ctf__add_object(ctf, var->ip.tag.type);
+		err = ctf__add_object(ctf, var ? var->type : 0);
 		if (err != 0)
 			goto out_err_ctf;
 	}
 
-	ctf__encode(ctf, CTF_FLAGS_COMPR);
-
-	err = 0;
+	err = ctf__encode(ctf, CTF_FLAGS_COMPR, encoder->nr_jobs);
 out_delete:
 	ctf__delete(ctf);
-out:
 	return err;
 out_err_ctf:
 	fprintf(stderr,
 		"%4d: %-20s %#llx %5u failed encoding, "
-		"ABORTING!\n", id, sym_name,
-		(unsigned long long)addr, elf_sym__size(&sym));
+		"ABORTING!\n", id, elf_sym__name(&sym, ctf->symtab),
+		(unsigned long long)elf_sym__value(&sym), elf_sym__size(&sym));
 	goto out_delete;
 }
+
+struct ctf_encoder *ctf_encoder__new(const char *filename, bool verbose, int nr_jobs)
+{
+	struct ctf_encoder *encoder = zalloc(sizeof(*encoder));
+
+	if (encoder != NULL) {
+		encoder->filename = strdup(filename);
+		if (encoder->filename == NULL) {
+			free(encoder);
+			return NULL;
+		}
+
+		gobuffer__init(&encoder->strings);
+		encoder->verbose = verbose;
+		encoder->nr_jobs = nr_jobs;
+	}
+
+	return encoder;
+}
+
+void ctf_encoder__delete(struct ctf_encoder *encoder)
+{
+	uint32_t i;
+
+	if (encoder == NULL)
+		return;
+
+	for (i = 1; i < encoder->types.cnt; ++i)
+		free(encoder->types.entries[i].members);
+	for (i = 0; i < encoder->functions.cnt; ++i)
+		free(encoder->functions.entries[i].parms);
+
+	free(encoder->types.entries);
+	free(encoder->types_table.entries);
+	free(encoder->functions.entries);
+	free(encoder->variables.entries);
+	free(encoder->strings_table.entries);
+	__gobuffer__delete(&encoder->strings);
+	zfree(&encoder->filename);
+	free(encoder);
+}
+
+const char *ctf_encoder__filename(const struct ctf_encoder *encoder)
+{
+	return encoder->filename;
+}
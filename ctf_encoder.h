@@ -7,8 +7,18 @@
   Copyright (C) 2009 Arnaldo Carvalho de Melo <acme@redhat.com>
 */
 
+#include <stdbool.h>
+
+struct ctf_encoder;
 struct cu;
 
-int cu__encode_ctf(struct cu *cu, int verbose);
+struct ctf_encoder *ctf_encoder__new(const char *filename, bool verbose, int nr_jobs);
+void ctf_encoder__delete(struct ctf_encoder *encoder);
+
+const char *ctf_encoder__filename(const struct ctf_encoder *encoder);
+
+int ctf_encoder__encode(struct ctf_encoder *encoder);
+
+int ctf_encoder__encode_cu(struct ctf_encoder *encoder, struct cu *cu);
 
 #endif /* _CTF_ENCODER_H_ */
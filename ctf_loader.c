@@ -24,9 +24,10 @@
 #include "dutil.h"
 #include "dwarves.h"
 
-static void *tag__alloc(const size_t size)
+// Allocated from the cu obstack, freed all at once in cu__delete()
+static void *tag__alloc(struct cu *cu, const size_t size)
 {
-	struct tag *tag = zalloc(size);
+	struct tag *tag = cu__zalloc(cu, size);
 
 	if (tag != NULL)
 		tag->top_level = 1;
@@ -48,10 +49,10 @@ static int ctf__load_ftype(struct ctf *ctf, struct ftype *proto, uint16_t tag,
 		if (type == 0)
 			proto->unspec_parms = 1;
 		else {
-			struct parameter *p = tag__alloc(sizeof(*p));
+			struct parameter *p = tag__alloc(ctf->priv, sizeof(*p));
 
 			if (p == NULL)
-				goto out_free_parameters;
+				return -ENOMEM;
 			p->tag.tag  = DW_TAG_formal_parameter;
 			p->tag.type = ctf__get16(ctf, &args[i]);
 			ftype__add_parameter(proto, p);
@@ -75,15 +76,12 @@ static int ctf__load_ftype(struct ctf *ctf, struct ftype *proto, uint16_t tag,
 	}
 
 	return vlen;
-out_free_parameters:
-	ftype__delete(proto);
-	return -ENOMEM;
 }
 
 static struct function *function__new(uint16_t **ptr, GElf_Sym *sym,
 				      struct ctf *ctf)
 {
-	struct function *func = tag__alloc(sizeof(*func));
+	struct function *func = tag__alloc(ctf->priv, sizeof(*func));
 
 	if (func != NULL) {
 		func->lexblock.ip.addr = elf_sym__value(sym);
@@ -105,7 +103,7 @@ static struct function *function__new(uint16_t **ptr, GElf_Sym *sym,
 			fprintf(stderr,
 				"%s: Expected function type, got %u\n",
 				__func__, tag);
-			goto out_delete;
+			return NULL;
 		}
 		uint16_t type = ctf__get16(ctf, *ptr);
 		long id = -1; /* FIXME: not needed for funcs... */
@@ -124,9 +122,6 @@ static struct function *function__new(uint16_t **ptr, GElf_Sym *sym,
 	}
 
 	return func;
-out_delete:
-	free(func);
-	return NULL;
 }
 
 static int ctf__load_funcs(struct ctf *ctf)
@@ -144,10 +139,10 @@ static int ctf__load_funcs(struct ctf *ctf)
 	return 0;
 }
 
-static struct base_type *base_type__new(const char *name, uint32_t attrs,
+static struct base_type *base_type__new(struct cu *cu, const char *name, uint32_t attrs,
 					uint8_t float_type, size_t size)
 {
-        struct base_type *bt = tag__alloc(sizeof(*bt));
+        struct base_type *bt = tag__alloc(cu, sizeof(*bt));
 
 	if (bt != NULL) {
 		bt->name = name;
@@ -170,9 +165,9 @@ static void type__init(struct type *type, uint16_t tag, const char *name, size_t
 	type->namespace.name = name;
 }
 
-static struct type *type__new(uint16_t tag, const char *name, size_t size)
+static struct type *type__new(struct cu *cu, uint16_t tag, const char *name, size_t size)
 {
-        struct type *type = tag__alloc(sizeof(*type));
+        struct type *type = tag__alloc(cu, sizeof(*type));
 
 	if (type != NULL)
 		type__init(type, tag, name, size);
@@ -180,9 +175,9 @@ static struct type *type__new(uint16_t tag, const char *name, size_t size)
 	return type;
 }
 
-static struct class *class__new(const char *name, size_t size)
+static struct class *class__new(struct cu *cu, const char *name, size_t size)
 {
-	struct class *class = tag__alloc(sizeof(*class));
+	struct class *class = tag__alloc(cu, sizeof(*class));
 
 	if (class != NULL) {
 		type__init(&class->type, DW_TAG_structure_type, name, size);
@@ -199,7 +194,7 @@ static int create_new_base_type(struct ctf *ctf, void *ptr,
 	uint32_t eval = ctf__get32(ctf, enc);
 	uint32_t attrs = CTF_TYPE_INT_ATTRS(eval);
 	uint32_t name = ctf__get32(ctf, &tp->base.ctf_name);
-	struct base_type *base = base_type__new(ctf__string(ctf, name), attrs, 0,
+	struct base_type *base = base_type__new(ctf->priv, ctf__string(ctf, name), attrs, 0,
 						CTF_TYPE_INT_BITS(eval));
 	if (base == NULL)
 		return -ENOMEM;
@@ -216,7 +211,7 @@ static int create_new_base_type_float(struct ctf *ctf, void *ptr,
 {
 	uint32_t name = ctf__get32(ctf, &tp->base.ctf_name);
 	uint32_t *enc = ptr, eval = ctf__get32(ctf, enc);
-	struct base_type *base = base_type__new(ctf__string(ctf, name), 0, eval,
+	struct base_type *base = base_type__new(ctf->priv, ctf__string(ctf, name), 0, eval,
 						CTF_TYPE_FP_BITS(eval));
 	if (base == NULL)
 		return -ENOMEM;
@@ -230,7 +225,7 @@ static int create_new_base_type_float(struct ctf *ctf, void *ptr,
 static int create_new_array(struct ctf *ctf, void *ptr, uint32_t id)
 {
 	struct ctf_array *ap = ptr;
-	struct array_type *array = tag__alloc(sizeof(*array));
+	struct array_type *array = tag__alloc(ctf->priv, sizeof(*array));
 
 	if (array == NULL)
 		return -ENOMEM;
@@ -238,12 +233,10 @@ static int create_new_array(struct ctf *ctf, void *ptr, uint32_t id)
 	/* FIXME: where to get the number of dimensions?
 	 * it it flattened? */
 	array->dimensions = 1;
-	array->nr_entries = malloc(sizeof(uint32_t));
+	array->nr_entries = cu__malloc(ctf->priv, sizeof(uint32_t));
 
-	if (array->nr_entries == NULL) {
-		free(array);
+	if (array->nr_entries == NULL)
 		return -ENOMEM;
-	}
 
 	array->nr_entries[0] = ctf__get32(ctf, &ap->ctf_array_nelems);
 	array->tag.tag = DW_TAG_array_type;
@@ -260,7 +253,7 @@ static int create_new_subroutine_type(struct ctf *ctf, void *ptr,
 {
 	uint16_t *args = ptr;
 	unsigned int type = ctf__get16(ctf, &tp->base.ctf_type);
-	struct ftype *proto = tag__alloc(sizeof(*proto));
+	struct ftype *proto = tag__alloc(ctf->priv, sizeof(*proto));
 
 	if (proto == NULL)
 		return -ENOMEM;
@@ -277,7 +270,7 @@ static int create_full_members(struct ctf *ctf, void *ptr,
 	int i;
 
 	for (i = 0; i < vlen; i++) {
-		struct class_member *member = zalloc(sizeof(*member));
+		struct class_member *member = cu__zalloc(ctf->priv, sizeof(*member));
 
 		if (member == NULL)
 			return -ENOMEM;
@@ -301,7 +294,7 @@ static int create_short_members(struct ctf *ctf, void *ptr,
 	int i;
 
 	for (i = 0; i < vlen; i++) {
-		struct class_member *member = zalloc(sizeof(*member));
+		struct class_member *member = cu__zalloc(ctf->priv, sizeof(*member));
 
 		if (member == NULL)
 			return -ENOMEM;
@@ -324,7 +317,10 @@ static int create_new_class(struct ctf *ctf, void *ptr,
 {
 	int member_size;
 	const char *name = ctf__string(ctf, ctf__get32(ctf, &tp->base.ctf_name));
-	struct class *class = class__new(name, size);
+	struct class *class = class__new(ctf->priv, name, size);
+
+	if (class == NULL)
+		return -ENOMEM;
 
 	if (size >= CTF_SHORT_MEMBER_LIMIT) {
 		member_size = create_full_members(ctf, ptr, vlen, &class->type);
@@ -333,14 +329,11 @@ static int create_new_class(struct ctf *ctf, void *ptr,
 	}
 
 	if (member_size < 0)
-		goto out_free;
+		return -ENOMEM;
 
 	cu__add_tag_with_id(ctf->priv, &class->type.namespace.tag, id);
 
 	return (vlen * member_size);
-out_free:
-	class__delete(class);
-	return -ENOMEM;
 }
 
 static int create_new_union(struct ctf *ctf, void *ptr,
@@ -349,7 +342,10 @@ static int create_new_union(struct ctf *ctf, void *ptr,
 {
 	int member_size;
 	const char *name = ctf__string(ctf, ctf__get32(ctf, &tp->base.ctf_name));
-	struct type *un = type__new(DW_TAG_union_type, name, size);
+	struct type *un = type__new(ctf->priv, DW_TAG_union_type, name, size);
+
+	if (un == NULL)
+		return -ENOMEM;
 
 	if (size >= CTF_SHORT_MEMBER_LIMIT) {
 		member_size = create_full_members(ctf, ptr, vlen, un);
@@ -358,19 +354,16 @@ static int create_new_union(struct ctf *ctf, void *ptr,
 	}
 
 	if (member_size < 0)
-		goto out_free;
+		return -ENOMEM;
 
 	cu__add_tag_with_id(ctf->priv, &un->namespace.tag, id);
 
 	return (vlen * member_size);
-out_free:
-	type__delete(un);
-	return -ENOMEM;
 }
 
-static struct enumerator *enumerator__new(const char *name, uint32_t value)
+static struct enumerator *enumerator__new(struct cu *cu, const char *name, uint32_t value)
 {
-	struct enumerator *en = tag__alloc(sizeof(*en));
+	struct enumerator *en = tag__alloc(cu, sizeof(*en));
 
 	if (en != NULL) {
 		en->name = name;
@@ -388,7 +381,7 @@ static int create_new_enumeration(struct ctf *ctf, void *ptr,
 	struct ctf_enum *ep = ptr;
 	uint16_t i;
 	const char *name = ctf__string(ctf, ctf__get32(ctf, &tp->base.ctf_name));
-	struct type *enumeration = type__new(DW_TAG_enumeration_type, name, size ?: (sizeof(int) * 8));
+	struct type *enumeration = type__new(ctf->priv, DW_TAG_enumeration_type, name, size ?: (sizeof(int) * 8));
 
 	if (enumeration == NULL)
 		return -ENOMEM;
@@ -396,10 +389,10 @@ static int create_new_enumeration(struct ctf *ctf, void *ptr,
 	for (i = 0; i < vlen; i++) {
 		const char *name = ctf__string(ctf, ctf__get32(ctf, &ep[i].ctf_enum_name));
 		uint32_t value = ctf__get32(ctf, &ep[i].ctf_enum_val);
-		struct enumerator *enumerator = enumerator__new(name, value);
+		struct enumerator *enumerator = enumerator__new(ctf->priv, name, value);
 
 		if (enumerator == NULL)
-			goto out_free;
+			return -ENOMEM;
 
 		enumeration__add(enumeration, enumerator);
 	}
@@ -407,16 +400,13 @@ static int create_new_enumeration(struct ctf *ctf, void *ptr,
 	cu__add_tag_with_id(ctf->priv, &enumeration->namespace.tag, id);
 
 	return (vlen * sizeof(*ep));
-out_free:
-	enumeration__delete(enumeration);
-	return -ENOMEM;
 }
 
 static int create_new_forward_decl(struct ctf *ctf, struct ctf_full_type *tp,
 				   uint64_t size, uint32_t id)
 {
 	const char *name = ctf__string(ctf, ctf__get32(ctf, &tp->base.ctf_name));
-	struct class *fwd = class__new(name, size);
+	struct class *fwd = class__new(ctf->priv, name, size);
 
 	if (fwd == NULL)
 		return -ENOMEM;
@@ -430,7 +420,7 @@ static int create_new_typedef(struct ctf *ctf, struct ctf_full_type *tp,
 {
 	const char *name = ctf__string(ctf, ctf__get32(ctf, &tp->base.ctf_name));
 	unsigned int type_id = ctf__get16(ctf, &tp->base.ctf_type);
-	struct type *type = type__new(DW_TAG_typedef, name, size);
+	struct type *type = type__new(ctf->priv, DW_TAG_typedef, name, size);
 
 	if (type == NULL)
 		return -ENOMEM;
@@ -445,7 +435,7 @@ static int create_new_tag(struct ctf *ctf, int type,
 			  struct ctf_full_type *tp, uint32_t id)
 {
 	unsigned int type_id = ctf__get16(ctf, &tp->base.ctf_type);
-	struct tag *tag = zalloc(sizeof(*tag));
+	struct tag *tag = cu__zalloc(ctf->priv, sizeof(*tag));
 
 	if (tag == NULL)
 		return -ENOMEM;
@@ -456,7 +446,6 @@ static int create_new_tag(struct ctf *ctf, int type,
 	case CTF_TYPE_KIND_RESTRICT:	tag->tag = DW_TAG_restrict_type; break;
 	case CTF_TYPE_KIND_VOLATILE:	tag->tag = DW_TAG_volatile_type; break;
 	default:
-		free(tag);
 		printf("%s: unknown type %d\n\n", __func__, type);
 		return 0;
 	}
@@ -545,7 +534,7 @@ static int ctf__load_types(struct ctf *ctf)
 static struct variable *variable__new(uint16_t type, GElf_Sym *sym,
 				      struct ctf *ctf)
 {
-	struct variable *var = tag__alloc(sizeof(*var));
+	struct variable *var = tag__alloc(ctf->priv, sizeof(*var));
 
 	if (var != NULL) {
 		var->scope = VSCOPE_GLOBAL;
@@ -697,7 +686,7 @@ int ctf__load_file(struct cus *cus, struct conf_load *conf,
 	if (state == NULL)
 		return -1;
 
-	struct cu *cu = cu__new(filename, state->wordsize, NULL, 0, filename, false);
+	struct cu *cu = cu__new(filename, state->wordsize, NULL, 0, filename, true);
 	if (cu == NULL)
 		return -1;
 
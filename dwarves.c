@@ -346,6 +346,66 @@ void __type__init(struct type *type)
 	type->member_prefix = NULL;
 	type->member_prefix_len = 0;
 	type->suffix_disambiguation = 0;
+	type->members_layout = NULL;
+	type->nr_members_layout = 0;
+	type->members_laid_out = 0;
+}
+
+/*
+ * Copies the fields the layout, holes, comparison and encoding loops look at
+ * into an array, so that those don't have to chase the members list pointers.
+ * This is in addition to the list, i.e. it uses more memory to go faster.
+ *
+ * Counted in 32 bits, as type->nr_members, 16 bits, wraps with more than 64K
+ * members, that is valid DWARF.
+ */
+int type__layout_members(struct type *type)
+{
+	struct class_member_layout *layout = NULL;
+	struct class_member *pos;
+	uint32_t nr_entries = 0;
+
+	if (type->members_laid_out)
+		return 0;
+
+	type__for_each_member(type, pos)
+		++nr_entries;
+
+	if (nr_entries != 0) {
+		layout = malloc(nr_entries * sizeof(*layout));
+		if (layout == NULL)
+			return -ENOMEM;
+
+		nr_entries = 0;
+		type__for_each_member(type, pos) {
+			struct class_member_layout *entry = &layout[nr_entries++];
+
+			entry->member	     = pos;
+			entry->name	     = class_member__name(pos);
+			entry->type	     = pos->tag.type;
+			entry->bit_offset    = pos->bit_offset;
+			entry->byte_offset   = pos->byte_offset;
+			entry->bit_size	     = pos->bit_size;
+			entry->byte_size     = pos->byte_size;
+			entry->bitfield_size = pos->bitfield_size;
+			entry->is_inheritance = pos->tag.tag == DW_TAG_inheritance;
+			entry->is_static     = pos->is_static;
+			entry->virtual_inheritance = (pos->tag.tag == DW_TAG_inheritance &&
+						      pos->virtuality == DW_VIRTUALITY_virtual);
+		}
+	}
+
+	type->members_layout	= layout;
+	type->nr_members_layout = nr_entries;
+	type->members_laid_out	= 1;
+	return 0;
+}
+
+void type__free_members_layout(struct type *type)
+{
+	zfree(&type->members_layout);
+	type->nr_members_layout = 0;
+	type->members_laid_out	= 0;
 }
 
 struct class_member *
@@ -660,6 +720,8 @@ struct cu *cu__new(const char *name, uint8_t addr_size,
 
 		cu->addr_size = addr_size;
 		cu->extra_dbg_info = 0;
+		cu->lazy_types = 0;
+		cu->seq = 0;
 
 		cu->nr_inline_expansions   = 0;
 		cu->size_inline_expansions = 0;
@@ -672,6 +734,8 @@ struct cu *cu__new(const char *name, uint8_t addr_size,
 		if (build_id_len > 0)
 			memcpy(cu->build_id, build_id, build_id_len);
 		cu->priv = NULL;
+		cu->type_referrers = NULL;
+		cu->tag_names = NULL;
 	}
 
 	return cu;
@@ -685,11 +749,24 @@ out_free:
 	return NULL;
 }
 
+/* The types may be in the cu obstack, that doesn't know about these */
+static void cu__free_members_layouts(struct cu *cu)
+{
+	struct tag *pos;
+	uint32_t id;
+
+	cu__for_each_type(cu, id, pos) {
+		if (tag__is_struct(pos) || tag__is_union(pos))
+			type__free_members_layout(tag__type(pos));
+	}
+}
+
 void cu__delete(struct cu *cu)
 {
 	if (cu == NULL)
 		return;
 
+	cu__free_members_layouts(cu);
 	ptr_table__exit(&cu->tags_table);
 	ptr_table__exit(&cu->types_table);
 	ptr_table__exit(&cu->functions_table);
@@ -699,6 +776,8 @@ void cu__delete(struct cu *cu)
 	if (cu->use_obstack)
 		obstack_free(&cu->obstack, NULL);
 
+	zfree(&cu->type_referrers);
+	cu__uncache_tag_names(cu);
 	zfree(&cu->filename);
 	zfree(&cu->name);
 	free(cu);
@@ -723,7 +802,27 @@ struct tag *cu__tag(const struct cu *cu, const uint32_t id)
 
 struct tag *cu__type(const struct cu *cu, const type_id_t id)
 {
-	return cu ? ptr_table__entry(&cu->types_table, id) : NULL;
+	if (cu == NULL)
+		return NULL;
+
+	struct tag *tag = ptr_table__entry(&cu->types_table, id);
+
+	// The loaders don't change the tables for types already loaded, hence the cast
+	if (tag == NULL && cu->lazy_types && id != 0 &&
+	    cu->dfops->cu__load_type((struct cu *)cu, id) == 0)
+		tag = ptr_table__entry(&cu->types_table, id);
+
+	return tag;
+}
+
+/*
+ * Make sure all the types named @name are in cu->types_table, so that the
+ * cu__find_*_by_name() routines can keep just walking it.
+ */
+static void cu__load_types_by_name(const struct cu *cu, const char *name)
+{
+	if (cu->lazy_types)
+		cu->dfops->cu__load_types_by_name((struct cu *)cu, name);
 }
 
 struct tag *cu__find_first_typedef_of_type(const struct cu *cu,
@@ -751,6 +850,8 @@ struct tag *cu__find_base_type_by_name(const struct cu *cu,
 	if (cu == NULL || name == NULL)
 		return NULL;
 
+	cu__load_types_by_name(cu, name);
+
 	cu__for_each_type(cu, id, pos) {
 		if (pos->tag != DW_TAG_base_type)
 			continue;
@@ -778,6 +879,8 @@ struct tag *cu__find_base_type_by_name_and_size(const struct cu *cu, const char
 	if (name == NULL)
 		return NULL;
 
+	cu__load_types_by_name(cu, name);
+
 	cu__for_each_type(cu, id, pos) {
 		if (pos->tag == DW_TAG_base_type) {
 			const struct base_type *bt = tag__base_type(pos);
@@ -804,6 +907,8 @@ struct tag *cu__find_enumeration_by_name_and_size(const struct cu *cu, const cha
 	if (name == NULL)
 		return NULL;
 
+	cu__load_types_by_name(cu, name);
+
 	cu__for_each_type(cu, id, pos) {
 		if (pos->tag == DW_TAG_enumeration_type) {
 			const struct type *t = tag__type(pos);
@@ -828,6 +933,8 @@ struct tag *cu__find_enumeration_by_name(const struct cu *cu, const char *name,
 	if (name == NULL)
 		return NULL;
 
+	cu__load_types_by_name(cu, name);
+
 	cu__for_each_type(cu, id, pos) {
 		if (pos->tag == DW_TAG_enumeration_type) {
 			const struct type *type = tag__type(pos);
@@ -849,6 +956,8 @@ struct tag *cu__find_type_by_name(const struct cu *cu, const char *name, const i
 	if (cu == NULL || name == NULL)
 		return NULL;
 
+	cu__load_types_by_name(cu, name);
+
 	uint32_t id;
 	struct tag *pos;
 	cu__for_each_type(cu, id, pos) {
@@ -903,6 +1012,8 @@ static struct tag *__cu__find_struct_by_name(const struct cu *cu, const char *na
 	if (cu == NULL || name == NULL)
 		return NULL;
 
+	cu__load_types_by_name(cu, name);
+
 	uint32_t id;
 	struct tag *pos;
 	cu__for_each_type(cu, id, pos) {
@@ -1183,6 +1294,7 @@ void class__delete(struct class *class)
 		return;
 
 	type__delete_class_members(&class->type);
+	type__free_members_layout(&class->type);
 	free(class);
 }
 
@@ -1192,6 +1304,7 @@ void type__delete(struct type *type)
 		return;
 
 	type__delete_class_members(type);
+	type__free_members_layout(type);
 
 	if (type->suffix_disambiguation)
 		zfree(&type->namespace.name);
@@ -1259,6 +1372,10 @@ static int type__clone_members(struct type *type, const struct type *from)
 
 	type->nr_members = type->nr_static_members = 0;
 	INIT_LIST_HEAD(&type->namespace.tags);
+	/* Points to the members of the type being cloned */
+	type->members_layout = NULL;
+	type->nr_members_layout = 0;
+	type->members_laid_out = 0;
 
 	type__for_each_member(from, pos) {
 		struct class_member *clone = class_member__clone(pos);
@@ -1409,35 +1526,41 @@ const struct class_member *class__find_bit_hole(const struct class *class,
 	return NULL;
 }
 
-void class__find_holes(struct class *class)
+/*
+ * Returns -ENOMEM if there wasn't memory for the members layout, with the
+ * holes info left as it was, to be looked for again on the next call.
+ */
+int class__find_holes(struct class *class)
 {
-	const struct type *ctype = &class->type;
-	struct class_member *pos, *last = NULL;
+	struct type *ctype = &class->type;
+	const struct class_member_layout *pos, *last = NULL;
 	uint32_t cur_bitfield_end = ctype->size * 8, cur_bitfield_size = 0;
 	int bit_holes = 0, byte_holes = 0;
 	uint32_t bit_start, bit_end, last_seen_bit = 0;
 	bool in_bitfield = false;
 
 	if (!tag__is_struct(class__tag(class)))
-		return;
+		return 0;
 
 	if (class->holes_searched)
-		return;
+		return 0;
+
+	if (type__layout_members(ctype))
+		return -ENOMEM;
 
 	class->nr_holes = 0;
 	class->nr_bit_holes = 0;
 
-	type__for_each_member(ctype, pos) {
+	type__for_each_member_layout(ctype, pos) {
 		/* XXX for now just skip these */
-		if (pos->tag.tag == DW_TAG_inheritance &&
-		    pos->virtuality == DW_VIRTUALITY_virtual)
+		if (pos->virtual_inheritance)
 			continue;
 
 		if (pos->is_static)
 			continue;
 
-		pos->bit_hole = 0;
-		pos->hole = 0;
+		pos->member->bit_hole = 0;
+		pos->member->hole = 0;
 
 		bit_start = pos->bit_offset;
 		if (pos->bitfield_size) {
@@ -1495,8 +1618,8 @@ void class__find_holes(struct class *class)
 		}
 
 		if (last) {
-			last->hole = byte_holes;
-			last->bit_hole = bit_holes;
+			last->member->hole = byte_holes;
+			last->member->bit_hole = bit_holes;
 		} else {
 			class->pre_hole = byte_holes;
 			class->pre_bit_hole = bit_holes;
@@ -1519,6 +1642,7 @@ void class__find_holes(struct class *class)
 	class->padding = ctype->size - last_seen_bit / 8;
 
 	class->holes_searched = true;
+	return 0;
 }
 
 static size_t type__natural_alignment(struct type *type, const struct cu *cu);
@@ -1632,7 +1756,9 @@ bool class__infer_packed_attributes(struct class *cls, const struct cu *cu)
 	if (ctype->packed_attributes_inferred)
 		return cls->is_packed;
 
-	class__find_holes(cls);
+	// Without the holes info, don't infer anything
+	if (class__find_holes(cls))
+		return false;
 
 	if (cls->padding != 0 || cls->nr_holes != 0) {
 		type__check_structs_at_unnatural_alignments(ctype, cu);
@@ -2444,10 +2570,52 @@ try_elf:
 	return err;
 }
 
+/*
+ * Returns -ENOTSUP when no loader for the formats in conf->format_path can
+ * load all the files concurrently.
+ */
+static int cus__load_files_in_parallel(struct cus *cus, struct conf_load *conf,
+				       char *filenames[], int nr_files, int *failed)
+{
+	int i;
+
+	for (i = 0; debug_fmt_table[i] != NULL; ++i) {
+		struct debug_fmt_ops *ops = debug_fmt_table[i];
+
+		if (ops->load_files == NULL ||
+		    (conf->format_path != NULL && strstr(conf->format_path, ops->name) == NULL))
+			continue;
+
+		if (conf->conf_fprintf)
+			conf->conf_fprintf->has_alignment_info = ops->has_alignment_info;
+
+		int err = ops->load_files(cus, conf, filenames, nr_files, failed);
+
+		if (err != -ENOTSUP)
+			return err;
+	}
+
+	return -ENOTSUP;
+}
+
 int cus__load_files(struct cus *cus, struct conf_load *conf,
 		    char *filenames[])
 {
-	int i = 0;
+	int i = 0, nr_files = 0;
+
+	while (filenames[nr_files] != NULL)
+		++nr_files;
+
+	if (conf && conf->nr_jobs > 1 && nr_files > 1) {
+		int failed = 0, err = cus__load_files_in_parallel(cus, conf, filenames, nr_files, &failed);
+
+		if (err != -ENOTSUP) {
+			if (err == 0)
+				return 0;
+			errno = -err;
+			return -(failed + 1);
+		}
+	}
 
 	while (filenames[i] != NULL) {
 		int err = cus__load_file(cus, conf, filenames[i]);
@@ -65,6 +65,7 @@ struct conf_load {
 	bool			skip_encoding_btf_decl_tag;
 	bool			skip_missing;
 	bool			skip_encoding_btf_type_tag;
+	bool			lazy_types;
 	uint8_t			hashtable_bits;
 	uint8_t			max_hashtable_bits;
 	uint16_t		kabi_prefix_len;
@@ -219,6 +220,15 @@ struct debug_fmt_ops {
 	int		   (*load_file)(struct cus *cus,
 				       struct conf_load *conf,
 				       const char *filename);
+	/*
+	 * Optional, loads @nr_files files concurrently, with up to conf->nr_jobs
+	 * threads, -ENOTSUP if they are not all in this format, when the error
+	 * is for a file its index is returned in @failed.
+	 */
+	int		   (*load_files)(struct cus *cus,
+					 struct conf_load *conf,
+					 char *filenames[], int nr_files,
+					 int *failed);
 	const char	   *(*tag__decl_file)(const struct tag *tag,
 					      const struct cu *cu);
 	uint32_t	   (*tag__decl_line)(const struct tag *tag,
@@ -226,9 +236,18 @@ struct debug_fmt_ops {
 	unsigned long long (*tag__orig_id)(const struct tag *tag,
 					   const struct cu *cu);
 	void		   (*cu__delete)(struct cu *cu);
+	/*
+	 * For CUs with cu->lazy_types: types are only loaded when first looked
+	 * up by id, via cu__type(), or by name, via cu__find_*_by_name().
+	 */
+	int		   (*cu__load_type)(struct cu *cu, uint32_t id);
+	int		   (*cu__load_types_by_name)(struct cu *cu, const char *name);
 	bool		   has_alignment_info;
 };
 
+struct type_referrers;
+struct tag_name_cache;
+
 struct cu {
 	struct list_head node;
 	struct list_head tags;
@@ -240,17 +259,21 @@ struct cu {
 	char		 *name;
 	char		 *filename;
 	void 		 *priv;
+	struct type_referrers *type_referrers; /* Built by tools on first use, single allocation */
+	struct tag_name_cache *tag_names; /* See cu__cache_tag_names() */
 	struct debug_fmt_ops *dfops;
 	Elf		 *elf;
 	Dwfl_Module	 *dwfl;
 	struct obstack	 obstack;
 	uint32_t	 cached_symtab_nr_entries;
+	uint32_t	 seq;		/* Order in the file, for tools keeping output order with -j */
 	bool		 use_obstack;
 	uint8_t		 addr_size;
 	uint8_t		 extra_dbg_info:1;
 	uint8_t		 has_addr_info:1;
 	uint8_t		 uses_global_strings:1;
 	uint8_t		 little_endian:1;
+	uint8_t		 lazy_types:1;	/* See debug_fmt_ops->cu__load_type() */
 	uint16_t	 language;
 	unsigned long	 nr_inline_expansions;
 	size_t		 size_inline_expansions;
@@ -316,7 +339,8 @@ int lang__str2int(const char *lang);
  * @pos: struct tag iterator
  *
  * See cu__table_nullify_type_entry and users for the reason for
- * the NULL test (hint: CTF Unknown types)
+ * the NULL test (hint: CTF Unknown types), with cu->lazy_types only
+ * the types already loaded are visited.
  */
 #define cu__for_each_type(cu, id, pos)				\
 	for (id = 1; id < cu->types_table.nr_entries; ++id)	\
@@ -571,6 +595,16 @@ size_t tag__fprintf_decl_info(const struct tag *tag,
 size_t tag__fprintf(struct tag *tag, const struct cu *cu,
 		    const struct conf_fprintf *conf, FILE *fp);
 
+/*
+ * Memoize the tag__name() results for pointers, arrays, qualified and function
+ * types in @cu, the ones that need recursing. Optional, as it takes memory and
+ * isn't locked, i.e. @cu must be used by one thread at a time. Call
+ * cu__flush_tag_names() if the types get changed, the cache is freed with @cu.
+ */
+int cu__cache_tag_names(struct cu *cu);
+void cu__flush_tag_names(struct cu *cu);
+void cu__uncache_tag_names(struct cu *cu);
+
 const char *tag__name(const struct tag *tag, const struct cu *cu,
 		      char *bf, size_t len, const struct conf_fprintf *conf);
 void tag__not_found_die(const char *file, int line, const char *func);
@@ -981,6 +1015,35 @@ struct class_member {
 
 void class_member__delete(struct class_member *member);
 
+/**
+ * struct class_member_layout - the class_member fields the member walking loops use, see type__layout_members()
+ *
+ * @member: the class_member it was copied from, for what isn't here and to store holes
+ * @name: class_member__name(member)
+ * @type: member->tag.type
+ * @bit_offset: member->bit_offset
+ * @byte_offset: member->byte_offset
+ * @bit_size: member->bit_size
+ * @byte_size: member->byte_size
+ * @bitfield_size: member->bitfield_size
+ * @is_inheritance: DW_TAG_inheritance entry
+ * @is_static: member->is_static
+ * @virtual_inheritance: DW_TAG_inheritance with DW_VIRTUALITY_virtual
+ */
+struct class_member_layout {
+	struct class_member *member;
+	const char	    *name;
+	uint32_t	    type;
+	uint32_t	    bit_offset;
+	uint32_t	    byte_offset;
+	uint32_t	    bit_size;
+	uint32_t	    byte_size;
+	uint8_t		    bitfield_size;
+	uint8_t		    is_inheritance:1;
+	uint8_t		    is_static:1;
+	uint8_t		    virtual_inheritance:1;
+};
+
 static inline struct class_member *tag__class_member(const struct tag *tag)
 {
 	return (struct class_member *)tag;
@@ -1023,6 +1086,9 @@ struct tag_cu_node {
  * @type_enum: enumeration(s) to use together with type_member to find a type to cast
  * @member_prefix: the common prefix for all members, say in an enum, this should be calculated on demand
  * @member_prefix_len: the lenght of the common prefix for all members
+ * @members_layout: the type__for_each_member() entries in an array, built by type__layout_members()
+ * @nr_members_layout: number of entries in @members_layout
+ * @members_laid_out: @members_layout was built, reset with type__free_members_layout() when members change
  */
 struct type {
 	struct namespace namespace;
@@ -1037,6 +1103,8 @@ struct type {
 	struct class_member_filter *filter;
 	struct list_head type_enum;
 	char 		 *member_prefix;
+	struct class_member_layout *members_layout;
+	uint32_t	 nr_members_layout;
 	uint16_t	 member_prefix_len;
 	uint16_t	 max_tag_name_len;
 	uint16_t	 natural_alignment;
@@ -1046,10 +1114,14 @@ struct type {
 	uint8_t		 definition_emitted:1;
 	uint8_t		 fwd_decl_emitted:1;
 	uint8_t		 resized:1;
+	uint8_t		 members_laid_out:1;
 };
 
 void __type__init(struct type *type);
 
+int type__layout_members(struct type *type);
+void type__free_members_layout(struct type *type);
+
 size_t tag__natural_alignment(struct tag *tag, const struct cu *cu);
 
 static inline struct class *type__class(const struct type *type)
@@ -1128,6 +1200,16 @@ static inline struct class_member *class_member__next(struct class_member *membe
 			continue; \
 		else
 
+/**
+ * type__for_each_member_layout - iterate thru the type__for_each_member() entries,
+ *				  in the array built by type__layout_members()
+ * @type: struct type instance to iterate
+ * @pos: struct class_member_layout iterator
+ */
+#define type__for_each_member_layout(type, pos) \
+	for (pos = (type)->members_layout; \
+	     pos < (type)->members_layout + (type)->nr_members_layout; ++pos)
+
 /**
  * type__for_each_member_safe - safely iterate thru the entries that use space
  *                              (data members and inheritance entries)
@@ -1234,7 +1316,7 @@ static inline int class__is_struct(const struct class *cls)
 	return tag__is_struct(&cls->type.namespace.tag);
 }
 
-void class__find_holes(struct class *cls);
+int class__find_holes(struct class *cls);
 int class__has_hole_ge(const struct class *cls, const uint16_t size);
 
 bool class__infer_packed_attributes(struct class *cls, const struct cu *cu);
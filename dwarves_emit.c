@@ -7,33 +7,180 @@
   Copyright (C) 2007 Arnaldo Carvalho de Melo <acme@redhat.com>
 */
 
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "list.h"
 #include "dwarves_emit.h"
 #include "dwarves.h"
+#include "dutil.h"
+#include "hash.h"
 
 void type_emissions__init(struct type_emissions *emissions)
 {
 	INIT_LIST_HEAD(&emissions->definitions);
 	INIT_LIST_HEAD(&emissions->fwd_decls);
+	memset(&emissions->definitions_table, 0, sizeof(emissions->definitions_table));
+	memset(&emissions->fwd_decls_table, 0, sizeof(emissions->fwd_decls_table));
+	emissions->no_tables = false;
+}
+
+void type_emissions__exit(struct type_emissions *emissions)
+{
+	free(emissions->definitions_table.entries);
+	free(emissions->fwd_decls_table.entries);
+	memset(&emissions->definitions_table, 0, sizeof(emissions->definitions_table));
+	memset(&emissions->fwd_decls_table, 0, sizeof(emissions->fwd_decls_table));
+}
+
+struct type_emissions_entry {
+	struct type *type;
+	uint64_t    hash;
+};
+
+// Marks a slot whose type was removed, so that lookups keep probing past it
+static struct type type_emissions__removed;
+
+static uint64_t type_emissions__hash(const char *name)
+{
+	return hash_str(HASH_BYTES__INIT, name);
+}
+
+static int type_emissions_table__grow(struct type_emissions_table *table)
+{
+	const uint8_t bits = table->bits ? table->bits + 1 : 10;
+	struct type_emissions_entry *entries = calloc(1U << bits, sizeof(*entries));
+
+	if (entries == NULL)
+		return -ENOMEM;
+
+	uint32_t nr_used = 0;
+
+	for (uint32_t i = 0; i < table->nr_slots; ++i) {
+		const struct type_emissions_entry *entry = &table->entries[i];
+		uint32_t slot;
+
+		if (entry->type == NULL || entry->type == &type_emissions__removed)
+			continue;
+
+		slot = hash_64(entry->hash, bits);
+		while (entries[slot].type != NULL)
+			slot = (slot + 1) & ((1U << bits) - 1);
+
+		entries[slot] = *entry;
+		++nr_used;
+	}
+
+	free(table->entries);
+	table->entries	= entries;
+	table->nr_used	= nr_used;
+	table->nr_slots = 1U << bits;
+	table->bits	= bits;
+	return 0;
+}
+
+static int type_emissions_table__add(struct type_emissions_table *table, struct type *type)
+{
+	uint64_t hash = type_emissions__hash(type__name(type));
+	uint32_t slot;
+
+	if ((table->nr_used + 1) * 2 > table->nr_slots && type_emissions_table__grow(table))
+		return -ENOMEM;
+
+	slot = hash_64(hash, table->bits);
+	while (table->entries[slot].type != NULL)
+		slot = (slot + 1) & (table->nr_slots - 1);
+
+	table->entries[slot].type = type;
+	table->entries[slot].hash = hash;
+	++table->nr_used;
+	return 0;
+}
+
+static void type_emissions_table__remove(struct type_emissions_table *table, struct type *type)
+{
+	uint32_t slot;
+
+	if (table->nr_slots == 0)
+		return;
+
+	slot = hash_64(type_emissions__hash(type__name(type)), table->bits);
+	while (table->entries[slot].type != NULL) {
+		if (table->entries[slot].type == type) {
+			table->entries[slot].type = &type_emissions__removed;
+			return;
+		}
+		slot = (slot + 1) & (table->nr_slots - 1);
+	}
+}
+
+/*
+ * Calls @match() for the types named @name, in no particular order, till it
+ * returns true.
+ */
+static struct type *type_emissions_table__find(const struct type_emissions_table *table, const char *name,
+					       bool (*match)(const struct type *type, uint16_t tag), uint16_t tag)
+{
+	uint64_t hash = type_emissions__hash(name);
+	uint32_t slot;
+
+	if (table->nr_slots == 0)
+		return NULL;
+
+	slot = hash_64(hash, table->bits);
+	while (table->entries[slot].type != NULL) {
+		struct type *type = table->entries[slot].type;
+
+		if (table->entries[slot].hash == hash && type != &type_emissions__removed &&
+		    strcmp(type__name(type), name) == 0 && match(type, tag))
+			return type;
+
+		slot = (slot + 1) & (table->nr_slots - 1);
+	}
+
+	return NULL;
+}
+
+static void type_emissions__add_to_table(struct type_emissions *emissions,
+					 struct type_emissions_table *table, struct type *type)
+{
+	if (emissions->no_tables || type__name(type) == NULL)
+		return;
+
+	if (type_emissions_table__add(table, type)) {
+		// Can't keep the tables complete, so just use the lists from now on
+		emissions->no_tables = true;
+		type_emissions__exit(emissions);
+	}
 }
 
 static void type_emissions__add_definition(struct type_emissions *emissions,
 					   struct type *type)
 {
 	type->definition_emitted = 1;
-	if (!list_empty(&type->node))
+	if (!list_empty(&type->node)) {
 		list_del(&type->node);
+		if (!emissions->no_tables && type__name(type) != NULL)
+			type_emissions_table__remove(&emissions->fwd_decls_table, type);
+	}
 	list_add_tail(&type->node, &emissions->definitions);
+	type_emissions__add_to_table(emissions, &emissions->definitions_table, type);
 }
 
 static void type_emissions__add_fwd_decl(struct type_emissions *emissions,
 					 struct type *type)
 {
 	type->fwd_decl_emitted = 1;
-	if (list_empty(&type->node))
+	if (list_empty(&type->node)) {
 		list_add_tail(&type->node, &emissions->fwd_decls);
+		type_emissions__add_to_table(emissions, &emissions->fwd_decls_table, type);
+	}
+}
+
+static bool type__is_definition_of(const struct type *type, uint16_t tag)
+{
+	return type__tag((struct type *)type)->tag == tag;
 }
 
 struct type *type_emissions__find_definition(const struct type_emissions *emissions,
@@ -44,6 +191,9 @@ struct type *type_emissions__find_definition(const struct type_emissions *emissi
 	if (name == NULL)
 		return NULL;
 
+	if (!emissions->no_tables)
+		return type_emissions_table__find(&emissions->definitions_table, name, type__is_definition_of, tag);
+
 	list_for_each_entry(pos, &emissions->definitions, node)
 		if (type__tag(pos)->tag == tag &&
 		    type__name(pos) != NULL &&
@@ -60,6 +210,11 @@ static bool type__can_have_shadow_definition(struct type *type)
 	return tag__is_struct(tag) || tag__is_union(tag) || tag__is_enumeration(tag);
 }
 
+static bool type__is_shadow_definition_of(const struct type *type, uint16_t tag)
+{
+	return type__tag((struct type *)type)->tag != tag && type__can_have_shadow_definition((struct type *)type);
+}
+
 // Find if 'struct foo' is defined with a pre-existing 'enum foo', 'union foo', etc
 struct type *type_emissions__find_shadow_definition(const struct type_emissions *emissions,
 						    uint16_t tag, const char *name)
@@ -69,6 +224,9 @@ struct type *type_emissions__find_shadow_definition(const struct type_emissions
 	if (name == NULL)
 		return NULL;
 
+	if (!emissions->no_tables)
+		return type_emissions_table__find(&emissions->definitions_table, name, type__is_shadow_definition_of, tag);
+
 	list_for_each_entry(pos, &emissions->definitions, node) {
 		if (type__tag(pos)->tag != tag &&
 		    type__name(pos) != NULL &&
@@ -80,6 +238,11 @@ struct type *type_emissions__find_shadow_definition(const struct type_emissions
 	return NULL;
 }
 
+static bool type__is_any(const struct type *type __maybe_unused, uint16_t tag __maybe_unused)
+{
+	return true;
+}
+
 static struct type *type_emissions__find_fwd_decl(const struct type_emissions *emissions,
 						  const char *name)
 {
@@ -88,6 +251,9 @@ static struct type *type_emissions__find_fwd_decl(const struct type_emissions *e
 	if (name == NULL)
 		return NULL;
 
+	if (!emissions->no_tables)
+		return type_emissions_table__find(&emissions->fwd_decls_table, name, type__is_any, 0);
+
 	list_for_each_entry(pos, &emissions->fwd_decls, node) {
 		const char *curr_name = type__name(pos);
 
@@ -316,23 +482,9 @@ int ftype__emit_definitions(struct ftype *ftype, struct cu *cu,
 	return printed;
 }
 
-int type__emit_definitions(struct tag *tag, struct cu *cu,
-			   struct type_emissions *emissions, FILE *fp)
+static void type__disambiguate_shadow_definition(struct tag *tag, struct cu *cu, struct type_emissions *emissions)
 {
 	struct type *ctype = tag__type(tag);
-	struct class_member *pos;
-
-	if (ctype->definition_emitted)
-		return 0;
-
-	/* Ok, lets look at the previous CUs: */
-	if (type_emissions__find_definition(emissions, tag->tag, type__name(ctype)) != NULL) {
-		ctype->definition_emitted = 1;
-		return 0;
-	}
-
-	if (tag__is_typedef(tag))
-		return typedef__emit_definitions(tag, cu, emissions, fp);
 
 	/*
 	 * vmlinux.h:120298:8: error: ‘irte’ defined as wrong kind of tag
@@ -357,10 +509,33 @@ int type__emit_definitions(struct tag *tag, struct cu *cu,
 			} else {
 				// Will be deleted in type__delete() on noticing ctype->suffix_disambiguation != 0
 				tag__namespace(tag)->name = disambiguated_name;
+				// Pointers to it, etc, may already have been named with the old name
+				cu__flush_tag_names(cu);
 			}
 
 		}
 	}
+}
+
+int type__emit_definitions(struct tag *tag, struct cu *cu,
+			   struct type_emissions *emissions, FILE *fp)
+{
+	struct type *ctype = tag__type(tag);
+	struct class_member *pos;
+
+	if (ctype->definition_emitted)
+		return 0;
+
+	/* Ok, lets look at the previous CUs: */
+	if (type_emissions__find_definition(emissions, tag->tag, type__name(ctype)) != NULL) {
+		ctype->definition_emitted = 1;
+		return 0;
+	}
+
+	if (tag__is_typedef(tag))
+		return typedef__emit_definitions(tag, cu, emissions, fp);
+
+	type__disambiguate_shadow_definition(tag, cu, emissions);
 
 	type_emissions__add_definition(emissions, ctype);
 
@@ -389,3 +564,333 @@ void type__emit(struct tag *tag, struct cu *cu,
 		fputc('\n', fp);
 	}
 }
+
+/*
+ * Bulk emission: instead of walking the dependencies of each requested type
+ * from scratch, as type__emit_definitions() does, do a single depth first
+ * walk over the type graph, emitting each type after what it needs to be
+ * complete, so each type is visited just once.
+ *
+ * Only named structs, unions, enums and typedefs are emitted, anonymous types
+ * are emitted inline where used. A named struct or union reached via a
+ * pointer, a function prototype or a typedef only needs a forward
+ * declaration, which is also what breaks the cycles.
+ */
+enum bulk_emitter_state {
+	BULK_EMITTER__NEW = 0,
+	BULK_EMITTER__VISITING,
+	BULK_EMITTER__DEFERRED,
+	BULK_EMITTER__DONE,
+};
+
+/*
+ * struct bulk_emitter - state for cu__emit_definitions()
+ *
+ * @state - enum bulk_emitter_state, indexed by type id
+ * @nr_types - number of entries in @state
+ * @deferred - typedefs waiting for a struct or union they need complete, that
+ *	       is still being visited, see bulk_emitter__defer_typedef()
+ */
+struct bulk_emitter {
+	struct cu	      *cu;
+	struct type_emissions *emissions;
+	FILE		      *fp;
+	uint8_t		      *state;
+	uint32_t	      nr_types;
+	uint32_t	      nr_deferred;
+	uint32_t	      allocated_deferred;
+	type_id_t	      *deferred;
+};
+
+static void bulk_emitter__visit(struct bulk_emitter *be, type_id_t id);
+
+static void bulk_emitter__emit_fwd_decl(struct bulk_emitter *be, struct type *ctype)
+{
+	if (ctype->definition_emitted)
+		return;
+
+	if (type_emissions__find_definition(be->emissions, type__tag(ctype)->tag, type__name(ctype)) != NULL) {
+		ctype->definition_emitted = 1;
+		return;
+	}
+
+	type__emit_fwd_decl(ctype, be->emissions, be->fp);
+}
+
+/*
+ * Make @type_id usable where it is referenced, @weak is true when an
+ * incomplete struct or union is enough, i.e. via pointers, in function
+ * prototypes and in typedefs.
+ */
+static void bulk_emitter__visit_use(struct bulk_emitter *be, type_id_t type_id, bool weak)
+{
+	struct tag *type = cu__type(be->cu, type_id);
+
+	while (type != NULL) {
+		switch (type->tag) {
+		case DW_TAG_pointer_type:
+		case DW_TAG_reference_type:
+			weak = true;
+			break;
+		case DW_TAG_array_type:
+			// Array elements have to be complete, even when behind a pointer
+			weak = false;
+			break;
+		case DW_TAG_const_type:
+		case DW_TAG_volatile_type:
+			break;
+		case DW_TAG_typedef:
+			bulk_emitter__visit(be, type_id);
+			// Used by value? Then what it points to has to be complete as well
+			if (weak)
+				return;
+			break;
+		case DW_TAG_enumeration_type:
+			if (type__name(tag__type(type)) != NULL)
+				bulk_emitter__visit(be, type_id);
+			return;
+		case DW_TAG_structure_type:
+		case DW_TAG_union_type: {
+			struct type *ctype = tag__type(type);
+
+			if (type__name(ctype) == NULL) {
+				bulk_emitter__visit(be, type_id);
+			} else if (weak) {
+				bulk_emitter__emit_fwd_decl(be, ctype);
+			} else {
+				bulk_emitter__visit(be, type_id);
+				/*
+				 * Can only be in progress if it contains itself by value, which
+				 * isn't valid C, but at least declare it.
+				 */
+				if (type_id < be->nr_types && be->state[type_id] == BULK_EMITTER__VISITING)
+					bulk_emitter__emit_fwd_decl(be, ctype);
+			}
+			return;
+		}
+		case DW_TAG_subroutine_type: {
+			struct ftype *ftype = tag__ftype(type);
+			struct parameter *pos;
+
+			bulk_emitter__visit_use(be, ftype->tag.type, true);
+			list_for_each_entry(pos, &ftype->parms, tag.node)
+				bulk_emitter__visit_use(be, pos->tag.type, true);
+			return;
+		}
+		default:
+			return;
+		}
+
+		type_id = type->type;
+		type = cu__type(be->cu, type_id);
+	}
+}
+
+static void bulk_emitter__emit_typedef(struct bulk_emitter *be, struct tag *tdef)
+{
+	struct type *def = tag__type(tdef);
+	struct tag *type = cu__type(be->cu, tdef->type);
+
+	if (type != NULL && tag__is_enumeration(type) && type__name(tag__type(type)) == NULL) {
+		struct conf_fprintf conf = {
+			.suffix = type__name(def),
+		};
+
+		fputs("typedef ", be->fp);
+		enumeration__fprintf(type, &conf, be->fp);
+		fputs(";\n", be->fp);
+	} else if (type != NULL && (tag__is_struct(type) || tag__is_union(type)) &&
+		   type__name(tag__type(type)) == NULL) {
+		type__emit(type, be->cu, "typedef", type__name(def), be->fp);
+		tag__type(type)->definition_emitted = 1;
+	} else {
+		typedef__fprintf(tdef, be->cu, NULL, be->fp);
+		fputs(";\n", be->fp);
+	}
+
+	type_emissions__add_definition(be->emissions, def);
+}
+
+static void bulk_emitter__emit(struct bulk_emitter *be, struct tag *tag)
+{
+	struct type *ctype = tag__type(tag);
+
+	switch (tag->tag) {
+	case DW_TAG_typedef:
+		bulk_emitter__emit_typedef(be, tag);
+		break;
+	case DW_TAG_enumeration_type: {
+		struct conf_fprintf conf = {
+			.suffix = NULL,
+		};
+
+		enumeration__fprintf(tag, &conf, be->fp);
+		fputs(";\n", be->fp);
+		type_emissions__add_definition(be->emissions, ctype);
+		break;
+	}
+	default:
+		// Renamed when starting to visit it, but a clashing type may have been emitted since
+		type__disambiguate_shadow_definition(tag, be->cu, be->emissions);
+		type_emissions__add_definition(be->emissions, ctype);
+		type__check_structs_at_unnatural_alignments(ctype, be->cu);
+		type__emit(tag, be->cu, NULL, NULL, be->fp);
+		fputc('\n', be->fp);
+		break;
+	}
+}
+
+/*
+ * Is @type_id, used by value, a struct or union still being visited, i.e. not
+ * yet complete, or something that needs one, such as an array of it?
+ */
+static bool bulk_emitter__is_incomplete(struct bulk_emitter *be, type_id_t type_id)
+{
+	struct tag *type = cu__type(be->cu, type_id);
+
+	while (type != NULL) {
+		switch (type->tag) {
+		case DW_TAG_array_type:
+		case DW_TAG_const_type:
+		case DW_TAG_volatile_type:
+		case DW_TAG_typedef:
+			break;
+		case DW_TAG_structure_type:
+		case DW_TAG_union_type:
+			return type_id < be->nr_types && be->state[type_id] == BULK_EMITTER__VISITING;
+		default: // Pointers, functions, base types, enums
+			return false;
+		}
+
+		type_id = type->type;
+		type = cu__type(be->cu, type_id);
+	}
+
+	return false;
+}
+
+/*
+ * A typedef for an array of a struct that has a pointer back to the typedef
+ * can't be emitted before the struct is complete, nor forward declared, so
+ * emit it right after that struct, see bulk_emitter__emit_deferred().
+ */
+static bool bulk_emitter__defer_typedef(struct bulk_emitter *be, type_id_t id)
+{
+	if (be->nr_deferred == be->allocated_deferred) {
+		uint32_t allocated = be->allocated_deferred ? be->allocated_deferred * 2 : 16;
+		type_id_t *deferred = realloc(be->deferred, allocated * sizeof(*deferred));
+
+		// Emit it now then, as before
+		if (deferred == NULL)
+			return false;
+
+		be->deferred = deferred;
+		be->allocated_deferred = allocated;
+	}
+
+	be->deferred[be->nr_deferred++] = id;
+	be->state[id] = BULK_EMITTER__DEFERRED;
+	return true;
+}
+
+// Emit the deferred typedefs that have what they need complete by now
+static void bulk_emitter__emit_deferred(struct bulk_emitter *be)
+{
+	uint32_t i = 0;
+
+	while (i < be->nr_deferred) {
+		const type_id_t id = be->deferred[i];
+		struct tag *tdef = cu__type(be->cu, id);
+
+		if (bulk_emitter__is_incomplete(be, tdef->type)) {
+			++i;
+			continue;
+		}
+
+		be->deferred[i] = be->deferred[--be->nr_deferred];
+		bulk_emitter__emit(be, tdef);
+		be->state[id] = BULK_EMITTER__DONE;
+		// Emitting it may have completed what others were waiting for
+		i = 0;
+	}
+}
+
+static void bulk_emitter__visit(struct bulk_emitter *be, type_id_t id)
+{
+	struct tag *tag = cu__type(be->cu, id);
+
+	if (tag == NULL || id >= be->nr_types || be->state[id] != BULK_EMITTER__NEW)
+		return;
+
+	if (!tag__is_struct(tag) && !tag__is_union(tag) &&
+	    !tag__is_enumeration(tag) && !tag__is_typedef(tag))
+		return;
+
+	struct type *ctype = tag__type(tag);
+	const char *name = type__name(ctype);
+
+	if (name != NULL) {
+		/* Have we already emitted it, in this CU or in previous ones? */
+		if (ctype->definition_emitted) {
+			be->state[id] = BULK_EMITTER__DONE;
+			return;
+		}
+
+		if (type_emissions__find_definition(be->emissions, tag->tag, name) != NULL) {
+			ctype->definition_emitted = 1;
+			be->state[id] = BULK_EMITTER__DONE;
+			return;
+		}
+	}
+
+	be->state[id] = BULK_EMITTER__VISITING;
+
+	/*
+	 * Rename it now, if it clashes with an already emitted type of another
+	 * kind, as forward declarations may be emitted while visiting its members.
+	 */
+	if (name != NULL && (tag__is_struct(tag) || tag__is_union(tag)))
+		type__disambiguate_shadow_definition(tag, be->cu, be->emissions);
+
+	if (tag__is_typedef(tag)) {
+		bulk_emitter__visit_use(be, tag->type, true);
+		if (bulk_emitter__is_incomplete(be, tag->type) && bulk_emitter__defer_typedef(be, id))
+			return;
+	} else if (!tag__is_enumeration(tag)) {
+		struct class_member *pos;
+
+		type__for_each_member(ctype, pos)
+			bulk_emitter__visit_use(be, pos->tag.type, false);
+	}
+
+	// Anonymous types are printed inline by what uses them
+	if (name != NULL)
+		bulk_emitter__emit(be, tag);
+
+	be->state[id] = BULK_EMITTER__DONE;
+
+	if (be->nr_deferred != 0 && (tag__is_struct(tag) || tag__is_union(tag)))
+		bulk_emitter__emit_deferred(be);
+}
+
+int cu__emit_definitions(struct cu *cu, const uint32_t *ids, uint32_t nr_ids,
+			 struct type_emissions *emissions, FILE *fp)
+{
+	struct bulk_emitter be = {
+		.cu	   = cu,
+		.emissions = emissions,
+		.fp	   = fp,
+		.nr_types  = cu->types_table.nr_entries,
+	};
+
+	be.state = calloc(be.nr_types, sizeof(be.state[0]));
+	if (be.state == NULL)
+		return -ENOMEM;
+
+	for (uint32_t i = 0; i < nr_ids; ++i)
+		bulk_emitter__visit(&be, ids[i]);
+
+	free(be.deferred);
+	free(be.state);
+	return 0;
+}
@@ -9,6 +9,7 @@
 */
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include "list.h"
 
@@ -17,17 +18,42 @@ struct ftype;
 struct tag;
 struct type;
 
+/*
+ * struct type_emissions_table - emitted types, by name
+ *
+ * @entries - open addressing, @nr_slots is a power of two
+ * @nr_used - including the slots of removed entries
+ */
+struct type_emissions_table {
+	struct type_emissions_entry *entries;
+	uint32_t		    nr_used;
+	uint32_t		    nr_slots;
+	uint8_t			    bits;
+};
+
+/*
+ * @definitions_table, @fwd_decls_table - to find types in @definitions and
+ *	@fwd_decls by name, that is what gets looked up for each type referenced
+ *	in the types being emitted.
+ * @no_tables - couldn't grow the tables, walk the lists
+ */
 struct type_emissions {
 	struct list_head definitions; /* struct type entries */
 	struct list_head fwd_decls;   /* struct class entries */
+	struct type_emissions_table definitions_table;
+	struct type_emissions_table fwd_decls_table;
+	bool			    no_tables;
 };
 
 void type_emissions__init(struct type_emissions *temissions);
+void type_emissions__exit(struct type_emissions *temissions);
 
 int ftype__emit_definitions(struct ftype *ftype, struct cu *cu,
 			    struct type_emissions *emissions, FILE *fp);
 int type__emit_definitions(struct tag *tag, struct cu *cu,
 			   struct type_emissions *emissions, FILE *fp);
+int cu__emit_definitions(struct cu *cu, const uint32_t *ids, uint32_t nr_ids,
+			 struct type_emissions *emissions, FILE *fp);
 void type__emit(struct tag *tag_type, struct cu *cu,
 		const char *prefix, const char *suffix, FILE *fp);
 struct type *type_emissions__find_definition(const struct type_emissions *temissions,
@@ -10,6 +10,7 @@
 #include <dwarf.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -21,6 +22,10 @@
 
 #include "config.h"
 #include "dwarves.h"
+#include "hash.h"
+
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
 
 static const char *dwarf_tag_names[] = {
 	[DW_TAG_array_type]		  = "array_type",
@@ -148,6 +153,99 @@ static struct conf_fprintf conf_fprintf__defaults = {
 
 const char tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
 
+/*
+ * Appenders for the most common bits of output when printing types, to avoid
+ * parsing a format string for each, they return what they printed, like
+ * fprintf() does.
+ */
+#define fputs_literal(fp, str) fwrite(str, 1, sizeof(str) - 1, fp)
+
+static size_t fputs_len(const char *s, FILE *fp)
+{
+	// As printf("%s", NULL) does in glibc
+	if (s == NULL)
+		s = "(null)";
+
+	return fwrite(s, 1, strlen(s), fp);
+}
+
+// Same as fprintf(fp, "%.*s", indent, tabs)
+static size_t fprintf_indent(int indent, FILE *fp)
+{
+	if (indent < 0 || indent >= (int)sizeof(tabs))
+		indent = sizeof(tabs) - 1;
+
+	return fwrite(tabs, 1, indent, fp);
+}
+
+// Same as fprintf(fp, "%*s", width, " ")
+static size_t fprintf_spaces(int width, FILE *fp)
+{
+	static const char spaces[] = "                                                                ";
+	size_t printed = 0;
+
+	if (width < 0)
+		width = -width;
+	if (width == 0)
+		width = 1;
+
+	while (width > 0) {
+		int n = width < (int)sizeof(spaces) - 1 ? width : (int)sizeof(spaces) - 1;
+
+		printed += fwrite(spaces, 1, n, fp);
+		width -= n;
+	}
+
+	return printed;
+}
+
+// Same as fprintf(fp, "%*u", width, value)
+static size_t fprintf_uint(uint32_t value, int width, FILE *fp)
+{
+	char bf[16], *s = bf + sizeof(bf);
+	int len;
+
+	do {
+		*--s = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+
+	len = bf + sizeof(bf) - s;
+
+	// Negative widths left justify
+	if (width < 0)
+		return fwrite(s, 1, len, fp) + (-width > len ? fprintf_spaces(-width - len, fp) : 0);
+
+	return (width > len ? fprintf_spaces(width - len, fp) : 0) + fwrite(s, 1, len, fp);
+}
+
+// The "   /* offset" in the member comments
+static size_t fprintf_offset_comment(int spacing, uint32_t offset, bool hex_fmt, FILE *fp)
+{
+	if (hex_fmt)
+		return fprintf(fp, "%*s/* %#5x", spacing, " ", offset);
+
+	return fprintf_spaces(spacing, fp) + fputs_literal(fp, "/* ") + fprintf_uint(offset, 5, fp);
+}
+
+// The ":bit_offset" in the member comments
+static size_t fprintf_bitfield_offset_comment(uint32_t bitfield_offset, bool hex_fmt, FILE *fp)
+{
+	if (hex_fmt)
+		return fprintf(fp, ":%#2x", bitfield_offset);
+
+	return fputs_literal(fp, ":") + fprintf_uint(bitfield_offset, 2, fp);
+}
+
+// The " size */" in the member comments
+static size_t fprintf_size_comment(int spacing, uint32_t size, bool hex_fmt, FILE *fp)
+{
+	if (hex_fmt)
+		return fprintf(fp, " %#*x */", spacing, size);
+
+	return fputs_literal(fp, " ") + fprintf_uint(size, spacing, fp) + fputs_literal(fp, " */");
+}
+
 /*
  * In dwarves_emit.c we can call type__emit() using a locally setup conf_fprintf for which
  * the conf->cacheline_size member is not setup and is thus zero, so check for that and
@@ -219,6 +317,8 @@ size_t tag__fprintf_decl_info(const struct tag *tag,
 
 static size_t __class__fprintf(struct class *class, const struct cu *cu,
 			       const struct conf_fprintf *conf, FILE *fp);
+static size_t __tag__fprintf(struct tag *tag, const struct cu *cu,
+			     const struct conf_fprintf *conf, FILE *fp);
 static size_t type__fprintf(struct tag *type, const struct cu *cu,
 			    const char *name, const struct conf_fprintf *conf,
 			    FILE *fp);
@@ -261,7 +361,7 @@ static size_t array_type__fprintf(const struct tag *tag,
 			if (at->nr_entries[i] != 0 || !conf->last_member || single_member || conf->union_member)
 				printed += fprintf(fp, "[%u]", at->nr_entries[i]);
 			else
-				printed += fprintf(fp, "[]");
+				printed += fputs_literal(fp, "[]");
 		}
 	}
 
@@ -278,7 +378,7 @@ static size_t array_type__fprintf(const struct tag *tag,
 		if (flat_dimensions != 0 || !conf->last_member || single_member || conf->union_member)
 			printed += fprintf(fp, "[%llu]", flat_dimensions);
 		else
-			printed += fprintf(fp, "[]");
+			printed += fputs_literal(fp, "[]");
 	}
 
 	return printed;
@@ -313,21 +413,21 @@ size_t typedef__fprintf(const struct tag *tag, const struct cu *cu,
 
 	tag_type = cu__type(cu, tag->type);
 	if (tag_type == NULL) {
-		printed = fprintf(fp, "typedef ");
+		printed = fputs_literal(fp, "typedef ");
 		printed += tag__id_not_found_fprintf(fp, tag->type);
 		return printed + fprintf(fp, " %s", type__name(type));
 	}
 
 	switch (tag_type->tag) {
 	case DW_TAG_array_type:
-		printed = fprintf(fp, "typedef ");
+		printed = fputs_literal(fp, "typedef ");
 		return printed + array_type__fprintf(tag_type, cu, type__name(type), pconf, fp);
 	case DW_TAG_pointer_type:
 		if (tag_type->type == 0) /* void pointer */
 			break;
 		ptr_type = cu__type(cu, tag_type->type);
 		if (ptr_type == NULL) {
-			printed = fprintf(fp, "typedef ");
+			printed = fputs_literal(fp, "typedef ");
 			printed += tag__id_not_found_fprintf(fp, tag_type->type);
 			return printed + fprintf(fp, " *%s", type__name(type));
 		}
@@ -337,7 +437,7 @@ size_t typedef__fprintf(const struct tag *tag, const struct cu *cu,
 		is_pointer = 1;
 		/* Fall thru */
 	case DW_TAG_subroutine_type:
-		printed = fprintf(fp, "typedef ");
+		printed = fputs_literal(fp, "typedef ");
 		return printed + ftype__fprintf(tag__ftype(tag_type), cu, type__name(type),
 						0, is_pointer, 0, true, pconf, fp);
 	case DW_TAG_class_type:
@@ -350,7 +450,7 @@ size_t typedef__fprintf(const struct tag *tag, const struct cu *cu,
 		struct conf_fprintf tconf = *pconf;
 
 		tconf.suffix = type__name(type);
-		return fprintf(fp, "typedef ") + __class__fprintf(tag__class(tag_type), cu, &tconf, fp);
+		return fputs_literal(fp, "typedef ") + __class__fprintf(tag__class(tag_type), cu, &tconf, fp);
 	}
 	case DW_TAG_enumeration_type: {
 		struct type *ctype = tag__type(tag_type);
@@ -361,7 +461,7 @@ size_t typedef__fprintf(const struct tag *tag, const struct cu *cu,
 		struct conf_fprintf tconf = *pconf;
 
 		tconf.suffix = type__name(type);
-		return fprintf(fp, "typedef ") + enumeration__fprintf(tag_type, &tconf, fp);
+		return fputs_literal(fp, "typedef ") + enumeration__fprintf(tag_type, &tconf, fp);
 	}
 	}
 
@@ -373,7 +473,7 @@ static size_t imported_declaration__fprintf(const struct tag *tag,
 					    const struct cu *cu, FILE *fp)
 {
 	char bf[BUFSIZ];
-	size_t printed = fprintf(fp, "using ::");
+	size_t printed = fputs_literal(fp, "using ::");
 	const struct tag *decl = cu__function(cu, tag->type);
 
 	if (decl == NULL) {
@@ -426,7 +526,7 @@ size_t enumeration__fprintf(const struct tag *tag, const struct conf_fprintf *co
 		indent = sizeof(tabs) - 1;
 
 	if (type->nr_members) {
-		printed += fprintf(fp, " {\n");
+		printed += fputs_literal(fp, " {\n");
 	} else {
 		// enum x86_intercept_stage in the Linux kernel comes just as a forward
 		// declaration, but then BTF isn't setting the type->declaration to mark
@@ -438,7 +538,7 @@ size_t enumeration__fprintf(const struct tag *tag, const struct conf_fprintf *co
 		printed += fprintf(fp, "%.*s\t%-*s = ", indent, tabs,
 				   max_entry_name_len, enumerator__name(pos));
 		printed += fprintf(fp, conf->hex_fmt ?  "%#x" : "%u", pos->value);
-		printed += fprintf(fp, ",\n");
+		printed += fputs_literal(fp, ",\n");
 	}
 
 	printed += fprintf(fp, "%.*s}", indent, tabs);
@@ -613,6 +713,163 @@ static const char *__tag__name(const struct tag *tag, const struct cu *cu,
 	return bf;
 }
 
+/*
+ * struct tag_name_cache - names already rendered by tag__name() for a CU
+ *
+ * Only for the types that are expensive to render, pointers, arrays, qualified
+ * and function types, the ones that recurse. The names depend on just a couple
+ * of conf_fprintf knobs, that are part of the key.
+ *
+ * @names - the rendered names, freed all at once
+ * @entries - open addressing, @nr_slots is a power of two
+ */
+struct tag_name_cache_entry {
+	const struct tag *tag;
+	const char	 *name;
+	uint8_t		 variant;
+};
+
+struct tag_name_cache {
+	struct obstack		    names;
+	struct tag_name_cache_entry *entries;
+	uint32_t		    nr_entries;
+	uint32_t		    nr_slots;
+	uint8_t			    bits;
+};
+
+int cu__cache_tag_names(struct cu *cu)
+{
+	struct tag_name_cache *cache;
+
+	if (cu->tag_names)
+		return 0;
+
+	cache = zalloc(sizeof(*cache));
+	if (cache == NULL)
+		return -ENOMEM;
+
+	obstack_init(&cache->names);
+	cu->tag_names = cache;
+	return 0;
+}
+
+void cu__flush_tag_names(struct cu *cu)
+{
+	struct tag_name_cache *cache = cu->tag_names;
+
+	if (cache == NULL)
+		return;
+
+	obstack_free(&cache->names, NULL);
+	obstack_init(&cache->names);
+	zfree(&cache->entries);
+	cache->nr_entries = cache->nr_slots = 0;
+	cache->bits = 0;
+}
+
+void cu__uncache_tag_names(struct cu *cu)
+{
+	struct tag_name_cache *cache = cu->tag_names;
+
+	if (cache == NULL)
+		return;
+
+	obstack_free(&cache->names, NULL);
+	free(cache->entries);
+	zfree(&cu->tag_names);
+}
+
+static uint32_t tag_name_cache__slot(const struct tag_name_cache *cache, const struct tag *tag, uint8_t variant)
+{
+	uint32_t slot = hash_64((uintptr_t)tag ^ variant, cache->bits);
+
+	while (cache->entries[slot].tag != NULL &&
+	       (cache->entries[slot].tag != tag || cache->entries[slot].variant != variant))
+		slot = (slot + 1) & (cache->nr_slots - 1);
+
+	return slot;
+}
+
+static int tag_name_cache__grow(struct tag_name_cache *cache)
+{
+	const uint8_t bits = cache->bits ? cache->bits + 1 : 10;
+	struct tag_name_cache_entry *old_entries = cache->entries;
+	uint32_t old_nr_slots = cache->nr_slots;
+
+	cache->entries = calloc(1U << bits, sizeof(cache->entries[0]));
+	if (cache->entries == NULL) {
+		cache->entries = old_entries;
+		return -ENOMEM;
+	}
+
+	cache->nr_slots = 1U << bits;
+	cache->bits	= bits;
+
+	for (uint32_t i = 0; i < old_nr_slots; ++i) {
+		if (old_entries[i].tag)
+			cache->entries[tag_name_cache__slot(cache, old_entries[i].tag, old_entries[i].variant)] = old_entries[i];
+	}
+
+	free(old_entries);
+	return 0;
+}
+
+static bool tag__name_is_cacheable(const struct tag *tag)
+{
+	switch (tag->tag) {
+	case DW_TAG_pointer_type:
+	case DW_TAG_reference_type:
+	case DW_TAG_ptr_to_member_type:
+	case DW_TAG_volatile_type:
+	case DW_TAG_const_type:
+	case DW_TAG_restrict_type:
+	case DW_TAG_array_type:
+	case DW_TAG_subroutine_type:
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Renders @tag into @bf, as tag__name(), caching the result, unless it may have
+ * been truncated to @len, so that a caller with a bigger buffer gets it whole.
+ */
+static const char *tag_name_cache__name(struct tag_name_cache *cache, const struct tag *tag,
+					const struct cu *cu, char *bf, size_t len,
+					const struct conf_fprintf *conf)
+{
+	const struct conf_fprintf *pconf = conf ?: &conf_fprintf__defaults;
+	const uint8_t variant = pconf->classes_as_structs | (pconf->no_parm_names << 1);
+	uint32_t slot;
+
+	if (cache->nr_slots != 0) {
+		slot = tag_name_cache__slot(cache, tag, variant);
+		if (cache->entries[slot].tag != NULL) {
+			snprintf(bf, len, "%s", cache->entries[slot].name);
+			return bf;
+		}
+	}
+
+	const char *rendered = __tag__name(tag, cu, bf, len, conf);
+	const size_t rendered_len = strlen(rendered);
+
+	if (rendered_len + 1 >= len ||
+	    ((cache->nr_entries + 1) * 2 > cache->nr_slots && tag_name_cache__grow(cache)))
+		return rendered;
+
+	const char *name = obstack_copy0(&cache->names, rendered, rendered_len);
+
+	slot = tag_name_cache__slot(cache, tag, variant);
+	cache->entries[slot] = (struct tag_name_cache_entry){
+		.tag	 = tag,
+		.name	 = name,
+		.variant = variant,
+	};
+	++cache->nr_entries;
+	return rendered;
+}
+
 const char *tag__name(const struct tag *tag, const struct cu *cu,
 		      char *bf, size_t len, const struct conf_fprintf *conf)
 {
@@ -623,6 +880,9 @@ const char *tag__name(const struct tag *tag, const struct cu *cu,
 		return bf;
 	}
 
+	if (cu && cu->tag_names && tag__name_is_cacheable(tag))
+		return tag_name_cache__name(cu->tag_names, tag, cu, bf, len, conf);
+
 	__tag__name(tag, cu, bf + printed, len - printed, conf);
 
 	return bf;
@@ -658,7 +918,7 @@ static size_t type__fprintf_stats(struct type *type, const struct cu *cu,
 	if (type->nr_static_members != 0)
 		printed += fprintf(fp, ", static members: %u */\n", type->nr_static_members);
 	else
-		printed += fprintf(fp, " */\n");
+		printed += fputs_literal(fp, " */\n");
 
 	return printed;
 }
@@ -746,7 +1006,7 @@ static size_t type__fprintf(struct tag *type, const struct cu *cu,
 			type = type_type;
 		}
 		if (typedef_expanded)
-			printed += fprintf(fp, " */ ");
+			printed += fputs_literal(fp, " */ ");
 	}
 
 	tconf = *conf;
@@ -900,11 +1160,11 @@ static size_t class_member__fprintf(struct class_member *member, bool union_memb
 
 	if (member->tag.tag == DW_TAG_inheritance) {
 		name = "<ancestor>";
-		printed += fprintf(fp, "/* ");
+		printed += fputs_literal(fp, "/* ");
 	}
 
 	if (member->is_static)
-		printed += fprintf(fp, "static ");
+		printed += fputs_literal(fp, "static ");
 
 	/* For struct-like constructs, the name of the member cannot be
 	 * conflated with the name of its type, otherwise __attribute__ are
@@ -915,8 +1175,8 @@ static size_t class_member__fprintf(struct class_member *member, bool union_memb
 		printed += type__fprintf(type, cu, NULL, &sconf, fp);
 		if (name) {
 			if (!type__name(tag__type(type)))
-				printed += fprintf(fp, " ");
-			printed += fprintf(fp, "%s", name);
+				printed += fputs_literal(fp, " ");
+			printed += fputs_len(name, fp);
 		}
 	} else {
 		printed += type__fprintf(type, cu, name, &sconf, fp);
@@ -951,12 +1211,8 @@ static size_t class_member__fprintf(struct class_member *member, bool union_memb
 				slen += packed_len;
 			}
 
-			printed += fprintf(fp, sconf.hex_fmt ?
-							"%*s/* %#5x" :
-							"%*s/* %5u",
-					   (sconf.type_spacing +
-					    sconf.name_spacing - slen - 3),
-					   " ", offset);
+			printed += fprintf_offset_comment(sconf.type_spacing + sconf.name_spacing - slen - 3,
+							  offset, sconf.hex_fmt, fp);
 
 			if (member->bitfield_size != 0) {
 				unsigned int bitfield_offset = member->bitfield_offset;
@@ -964,27 +1220,24 @@ static size_t class_member__fprintf(struct class_member *member, bool union_memb
 				if (member->bitfield_offset < 0)
 					bitfield_offset = member->byte_size * 8 + member->bitfield_offset;
 
-				printed += fprintf(fp, sconf.hex_fmt ?  ":%#2x" : ":%2u", bitfield_offset);
+				printed += fprintf_bitfield_offset_comment(bitfield_offset, sconf.hex_fmt, fp);
 				size_spacing -= 3;
 			}
 
-			printed += fprintf(fp, sconf.hex_fmt ?  " %#*x */" : " %*u */", size_spacing, size);
+			printed += fprintf_size_comment(size_spacing, size, sconf.hex_fmt, fp);
 		}
 	} else {
 		int spacing = sconf.type_spacing + sconf.name_spacing - printed;
 
 		if (member->tag.tag == DW_TAG_inheritance) {
-			const size_t p = fprintf(fp, " */");
+			const size_t p = fputs_literal(fp, " */");
 			printed += p;
 			spacing -= p;
 		}
 		if (!sconf.suppress_offset_comment) {
 			int size_spacing = 5;
 
-			printed += fprintf(fp, sconf.hex_fmt ?
-						"%*s/* %#5x" : "%*s/* %5u",
-					   spacing > 0 ? spacing : 0, " ",
-					   offset);
+			printed += fprintf_offset_comment(spacing > 0 ? spacing : 0, offset, sconf.hex_fmt, fp);
 
 			if (member->bitfield_size != 0) {
 				unsigned int bitfield_offset = member->bitfield_offset;
@@ -992,15 +1245,11 @@ static size_t class_member__fprintf(struct class_member *member, bool union_memb
 				if (member->bitfield_offset < 0)
 					bitfield_offset = member->byte_size * 8 + member->bitfield_offset;
 
-				printed += fprintf(fp, sconf.hex_fmt ?
-							":%#2x" : ":%2u",
-						   bitfield_offset);
+				printed += fprintf_bitfield_offset_comment(bitfield_offset, sconf.hex_fmt, fp);
 				size_spacing -= 3;
 			}
 
-			printed += fprintf(fp, sconf.hex_fmt ?
-						" %#*x */" : " %*u */",
-					   size_spacing, size);
+			printed += fprintf_size_comment(size_spacing, size, sconf.hex_fmt, fp);
 		}
 	}
 	return printed + printed_cacheline;
@@ -1069,13 +1318,13 @@ static size_t union__fprintf(struct type *type, const struct cu *cu,
 		struct tag *pos_type = cu__type(cu, pos->tag.type);
 
 		if (pos_type == NULL) {
-			printed += fprintf(fp, "%.*s", uconf.indent, tabs);
+			printed += fprintf_indent(uconf.indent, fp);
 			printed += tag__id_not_found_fprintf(fp, pos->tag.type);
 			continue;
 		}
 
 		uconf.union_member = 1;
-		printed += fprintf(fp, "%.*s", uconf.indent, tabs);
+		printed += fprintf_indent(uconf.indent, fp);
 		printed += union_member__fprintf(pos, pos_type, cu, &uconf, fp);
 		fputc('\n', fp);
 		++printed;
@@ -1110,12 +1359,12 @@ size_t ftype__fprintf_parms(const struct ftype *ftype,
 	char sbf[128];
 	struct tag *type;
 	const char *name, *stype;
-	size_t printed = fprintf(fp, "(");
+	size_t printed = fputs_literal(fp, "(");
 
 	ftype__for_each_parameter(ftype, pos) {
 		if (!first_parm) {
 			if (indent == 0)
-				printed += fprintf(fp, ", ");
+				printed += fputs_literal(fp, ", ");
 			else
 				printed += fprintf(fp, ",\n%.*s",
 						   indent, tabs);
@@ -1162,11 +1411,11 @@ print_it:
 
 	/* No parameters? */
 	if (first_parm)
-		printed += fprintf(fp, "void)");
+		printed += fputs_literal(fp, "void)");
 	else if (ftype->unspec_parms)
-		printed += fprintf(fp, ", ...)");
+		printed += fputs_literal(fp, ", ...)");
 	else
-		printed += fprintf(fp, ")");
+		printed += fputs_literal(fp, ")");
 	return printed;
 }
 
@@ -1194,9 +1443,9 @@ static size_t function__tag_fprintf(const struct tag *tag, const struct cu *cu,
 			printed += tag__id_not_found_fprintf(fp, exp->ip.tag.type);
 			break;
 		}
-		printed = fprintf(fp, "%.*s", indent, tabs);
+		printed = fprintf_indent(indent, fp);
 		name = function__name(alias);
-		n = fprintf(fp, "%s", name);
+		n = fputs_len(name, fp);
 		size_t namelen = 0;
 		if (name != NULL)
 			namelen = strlen(name);
@@ -1215,7 +1464,7 @@ static size_t function__tag_fprintf(const struct tag *tag, const struct cu *cu,
 	}
 		break;
 	case DW_TAG_variable:
-		printed = fprintf(fp, "%.*s", indent, tabs);
+		printed = fprintf_indent(indent, fp);
 		n = fprintf(fp, "%s %s; /* scope: %s */",
 			    variable__type_name(vtag, cu, bf, sizeof(bf)),
 			    variable__name(vtag),
@@ -1225,7 +1474,7 @@ static size_t function__tag_fprintf(const struct tag *tag, const struct cu *cu,
 		break;
 	case DW_TAG_label: {
 		const struct label *label = vtag;
-		printed = fprintf(fp, "%.*s", indent, tabs);
+		printed = fprintf_indent(indent, fp);
 		fputc('\n', fp);
 		++printed;
 		c = fprintf(fp, "%s:", label__name(label));
@@ -1238,7 +1487,7 @@ static size_t function__tag_fprintf(const struct tag *tag, const struct cu *cu,
 		fputc('\n', fp);
 		return printed + 1;
 	default:
-		printed = fprintf(fp, "%.*s", indent, tabs);
+		printed = fprintf_indent(indent, fp);
 		n = fprintf(fp, "%s <%llx>", dwarf_tag_name(tag->tag),
 			    tag__orig_id(tag, cu));
 		c += n;
@@ -1270,7 +1519,7 @@ size_t lexblock__fprintf(const struct lexblock *block, const struct cu *cu,
 					   function__name(function),
 					   (unsigned long long)offset);
 	}
-	printed += fprintf(fp, "\n");
+	printed += fputs_literal(fp, "\n");
 	list_for_each_entry(pos, &block->tags, node)
 		printed += function__tag_fprintf(pos, cu, function, indent + 1,
 						 conf, fp);
@@ -1310,13 +1559,13 @@ static size_t function__fprintf(const struct tag *tag, const struct cu *cu,
 
 	if (func->virtuality == DW_VIRTUALITY_virtual ||
 	    func->virtuality == DW_VIRTUALITY_pure_virtual)
-		printed += fprintf(fp, "virtual ");
+		printed += fputs_literal(fp, "virtual ");
 
 	printed += ftype__fprintf(ftype, cu, function__name(func),
 				  inlined, 0, 0, false, conf, fp);
 
 	if (func->virtuality == DW_VIRTUALITY_pure_virtual)
-		printed += fprintf(fp, " = 0");
+		printed += fputs_literal(fp, " = 0");
 
 	return printed;
 }
@@ -1338,7 +1587,7 @@ size_t function__fprintf_stats(const struct tag *tag, const struct cu *cu,
 		printed += fprintf(fp, ", inline expansions: %u (%d bytes)",
 			func->lexblock.nr_inline_expansions,
 			func->lexblock.size_inline_expansions);
-	return printed + fprintf(fp, " */\n");
+	return printed + fputs_literal(fp, " */\n");
 }
 
 static size_t class__fprintf_cacheline_boundary(struct conf_fprintf *conf,
@@ -1363,7 +1612,7 @@ static size_t class__fprintf_cacheline_boundary(struct conf_fprintf *conf,
 					   "*/\n", cacheline,
 					   cacheline_in_bytes, cacheline_pos);
 
-		printed += fprintf(fp, "%.*s", indent, tabs);
+		printed += fprintf_indent(indent, fp);
 
 		*conf->cachelinep = cacheline;
 	}
@@ -1443,15 +1692,15 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 			continue;
 
 		if (first) {
-			printed += fprintf(fp, " :");
+			printed += fputs_literal(fp, " :");
 			first = 0;
 		} else
-			printed += fprintf(fp, ",");
+			printed += fputs_literal(fp, ",");
 
 		pos = tag__class_member(tag_pos);
 
 		if (pos->virtuality == DW_VIRTUALITY_virtual)
-			printed += fprintf(fp, " virtual");
+			printed += fputs_literal(fp, " virtual");
 
 		accessibility = tag__accessibility(tag_pos);
 		if (accessibility != NULL)
@@ -1465,7 +1714,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 			printed += tag__id_not_found_fprintf(fp, tag_pos->type);
 	}
 
-	printed += fprintf(fp, " {\n");
+	printed += fputs_literal(fp, " {\n");
 
 	if (class->pre_bit_hole > 0 && !cconf.suppress_comments) {
 		if (!newline++) {
@@ -1505,8 +1754,8 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 		if (tag_pos->tag != DW_TAG_member &&
 		    tag_pos->tag != DW_TAG_inheritance) {
 			if (!cconf.show_only_data_members) {
-				printed += tag__fprintf(tag_pos, cu, &cconf, fp);
-				printed += fprintf(fp, "\n\n");
+				printed += __tag__fprintf(tag_pos, cu, &cconf, fp);
+				printed += fputs_literal(fp, "\n\n");
 			}
 			continue;
 		}
@@ -1537,7 +1786,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 				struct tag *pos_type = cu__type(cu, pos->tag.type);
 
 				if (pos_type == NULL) {
-					printed += fprintf(fp, "%.*s", cconf.indent, tabs);
+					printed += fprintf_indent(cconf.indent, fp);
 					printed += tag__id_not_found_fprintf(fp, pos->tag.type);
 					continue;
 				}
@@ -1550,7 +1799,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 					bitfield_size = 0;
 				}
 
-				printed += fprintf(fp, "%.*s", cconf.indent, tabs);
+				printed += fprintf_indent(cconf.indent, fp);
 				printed += type__fprintf(pos_type, cu, "", &cconf, fp);
 				printed += fprintf(fp, ":%u;\n", bitfield_size);
 			}
@@ -1600,7 +1849,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 
 		struct tag *pos_type = cu__type(cu, pos->tag.type);
 		if (pos_type == NULL) {
-			printed += fprintf(fp, "%.*s", cconf.indent, tabs);
+			printed += fprintf_indent(cconf.indent, fp);
 			printed += tag__id_not_found_fprintf(fp, pos->tag.type);
 			continue;
 		}
@@ -1609,7 +1858,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 		cconf.first_member = last == NULL;
 
 		size = pos->byte_size;
-		printed += fprintf(fp, "%.*s", cconf.indent, tabs);
+		printed += fprintf_indent(cconf.indent, fp);
 		printed += struct_member__fprintf(pos, pos_type, cu, &cconf, fp);
 
 		if (tag__is_struct(pos_type) && !cconf.suppress_comments) {
@@ -1733,7 +1982,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 			printed += fprintf(fp, "\n%.*s/* Force padding: */\n", cconf.indent, tabs);
 
 			for (added_padding = 0; added_padding < class->padding; added_padding += size) {
-				printed += fprintf(fp, "%.*s", cconf.indent, tabs);
+				printed += fprintf_indent(cconf.indent, fp);
 				printed += type__fprintf(tag_pos, cu, "", &cconf, fp);
 				printed += fprintf(fp, ":%u;\n", bit_size);
 			}
@@ -1755,7 +2004,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 			if (sum_holes > 0)
 				printed += fprintf(fp, ", holes: %d, sum holes: %u",
 						   class->nr_holes, sum_holes);
-			printed += fprintf(fp, " */\n");
+			printed += fputs_literal(fp, " */\n");
 		}
 		if (sum_bits > 0) {
 			printed += fprintf(fp, "%.*s/* sum bitfield members: %u bits",
@@ -1765,7 +2014,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 						   class->nr_bit_holes, sum_bit_holes);
 			else
 				printed += fprintf(fp, " (%u bytes)", sum_bits / 8);
-			printed += fprintf(fp, " */\n");
+			printed += fputs_literal(fp, " */\n");
 		}
 	}
 	if (class->padding > 0)
@@ -1790,7 +2039,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 					   nr_forced_alignment_holes,
 					   sum_forced_alignment_holes);
 		}
-		printed += fprintf(fp, " */\n");
+		printed += fputs_literal(fp, " */\n");
 	}
 	cacheline = (cconf.base_offset + type->size) % conf_fprintf__cacheline_size(conf);
 	if (cacheline != 0)
@@ -1819,7 +2068,7 @@ out:
 	printed += fprintf(fp, "%.*s}", indent, tabs);
 
 	if (class->is_packed && !cconf.suppress_packed)
-		printed += fprintf(fp, " __attribute__((__packed__))");
+		printed += fputs_literal(fp, " __attribute__((__packed__))");
 
 	if (cconf.suffix)
 		printed += fprintf(fp, " %s", cconf.suffix);
@@ -1854,7 +2103,7 @@ static size_t variable__fprintf(const struct tag *tag, const struct cu *cu,
 			const char *varprefix = variable__prefix(var);
 
 			if (varprefix != NULL)
-				printed += fprintf(fp, "%s", varprefix);
+				printed += fputs_len(varprefix, fp);
 			printed += type__fprintf(type, cu, name, conf, fp);
 		}
 	}
@@ -1873,15 +2122,15 @@ static size_t namespace__fprintf(const struct tag *tag, const struct cu *cu,
 	cconf.no_semicolon = 0;
 
 	namespace__for_each_tag(space, pos) {
-		printed += tag__fprintf(pos, cu, &cconf, fp);
-		printed += fprintf(fp, "\n\n");
+		printed += __tag__fprintf(pos, cu, &cconf, fp);
+		printed += fputs_literal(fp, "\n\n");
 	}
 
-	return printed + fprintf(fp, "}");
+	return printed + fputs_literal(fp, "}");
 }
 
-size_t tag__fprintf(struct tag *tag, const struct cu *cu,
-		    const struct conf_fprintf *conf, FILE *fp)
+static size_t __tag__fprintf(struct tag *tag, const struct cu *cu,
+			     const struct conf_fprintf *conf, FILE *fp)
 {
 	size_t printed = 0;
 	struct conf_fprintf tconf;
@@ -1913,12 +2162,12 @@ size_t tag__fprintf(struct tag *tag, const struct cu *cu,
 		++tag->recursivity_level;
 
 	if (pconf->show_decl_info) {
-		printed += fprintf(fp, "%.*s", pconf->indent, tabs);
+		printed += fprintf_indent(pconf->indent, fp);
 		printed += fprintf(fp, "/* Used at: %s */\n", cu->name);
-		printed += fprintf(fp, "%.*s", pconf->indent, tabs);
+		printed += fprintf_indent(pconf->indent, fp);
 		printed += tag__fprintf_decl_info(tag, cu, fp);
 	}
-	printed += fprintf(fp, "%.*s", pconf->indent, tabs);
+	printed += fprintf_indent(pconf->indent, fp);
 
 	switch (tag->tag) {
 	case DW_TAG_array_type:
@@ -1980,6 +2229,32 @@ size_t tag__fprintf(struct tag *tag, const struct cu *cu,
 	return printed;
 }
 
+/*
+ * Printing a struct takes many small writes, for each member its type, name,
+ * offset and size comments, holes, cacheline boundaries, so render it in a
+ * memory stream, that isn't shared, so without stdio locking, then write it all
+ * at once to @fp.
+ */
+size_t tag__fprintf(struct tag *tag, const struct cu *cu,
+		    const struct conf_fprintf *conf, FILE *fp)
+{
+	size_t size = 0, printed;
+	char *bf = NULL;
+	FILE *bfp = open_memstream(&bf, &size);
+
+	if (bfp == NULL)
+		return __tag__fprintf(tag, cu, conf, fp);
+
+	__fsetlocking(bfp, FSETLOCKING_BYCALLER);
+	printed = __tag__fprintf(tag, cu, conf, bfp);
+	fclose(bfp);
+
+	fwrite(bf, 1, size, fp);
+	free(bf);
+
+	return printed;
+}
+
 void cus__print_error_msg(const char *progname, const struct cus *cus,
 			  const char *filename, const int err)
 {
@@ -7,12 +7,20 @@
   Copyright (C) 2007 Arnaldo Carvalho de Melo <acme@redhat.com>
 */
 
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include "list.h"
 #include "dwarves_reorganize.h"
 #include "dwarves.h"
+#include "hash.h"
 
 static void class__recalc_holes(struct class *class)
 {
+	type__free_members_layout(&class->type);
 	class->holes_searched = 0;
 	class__find_holes(class);
 }
@@ -23,6 +31,8 @@ void class__subtract_offsets_from(struct class *class,
 {
 	struct class_member *member;
 
+	type__free_members_layout(&class->type);
+
 	class__for_each_member_continue(class, from, member) {
 		member->byte_offset -= size;
 		member->bit_offset  -= size * 8;
@@ -46,6 +56,8 @@ void class__add_offsets_from(struct class *class, struct class_member *from,
 {
 	struct class_member *member;
 
+	type__free_members_layout(&class->type);
+
 	class__for_each_member_continue(class, from, member) {
 		member->byte_offset += size;
 		member->bit_offset  += size * 8;
@@ -62,6 +74,8 @@ void class__fixup_alignment(struct class *class, const struct cu *cu)
 	struct class_member *pos, *last_member = NULL;
 	size_t power2;
 
+	type__free_members_layout(&class->type);
+
 	type__for_each_data_member(&class->type, pos) {
 		if (last_member == NULL && pos->byte_offset != 0) { /* paranoid! */
 			class__subtract_offsets_from(class, pos,
@@ -412,6 +426,8 @@ static void class__demote_bitfield_members(struct class *class,
 {
 	struct class_member *member;
 
+	type__free_members_layout(&class->type);
+
 	class__for_each_member_from(class, from, member) {
 		member->byte_size = new_type->bit_size / 8;
 		member->tag.type = new_type_id;
@@ -614,6 +630,8 @@ static void class__fixup_bitfield_types(struct class *class,
 {
 	struct class_member *member;
 
+	type__free_members_layout(&class->type);
+
 	class__for_each_member_from(class, from, member) {
 		if (member == to_before)
 			break;
@@ -846,3 +864,572 @@ restart:
 		}
 	}
 }
+
+/*
+ * class__reorganize() above is greedy: it moves members to fill holes, one at
+ * a time, and often leaves holes a careful layout wouldn't have, besides not
+ * considering cachelines at all.
+ *
+ * What follows searches all the orderings, branch and bound, for the one with
+ * the smallest size, then, if there is an access profile, with the hottest
+ * members in the first cachelines, i.e. the smallest sum of the member access
+ * counts times the cacheline they are in, then with the fewest members
+ * straddling cachelines, within a time budget, returning the best found if it
+ * runs out.
+ *
+ * The members are grouped into units that move together: a bitfield run, with
+ * its storage, or a member plus the zero sized ones before it, markers such as
+ * the kernel's __cacheline_group_begin(). Units with the same size and
+ * alignment are interchangeable, so they are kept in their original relative
+ * order, hottest first, which cuts the search space enormously, and the same
+ * number of units of each such class placed ending at the same offset leaves
+ * the same problem to solve, so that is remembered and not searched again
+ * unless reached with a lower cost.
+ */
+
+struct reorg_unit {
+	struct class_member *first;
+	struct class_member *last;
+	uint32_t	    offset;
+	uint32_t	    size;
+	uint32_t	    alignment;
+	uint16_t	    klass;
+	uint64_t	    weight;
+};
+
+// After the size, what is minimized
+struct reorg_cost {
+	uint64_t hot;
+	uint32_t straddles;
+};
+
+static bool reorg_cost__less(const struct reorg_cost *a, const struct reorg_cost *b)
+{
+	return a->hot < b->hot || (a->hot == b->hot && a->straddles < b->straddles);
+}
+
+struct reorg_class {
+	uint32_t size;
+	uint32_t alignment;
+	uint16_t nr_units;
+	uint16_t *units;
+};
+
+struct reorg_memo_entry {
+	uint64_t	  key;
+	uint32_t	  offset;
+	struct reorg_cost cost;
+};
+
+#define REORG_MEMO_BITS 16
+
+struct reorg_search {
+	struct reorg_unit  *units;
+	struct reorg_class *classes;
+	uint16_t	   nr_units;
+	uint16_t	   nr_classes;
+	uint16_t	   *used;	 // units placed per class
+	uint16_t	   *path;	 // classes, in placement order
+	uint16_t	   *best_path;
+	uint16_t	   *candidates;	 // nr_classes per depth, in the order to try them
+	uint32_t	   best_size;
+	struct reorg_cost  best_cost;
+	uint32_t	   alignment;	 // of the struct
+	uint32_t	   tail_alignment; // of the zero sized members at the end, if any
+	uint32_t	   cacheline_size;
+	uint64_t	   nr_states;
+	struct timespec	   deadline;
+	bool		   out_of_time;
+	struct reorg_memo_entry memo[1 << REORG_MEMO_BITS];
+};
+
+static bool reorg_search__out_of_time(struct reorg_search *search)
+{
+	struct timespec now;
+
+	if (search->out_of_time)
+		return true;
+
+	// Don't look at the clock all the time
+	if ((++search->nr_states & 1023) != 0)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec > search->deadline.tv_sec ||
+	    (now.tv_sec == search->deadline.tv_sec && now.tv_nsec >= search->deadline.tv_nsec))
+		search->out_of_time = true;
+
+	return search->out_of_time;
+}
+
+static uint32_t reorg_search__straddles(const struct reorg_search *search, uint32_t offset, uint32_t size)
+{
+	// Something bigger than a cacheline will straddle one no matter what
+	if (size > search->cacheline_size)
+		return 0;
+
+	return (offset % search->cacheline_size) + size > search->cacheline_size;
+}
+
+static uint32_t reorg_search__final_size(const struct reorg_search *search, uint32_t offset)
+{
+	offset = roundup(offset, search->tail_alignment);
+	return roundup(offset, search->alignment);
+}
+
+// Returns true if this state was already reached ending at the same offset with no higher cost
+static bool reorg_search__memoized(struct reorg_search *search, uint32_t offset, const struct reorg_cost *cost)
+{
+	uint64_t key = hash_bytes(HASH_BYTES__INIT, search->used, search->nr_classes * sizeof(search->used[0]));
+	struct reorg_memo_entry *entry = &search->memo[hash_64(key ^ offset, REORG_MEMO_BITS)];
+
+	if (entry->key == key && entry->offset == offset && !reorg_cost__less(cost, &entry->cost))
+		return true;
+
+	entry->key    = key;
+	entry->offset = offset;
+	entry->cost   = *cost;
+	return false;
+}
+
+// Hottest first, then in the original order
+static bool reorg_search__unit_before(const struct reorg_search *search, uint16_t a, uint16_t b)
+{
+	const uint64_t weight_a = search->units[a].weight, weight_b = search->units[b].weight;
+
+	return weight_a > weight_b || (weight_a == weight_b && a < b);
+}
+
+static void reorg_search__dfs(struct reorg_search *search, uint16_t depth, uint32_t offset,
+			      const struct reorg_cost *cost, uint32_t remaining_size)
+{
+	if (reorg_search__out_of_time(search))
+		return;
+
+	if (depth == search->nr_units) {
+		uint32_t size = reorg_search__final_size(search, offset);
+
+		if (size < search->best_size ||
+		    (size == search->best_size && reorg_cost__less(cost, &search->best_cost))) {
+			search->best_size = size;
+			search->best_cost = *cost;
+			memcpy(search->best_path, search->path, search->nr_units * sizeof(search->path[0]));
+		}
+		return;
+	}
+
+	uint32_t lower_bound = reorg_search__final_size(search, offset + remaining_size);
+
+	// The cost only grows as units are placed
+	if (lower_bound > search->best_size ||
+	    (lower_bound == search->best_size && !reorg_cost__less(cost, &search->best_cost)))
+		return;
+
+	if (reorg_search__memoized(search, offset, cost))
+		return;
+
+	/*
+	 * Try first the class whose next unit is the hottest or, for the same
+	 * weight, comes first in the original layout, so that without a profile
+	 * the first solution found is the original order and only strictly
+	 * better layouts replace it.
+	 */
+	uint16_t *candidates = &search->candidates[depth * search->nr_classes];
+	int nr_candidates = 0;
+
+	for (int i = 0; i < search->nr_classes; ++i) {
+		const struct reorg_class *class = &search->classes[i];
+		int j;
+
+		if (search->used[i] == class->nr_units)
+			continue;
+
+		for (j = nr_candidates; j > 0; --j) {
+			const struct reorg_class *prev = &search->classes[candidates[j - 1]];
+
+			if (reorg_search__unit_before(search, prev->units[search->used[candidates[j - 1]]],
+						      class->units[search->used[i]]))
+				break;
+			candidates[j] = candidates[j - 1];
+		}
+		candidates[j] = i;
+		++nr_candidates;
+	}
+
+	for (int i = 0; i < nr_candidates; ++i) {
+		const uint16_t klass = candidates[i];
+		const struct reorg_class *class = &search->classes[klass];
+		const struct reorg_unit *unit = &search->units[class->units[search->used[klass]]];
+		uint32_t start = roundup(offset, class->alignment);
+		struct reorg_cost unit_cost = {
+			.hot	   = cost->hot + unit->weight * (start / search->cacheline_size),
+			.straddles = cost->straddles + reorg_search__straddles(search, start, class->size),
+		};
+
+		search->path[depth] = klass;
+		++search->used[klass];
+		reorg_search__dfs(search, depth + 1, start + class->size, &unit_cost, remaining_size - class->size);
+		--search->used[klass];
+	}
+}
+
+static uint32_t class_member__reorg_alignment(struct class_member *member, const struct cu *cu)
+{
+	size_t alignment = member->bitfield_size ? member->byte_size :
+			   tag__natural_alignment(cu__type(cu, member->tag.type), cu);
+
+	if (member->alignment > alignment)
+		alignment = member->alignment;
+
+	return alignment ?: 1;
+}
+
+/*
+ * Splits the members into units, returns how many or a negative errno if this
+ * class isn't supported, in which case the greedy algorithm can be used.
+ */
+static int class__reorg_units(struct class *class, const struct cu *cu,
+			      const struct reorganize_profile *profile, struct reorg_unit *units,
+			      struct class_member **tail, uint32_t *tail_alignment)
+{
+	struct class_member *pos, *markers = NULL, *prev = NULL;
+	uint32_t markers_alignment = 1;
+	uint64_t markers_weight = 0;
+	struct reorg_unit *unit = NULL;
+	int nr_units = 0;
+
+	type__for_each_member(&class->type, pos) {
+		if (pos->tag.tag == DW_TAG_inheritance)
+			return -EINVAL;
+
+		if (pos->tag.tag != DW_TAG_member || pos->is_static)
+			continue;
+
+		uint32_t alignment = class_member__reorg_alignment(pos, cu);
+		uint64_t weight = profile ? profile->member_weight(profile, class, pos) : 0;
+
+		if (pos->bitfield_size) {
+			// Continuing a bitfield run?
+			if (unit && prev && prev->bitfield_size && unit->last == prev && markers == NULL) {
+				uint32_t end = pos->byte_offset + pos->byte_size;
+
+				if (pos->byte_offset < unit->offset)
+					return -EINVAL;
+
+				if (end > unit->offset + unit->size)
+					unit->size = end - unit->offset;
+				if (alignment > unit->alignment)
+					unit->alignment = alignment;
+				unit->weight += weight;
+				unit->last = pos;
+				prev = pos;
+				continue;
+			}
+		} else if (pos->byte_size == 0) {
+			// Zero sized markers stay with what comes after them
+			if (markers == NULL)
+				markers = pos;
+			if (alignment > markers_alignment)
+				markers_alignment = alignment;
+			markers_weight += weight;
+			prev = pos;
+			continue;
+		}
+
+		// The previous unit was a bitfield run, its storage must be aligned to move it around
+		if (unit && unit->first->bitfield_size && unit->offset % unit->alignment)
+			return -EINVAL;
+
+		/*
+		 * And not shared with what comes next, as in 'int a:1; char c;', where
+		 * 'c' is at offset 1, inside the 'int' storage the run unit is sized
+		 * from, so it can't be moved as a whole, leave it to greedy.
+		 */
+		if (unit && unit->first->bitfield_size &&
+		    (markers ?: pos)->byte_offset < unit->offset + unit->size)
+			return -EINVAL;
+
+		unit = &units[nr_units++];
+		unit->first	= markers ?: pos;
+		unit->last	= pos;
+		unit->offset	= pos->byte_offset;
+		unit->size	= pos->byte_size;
+		unit->alignment = alignment > markers_alignment ? alignment : markers_alignment;
+		unit->weight	= weight + markers_weight;
+		markers = NULL;
+		markers_alignment = 1;
+		markers_weight = 0;
+		prev = pos;
+	}
+
+	if (unit && unit->first->bitfield_size && unit->offset % unit->alignment)
+		return -EINVAL;
+
+	// Flexible arrays, etc, stay at the end
+	*tail = markers;
+	*tail_alignment = markers_alignment;
+	return nr_units;
+}
+
+static int reorg_search__init_classes(struct reorg_search *search)
+{
+	uint16_t *indexes = malloc(search->nr_units * sizeof(indexes[0]));
+
+	search->classes = calloc(search->nr_units, sizeof(search->classes[0]));
+	if (indexes == NULL || search->classes == NULL) {
+		free(indexes);
+		return -ENOMEM;
+	}
+
+	for (uint16_t i = 0; i < search->nr_units; ++i) {
+		struct reorg_unit *unit = &search->units[i];
+		uint16_t klass;
+
+		for (klass = 0; klass < search->nr_classes; ++klass) {
+			if (search->classes[klass].size == unit->size &&
+			    search->classes[klass].alignment == unit->alignment)
+				break;
+		}
+
+		if (klass == search->nr_classes) {
+			search->classes[klass].size	 = unit->size;
+			search->classes[klass].alignment = unit->alignment;
+			++search->nr_classes;
+		}
+
+		unit->klass = klass;
+		++search->classes[klass].nr_units;
+	}
+
+	// Each class gets its slice of 'indexes', with its units in the original order
+	uint16_t *next = indexes;
+
+	for (uint16_t klass = 0; klass < search->nr_classes; ++klass) {
+		search->classes[klass].units = next;
+		next += search->classes[klass].nr_units;
+		search->classes[klass].nr_units = 0;
+	}
+
+	for (uint16_t i = 0; i < search->nr_units; ++i) {
+		struct reorg_class *class = &search->classes[search->units[i].klass];
+		int j;
+
+		/*
+		 * Same size and alignment, so placing the hotter ones first
+		 * is never worse.
+		 */
+		for (j = class->nr_units; j > 0 && reorg_search__unit_before(search, i, class->units[j - 1]); --j)
+			class->units[j] = class->units[j - 1];
+		class->units[j] = i;
+		++class->nr_units;
+	}
+
+	return 0;
+}
+
+static void reorg_search__delete(struct reorg_search *search)
+{
+	if (search == NULL)
+		return;
+
+	if (search->classes)
+		free(search->classes[0].units);
+	free(search->classes);
+	free(search->units);
+	free(search->used);
+	free(search->path);
+	free(search->best_path);
+	free(search->candidates);
+	free(search);
+}
+
+static void class_member__move(struct class_member *member, uint32_t byte_offset)
+{
+	member->bit_offset += (byte_offset - member->byte_offset) * 8;
+	member->byte_offset = byte_offset;
+}
+
+// Set the new offsets and move the members to the new order
+static void class__apply_reorg(struct class *class, struct reorg_search *search,
+			       struct class_member *tail)
+{
+	struct list_head *tags = &class->type.namespace.tags;
+	struct class_member *pos, *n;
+	LIST_HEAD(tail_members);
+	uint32_t offset = 0;
+
+	// Set the ones at the end aside, the units will be moved after them
+	if (tail) {
+		pos = tail;
+		list_for_each_entry_safe_from(pos, n, tags, tag.node) {
+			if (pos->tag.tag == DW_TAG_member && !pos->is_static)
+				list_move_tail(&pos->tag.node, &tail_members);
+		}
+	}
+
+	memset(search->used, 0, search->nr_classes * sizeof(search->used[0]));
+
+	for (uint16_t depth = 0; depth < search->nr_units; ++depth) {
+		struct reorg_class *klass = &search->classes[search->best_path[depth]];
+		struct reorg_unit *unit = &search->units[klass->units[search->used[search->best_path[depth]]++]];
+		uint32_t start = roundup(offset, unit->alignment);
+		struct class_member *member = unit->first;
+
+		// The members in a unit are contiguous, except for static ones, that stay where they are
+		while (1) {
+			struct class_member *next = list_entry(member->tag.node.next, struct class_member, tag.node);
+			bool last = member == unit->last;
+
+			if (member->tag.tag == DW_TAG_member && !member->is_static) {
+				if (member->byte_size == 0 && !member->bitfield_size)
+					class_member__move(member, start);
+				else
+					class_member__move(member, start + member->byte_offset - unit->offset);
+				list_move_tail(&member->tag.node, tags);
+			}
+
+			if (last)
+				break;
+			member = next;
+		}
+
+		offset = start + unit->size;
+	}
+
+	offset = roundup(offset, search->tail_alignment);
+
+	list_for_each_entry_safe(pos, n, &tail_members, tag.node) {
+		class_member__move(pos, offset);
+		list_move_tail(&pos->tag.node, tags);
+	}
+
+	class->type.size = search->best_size;
+	type__free_members_layout(&class->type);
+	class->holes_searched = false;
+	class__find_holes(class);
+}
+
+int class__reorganize_optimal(struct class *class, const struct cu *cu, uint16_t cacheline_size,
+			      unsigned int time_budget_ms, const struct reorganize_profile *profile,
+			      const int verbose, FILE *fp)
+{
+	struct reorg_search *search = zalloc(sizeof(*search));
+	struct class_member *tail = NULL;
+	int err = -ENOMEM;
+
+	if (search == NULL)
+		return -ENOMEM;
+
+	if (class->is_packed) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	search->units = calloc(class->type.nr_members ?: 1, sizeof(search->units[0]));
+	if (search->units == NULL)
+		goto out;
+
+	err = class__reorg_units(class, cu, profile, search->units, &tail, &search->tail_alignment);
+	if (err < 0)
+		goto out;
+
+	search->nr_units = err;
+	if (search->nr_units < 2) {
+		err = 0;
+		goto out;
+	}
+
+	err = -ENOMEM;
+	if (reorg_search__init_classes(search))
+		goto out;
+
+	search->used	   = calloc(search->nr_classes, sizeof(search->used[0]));
+	search->path	   = calloc(search->nr_units, sizeof(search->path[0]));
+	search->best_path  = calloc(search->nr_units, sizeof(search->best_path[0]));
+	search->candidates = calloc((size_t)search->nr_units * search->nr_classes, sizeof(search->candidates[0]));
+	if (!search->used || !search->path || !search->best_path || !search->candidates)
+		goto out;
+
+	struct reorg_cost original_cost = { .hot = 0, }, cost = { .hot = 0, };
+	uint32_t remaining_size = 0;
+
+	search->alignment = class->type.alignment ?: 1;
+	if (search->tail_alignment > search->alignment)
+		search->alignment = search->tail_alignment;
+
+	for (uint16_t i = 0; i < search->nr_units; ++i) {
+		const struct reorg_unit *unit = &search->units[i];
+
+		if (unit->alignment > search->alignment)
+			search->alignment = unit->alignment;
+		remaining_size += unit->size;
+	}
+
+	search->cacheline_size = cacheline_size ?: 64;
+	for (uint16_t i = 0; i < search->nr_units; ++i) {
+		const struct reorg_unit *unit = &search->units[i];
+
+		original_cost.hot	+= unit->weight * (unit->offset / search->cacheline_size);
+		original_cost.straddles += reorg_search__straddles(search, unit->offset, unit->size);
+	}
+
+	search->best_size = UINT32_MAX;
+	search->best_cost.hot = UINT64_MAX;
+	search->best_cost.straddles = UINT32_MAX;
+
+	clock_gettime(CLOCK_MONOTONIC, &search->deadline);
+	search->deadline.tv_sec  += time_budget_ms / 1000;
+	search->deadline.tv_nsec += (time_budget_ms % 1000) * 1000000L;
+	if (search->deadline.tv_nsec >= 1000000000L) {
+		++search->deadline.tv_sec;
+		search->deadline.tv_nsec -= 1000000000L;
+	}
+
+	reorg_search__dfs(search, 0, 0, &cost, remaining_size);
+
+	if (verbose)
+		fprintf(fp, "/* Searched %" PRIu64 " states for %u units in %u size/alignment classes%s */\n",
+			search->nr_states, search->nr_units, search->nr_classes,
+			search->out_of_time ? ", ran out of time, may not be optimal" : "");
+
+	err = search->out_of_time ? 1 : 0;
+
+	// Only touch it if it gets better, the search may not have been able to finish
+	if (search->best_size == UINT32_MAX ||
+	    search->best_size > class__size(class) ||
+	    (search->best_size == class__size(class) && !reorg_cost__less(&search->best_cost, &original_cost)))
+		goto out;
+
+	class__apply_reorg(class, search, tail);
+out:
+	reorg_search__delete(search);
+	return err;
+}
+
+uint32_t class__hot_cachelines(struct class *class, uint16_t cacheline_size,
+			       const struct reorganize_profile *profile)
+{
+	uint32_t nr_cachelines = 0, last_cacheline = UINT32_MAX;
+	struct class_member *pos;
+
+	cacheline_size = cacheline_size ?: 64;
+
+	type__for_each_data_member(&class->type, pos) {
+		if (pos->is_static || profile->member_weight(profile, class, pos) == 0)
+			continue;
+
+		uint32_t first = pos->byte_offset / cacheline_size,
+			 last = (pos->byte_offset + (pos->byte_size ?: 1) - 1) / cacheline_size;
+
+		// Members are in offset order, so just don't count again the last one counted
+		if (last_cacheline != UINT32_MAX && first <= last_cacheline)
+			first = last_cacheline + 1;
+
+		if (first <= last) {
+			nr_cachelines += last - first + 1;
+			last_cacheline = last;
+		}
+	}
+
+	return nr_cachelines;
+}
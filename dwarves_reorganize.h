@@ -27,4 +27,34 @@ void class__fixup_alignment(struct class *cls, const struct cu *cu);
 void class__reorganize(struct class *cls, const struct cu *cu,
 		       const int verbose, FILE *fp);
 
+/*
+ * struct reorganize_profile - how often members are accessed
+ *
+ * @member_weight - access count for @member, from a profile, zero for cold members
+ * @priv - for @member_weight
+ */
+struct reorganize_profile {
+	uint64_t (*member_weight)(const struct reorganize_profile *profile,
+				  const struct class *cls, const struct class_member *member);
+	void	 *priv;
+};
+
+/*
+ * Returns 0 if the best layout was found, 1 if @time_budget_ms ran out, using
+ * the best found so far, or a negative errno, -EINVAL for classes it can't
+ * handle, such as ones with inheritance, packed or with members inside the
+ * storage unit of a bitfield run, as in 'int a:1; char c;'. The class is only
+ * changed if a smaller layout, or one as big but with the @profile hot members
+ * in earlier cachelines or with fewer members straddling @cacheline_size
+ * boundaries, was found. @profile can be NULL.
+ */
+int class__reorganize_optimal(struct class *cls, const struct cu *cu,
+			      uint16_t cacheline_size, unsigned int time_budget_ms,
+			      const struct reorganize_profile *profile,
+			      const int verbose, FILE *fp);
+
+// Number of cachelines with members that are hot in @profile
+uint32_t class__hot_cachelines(struct class *cls, uint16_t cacheline_size,
+			       const struct reorganize_profile *profile);
+
 #endif /* _DWARVES_REORGANIZE_H_ */
@@ -8,7 +8,9 @@
 
 #include "gobuffer.h"
 
+#include <pthread.h>
 #include <search.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -19,7 +21,6 @@
 #include "dutil.h"
 
 #define GOBUFFER__BCHUNK (8 * 1024)
-#define GOBUFFER__ZCHUNK (8 * 1024)
 
 void gobuffer__init(struct gobuffer *gb)
 {
@@ -102,45 +103,185 @@ void gobuffer__copy(const struct gobuffer *gb, void *dest)
 	}
 }
 
-const void *gobuffer__compress(struct gobuffer *gb, unsigned int *size)
+/*
+ * The buffer is split in chunks that are deflated in parallel, each one
+ * primed with the last 32KiB of the previous one as its dictionary, and
+ * then glued together into a single zlib stream, like pigz does, so that
+ * any inflater, not just ours, can read the result.
+ */
+#define GOBUFFER__ZCHUNK_SIZE (1024 * 1024)
+#define GOBUFFER__ZDICT_SIZE  (32 * 1024)
+
+struct gobuffer_zchunk {
+	void	     *bf;
+	unsigned int size;
+	uLong	     adler;
+	int	     err;
+};
+
+struct gobuffer_zcompressor {
+	const Bytef	       *in;
+	unsigned int	       in_size;
+	unsigned int	       nr_chunks;
+	unsigned int	       next_chunk;
+	pthread_mutex_t	       lock;
+	struct gobuffer_zchunk *chunks;
+};
+
+static int gobuffer_zcompressor__deflate_chunk(struct gobuffer_zcompressor *zc, unsigned int idx)
 {
+	struct gobuffer_zchunk *chunk = &zc->chunks[idx];
+	const unsigned int start = idx * GOBUFFER__ZCHUNK_SIZE;
+	const unsigned int len = (zc->in_size - start < GOBUFFER__ZCHUNK_SIZE ?
+				  zc->in_size - start : GOBUFFER__ZCHUNK_SIZE);
+	const bool last = idx == zc->nr_chunks - 1;
 	z_stream z = {
 		.zalloc	  = Z_NULL,
 		.zfree	  = Z_NULL,
 		.opaque	  = Z_NULL,
-		.avail_in = gobuffer__size(gb),
-		.next_in  = (Bytef *)(gobuffer__entries(gb) ? : ""),
+		.avail_in = len,
+		.next_in  = (Bytef *)zc->in + start,
 	};
-	void *bf = NULL;
-	unsigned int bf_size = 0;
+	unsigned int bf_size;
+	int err = -EINVAL;
 
-	if (deflateInit(&z, Z_BEST_COMPRESSION) != Z_OK)
-		goto out_free;
+	chunk->adler = adler32(adler32(0L, Z_NULL, 0), zc->in + start, len);
 
-	do {
-		const unsigned int new_bf_size = bf_size + GOBUFFER__ZCHUNK;
-		void *nbf = realloc(bf, new_bf_size);
+	/* Raw deflate, the zlib header and trailer are added when gluing the chunks */
+	if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return -ENOMEM;
 
-		if (nbf == NULL)
-			goto out_close_and_free;
+	if (start != 0) {
+		const unsigned int dict_len = start < GOBUFFER__ZDICT_SIZE ? start : GOBUFFER__ZDICT_SIZE;
 
-		bf = nbf;
-		z.avail_out = GOBUFFER__ZCHUNK;
-		z.next_out  = (Bytef *)bf + bf_size;
-		bf_size	    = new_bf_size;
-		if (deflate(&z, Z_FINISH) == Z_STREAM_ERROR)
-			goto out_close_and_free;
-	} while (z.avail_out == 0);
+		if (deflateSetDictionary(&z, zc->in + start - dict_len, dict_len) != Z_OK)
+			goto out_end;
+	}
 
-	deflateEnd(&z);
-	*size = bf_size - z.avail_out;
-out:
-	return bf;
+	/* Leave room for the empty stored block Z_SYNC_FLUSH appends */
+	bf_size = deflateBound(&z, len) + 16;
+	chunk->bf = malloc(bf_size);
+	if (chunk->bf == NULL) {
+		err = -ENOMEM;
+		goto out_end;
+	}
+
+	z.next_out  = chunk->bf;
+	z.avail_out = bf_size;
 
-out_close_and_free:
+	/*
+	 * Only the last chunk gets the final block bit set, the others end on a
+	 * byte boundary so that they can be concatenated.
+	 */
+	if (deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH) != (last ? Z_STREAM_END : Z_OK) ||
+	    z.avail_in != 0 || z.avail_out == 0)
+		goto out_end;
+
+	chunk->size = bf_size - z.avail_out;
+	err = 0;
+out_end:
 	deflateEnd(&z);
-out_free:
-	free(bf);
-	bf = NULL;
-	goto out;
+	return err;
+}
+
+static void *gobuffer_zcompressor__thread(void *arg)
+{
+	struct gobuffer_zcompressor *zc = arg;
+
+	while (1) {
+		unsigned int idx;
+
+		pthread_mutex_lock(&zc->lock);
+		idx = zc->next_chunk++;
+		pthread_mutex_unlock(&zc->lock);
+
+		if (idx >= zc->nr_chunks)
+			break;
+
+		zc->chunks[idx].err = gobuffer_zcompressor__deflate_chunk(zc, idx);
+	}
+
+	return NULL;
+}
+
+void *__gobuffer__compress(const void *buf, unsigned int *size, int nr_jobs)
+{
+	struct gobuffer_zcompressor zc = {
+		.in	   = buf,
+		.in_size   = *size,
+		.nr_chunks = (*size + GOBUFFER__ZCHUNK_SIZE - 1) / GOBUFFER__ZCHUNK_SIZE ?: 1,
+	};
+	uLong adler = adler32(0L, Z_NULL, 0);
+	unsigned int i, bf_size = 2 + 4;
+	pthread_t *threads = NULL;
+	uint8_t *bf = NULL, *p;
+	int nr_threads = 1;
+
+	zc.chunks = calloc(zc.nr_chunks, sizeof(*zc.chunks));
+	if (zc.chunks == NULL)
+		return NULL;
+
+	if (nr_jobs > (int)zc.nr_chunks)
+		nr_jobs = zc.nr_chunks;
+
+	if (nr_jobs > 1) {
+		threads = calloc(nr_jobs, sizeof(*threads));
+		if (threads == NULL)
+			goto out_free_chunks;
+	}
+
+	pthread_mutex_init(&zc.lock, NULL);
+
+	/* The calling thread deflates chunks too, so start one less */
+	for (; nr_threads < nr_jobs; ++nr_threads) {
+		if (pthread_create(&threads[nr_threads], NULL, gobuffer_zcompressor__thread, &zc) != 0)
+			break;
+	}
+
+	gobuffer_zcompressor__thread(&zc);
+
+	for (i = 1; i < (unsigned int)nr_threads; ++i)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&zc.lock);
+
+	for (i = 0; i < zc.nr_chunks; ++i) {
+		const unsigned int start = i * GOBUFFER__ZCHUNK_SIZE;
+		const unsigned int len = (zc.in_size - start < GOBUFFER__ZCHUNK_SIZE ?
+					  zc.in_size - start : GOBUFFER__ZCHUNK_SIZE);
+
+		if (zc.chunks[i].err != 0)
+			goto out_free_chunks;
+
+		adler = adler32_combine(adler, zc.chunks[i].adler, len);
+		bf_size += zc.chunks[i].size;
+	}
+
+	bf = malloc(bf_size);
+	if (bf == NULL)
+		goto out_free_chunks;
+
+	/* zlib header: deflate with a 32KiB window, maximum compression */
+	bf[0] = 0x78;
+	bf[1] = 0xda;
+	p = bf + 2;
+
+	for (i = 0; i < zc.nr_chunks; ++i) {
+		memcpy(p, zc.chunks[i].bf, zc.chunks[i].size);
+		p += zc.chunks[i].size;
+	}
+
+	/* zlib trailer: big endian adler32 of the uncompressed data */
+	p[0] = adler >> 24;
+	p[1] = adler >> 16;
+	p[2] = adler >> 8;
+	p[3] = adler;
+
+	*size = bf_size;
+out_free_chunks:
+	for (i = 0; i < zc.nr_chunks; ++i)
+		free(zc.chunks[i].bf);
+	free(zc.chunks);
+	free(threads);
+	return bf;
 }
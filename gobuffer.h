@@ -41,6 +41,6 @@ static inline unsigned int gobuffer__size(const struct gobuffer *gb)
 
 void *gobuffer__ptr(const struct gobuffer *gb, unsigned int s);
 
-const void *gobuffer__compress(struct gobuffer *gb, unsigned int *size);
+void *__gobuffer__compress(const void *buf, unsigned int *size, int nr_jobs);
 
 #endif /* _GOBUFFER_H_ */
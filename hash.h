@@ -14,6 +14,7 @@
  * machines where multiplications are slow.
  */
 
+#include <stddef.h>
 #include <stdint.h>
 
 static inline uint64_t hash_64(const uint64_t val, const unsigned int bits)
@@ -21,4 +22,32 @@ static inline uint64_t hash_64(const uint64_t val, const unsigned int bits)
 	return (val * 11400714819323198485LLU) >> (64 - bits);
 }
 
+/*
+ * FNV-1a, for hashing names and other byte sequences, chain calls passing the
+ * previous result as @hash, starting with HASH_BYTES__INIT.
+ */
+#define HASH_BYTES__INIT 14695981039346656037LLU
+
+static inline uint64_t hash_bytes(uint64_t hash, const void *bytes, size_t len)
+{
+	const unsigned char *s = bytes;
+
+	while (len--) {
+		hash ^= *s++;
+		hash *= 1099511628211LLU;
+	}
+
+	return hash;
+}
+
+static inline uint64_t hash_str(uint64_t hash, const char *s)
+{
+	while (*s) {
+		hash ^= (unsigned char)*s++;
+		hash *= 1099511628211LLU;
+	}
+
+	return hash;
+}
+
 #endif /* _LINUX_HASH_H */
@@ -81,6 +81,7 @@ static int ctf__decompress(struct ctf *ctf, void *orig_buf, size_t orig_size)
 	z_stream state;
 	size_t len;
 	void *new;
+	int ret;
 
 	len = (ctf__get32(ctf, &hp->ctf_str_off) +
 	       ctf__get32(ctf, &hp->ctf_str_len));
@@ -102,7 +103,18 @@ static int ctf__decompress(struct ctf *ctf, void *orig_buf, size_t orig_size)
 		goto err;
 	}
 
-	if (inflate(&state, Z_FINISH) != Z_STREAM_END) {
+	/*
+	 * Inflate straight into the final buffer, accepting payloads made of
+	 * several concatenated zlib streams, as produced by chunked encoders.
+	 */
+	while ((ret = inflate(&state, Z_FINISH)) == Z_STREAM_END &&
+	       state.avail_in != 0 && state.avail_out != 0) {
+		if (inflateReset(&state) != Z_OK)
+			break;
+	}
+
+	if (ret != Z_STREAM_END) {
+		inflateEnd(&state);
 		err_str = "struct ctf decompression inflate failure.";
 		goto err;
 	}
@@ -112,7 +124,7 @@ static int ctf__decompress(struct ctf *ctf, void *orig_buf, size_t orig_size)
 		goto err;
 	}
 
-	if (state.total_out != len) {
+	if ((size_t)(state.next_out - (Bytef *)new) != len + sizeof(*hp)) {
 		err_str = "struct ctf decompression truncation error.";
 		goto err;
 	}
@@ -159,13 +171,15 @@ int ctf__load(struct ctf *ctf)
 		goto out;
 
 	if (!(hp->ctf_flags & CTF_FLAGS_COMPR)) {
-		err = -ENOMEM;
-		ctf->buf = malloc(orig_size);
-		if (ctf->buf != NULL) {
-			memcpy(ctf->buf, hp, orig_size);
-			ctf->size = orig_size;
-			err = 0;
-		}
+		/*
+		 * Nothing writes to the CTF buffer when loading, so use the
+		 * section contents, mmapped by libelf, that stay around till
+		 * ctf__delete() calls elf_end().
+		 */
+		ctf->buf = hp;
+		ctf->size = orig_size;
+		ctf->buf_in_elf = true;
+		err = 0;
 	} else
 		err = ctf__decompress(ctf, hp, orig_size);
 out:
@@ -245,7 +259,8 @@ void ctf__delete(struct ctf *ctf)
 		__gobuffer__delete(&ctf->funcs);
 		elf_symtab__delete(ctf->symtab);
 		zfree(&ctf->filename);
-		zfree(&ctf->buf);
+		if (!ctf->buf_in_elf)
+			zfree(&ctf->buf);
 		free(ctf);
 	}
 }
@@ -286,7 +301,7 @@ int ctf__load_symtab(struct ctf *ctf)
 	return ctf->symtab == NULL ? -1 : 0;
 }
 
-void ctf__set_strings(struct ctf *ctf, struct strings *strings)
+void ctf__set_strings(struct ctf *ctf, struct gobuffer *strings)
 {
 	ctf->strings = strings;
 }
@@ -503,60 +518,7 @@ int ctf__add_object(struct ctf *ctf, uint16_t type)
 			     sizeof(type)) >= 0 ? 0 : -ENOMEM;
 }
 
-#if 0
-static const void *ctf__compress(void *orig_buf, unsigned int *size)
-{
-	z_stream z = {
-		.zalloc	  = Z_NULL,
-		.zfree	  = Z_NULL,
-		.opaque	  = Z_NULL,
-		.avail_in = *size,
-		.next_in  = (Bytef *)orig_buf,
-	};
-	void *bf = NULL;
-	unsigned int bf_size = 0;
-
-	if (deflateInit(&z, Z_BEST_COMPRESSION) != Z_OK)
-		goto out;
-
-#define _GOBUFFER__ZCHUNK 16384 * 1024
-
-	do {
-		const unsigned int new_bf_size = bf_size + _GOBUFFER__ZCHUNK;
-		void *nbf = realloc(bf, new_bf_size);
-
-		if (nbf == NULL)
-			goto out_close_and_free;
-
-		bf = nbf;
-		z.avail_out = _GOBUFFER__ZCHUNK;
-		z.next_out  = (Bytef *)bf + bf_size;
-		bf_size	    = new_bf_size;
-		if (deflate(&z, Z_FULL_FLUSH) == Z_STREAM_ERROR)
-			goto out_close_and_free;
-#if 0
-		fprintf(stderr,
-			"%s: size=%d, bf_size=%d, total_out=%ld, total_in=%ld\n",
-			__func__, *size, bf_size, z.total_out, z.total_in);
-#endif
-	} while (z.total_in != *size);
-
-	if (deflate(&z, Z_FINISH) == Z_STREAM_ERROR)
-		goto out_close_and_free;
-
-	deflateEnd(&z);
-	*size = z.total_out;
-out:
-	return bf;
-
-out_close_and_free:
-	deflateEnd(&z);
-	free(bf);
-	bf = NULL;
-	goto out;
-}
-
-int ctf__encode(struct ctf *ctf, uint8_t flags)
+int ctf__encode(struct ctf *ctf, uint8_t flags, int nr_jobs)
 {
 	struct ctf_header *hdr;
 	unsigned int size;
@@ -570,7 +532,7 @@ int ctf__encode(struct ctf *ctf, uint8_t flags)
 	size = (gobuffer__size(&ctf->types) +
 		gobuffer__size(&ctf->objects) +
 		gobuffer__size(&ctf->funcs) +
-		strings__size(ctf->strings));
+		gobuffer__size(ctf->strings));
 
 	ctf->size = sizeof(*hdr) + size;
 	ctf->buf = malloc(ctf->size);
@@ -594,19 +556,19 @@ int ctf__encode(struct ctf *ctf, uint8_t flags)
 	hdr->ctf_type_off = offset;
 	offset += gobuffer__size(&ctf->types);
 	hdr->ctf_str_off  = offset;
-	hdr->ctf_str_len  = strings__size(ctf->strings);
+	hdr->ctf_str_len  = gobuffer__size(ctf->strings);
 
 	void *payload = ctf->buf + sizeof(*hdr);
 	gobuffer__copy(&ctf->objects, payload + hdr->ctf_object_off);
 	gobuffer__copy(&ctf->funcs, payload + hdr->ctf_func_off);
 	gobuffer__copy(&ctf->types, payload + hdr->ctf_type_off);
-	strings__copy(ctf->strings, payload + hdr->ctf_str_off);
+	gobuffer__copy(ctf->strings, payload + hdr->ctf_str_off);
 
 	*(char *)(ctf->buf + sizeof(*hdr) + hdr->ctf_str_off) = '\0';
 	if (flags & CTF_FLAGS_COMPR) {
-		bf = (void *)ctf__compress(ctf->buf + sizeof(*hdr), &size);
+		bf = __gobuffer__compress(ctf->buf + sizeof(*hdr), &size, nr_jobs);
 		if (bf == NULL) {
-			printf("%s: ctf__compress failed!\n", __func__);
+			printf("%s: __gobuffer__compress failed!\n", __func__);
 			return -ENOMEM;
 		}
 		void *new_bf = malloc(sizeof(*hdr) + size);
@@ -626,7 +588,7 @@ int ctf__encode(struct ctf *ctf, uint8_t flags)
 		 "\nstrings:\n size: %u\ncompressed size: %d\n",
 	       ctf->type_index,
 	       gobuffer__size(&ctf->types),
-	       strings__size(ctf->strings), size);
+	       gobuffer__size(ctf->strings), size);
 #endif
 	int fd = open(ctf->filename, O_RDWR);
 	if (fd < 0) {
@@ -730,16 +692,23 @@ found_SUNW_ctf_str:
 	elf_flagshdr(newscn, ELF_C_SET, ELF_F_DIRTY);
 #else
 	char pathname[PATH_MAX];
+	int ctf_fd;
+
+	/* objcopy will rewrite the file, let go of it */
+	elf_end(elf);
+
 	snprintf(pathname, sizeof(pathname), "%s.SUNW_ctf", ctf->filename);
-	fd = creat(pathname, S_IRUSR | S_IWUSR);
-	if (fd == -1) {
+	ctf_fd = creat(pathname, S_IRUSR | S_IWUSR);
+	if (ctf_fd == -1) {
 		fprintf(stderr, "%s: open(%s) failed!\n", __func__, pathname);
 		goto out_close;
 	}
-	if (write(fd, bf, size) != size)
-		goto out_close;
+	if (write(ctf_fd, bf, size) != size) {
+		close(ctf_fd);
+		goto out_unlink;
+	}
 
-	if (close(fd) < 0)
+	if (close(ctf_fd) < 0)
 		goto out_unlink;
 
 	char cmd[PATH_MAX * 2];
@@ -749,7 +718,7 @@ found_SUNW_ctf_str:
 		err = 0;
 out_unlink:
 	unlink(pathname);
-	return err;
+	goto out_close;
 #endif
 out_update:
 	data->d_buf = bf;
@@ -769,4 +738,3 @@ out_close:
 	close(fd);
 	return err;
 }
-#endif
@@ -24,10 +24,11 @@ struct ctf {
 	struct gobuffer	  objects; /* data/variables */
 	struct gobuffer	  types;
 	struct gobuffer	  funcs;
-	struct strings   *strings;
+	struct gobuffer  *strings;
 	char		  *filename;
 	size_t		  size;
 	int		  swapped;
+	bool		  buf_in_elf; /* buf points to the ELF section data */
 	int		  in_fd;
 	uint8_t		  wordsize;
 	uint32_t	  type_index;
@@ -76,8 +77,8 @@ int ctf__add_function(struct ctf *ctf, uint16_t type, uint16_t nr_parms,
 
 int ctf__add_object(struct ctf *ctf, uint16_t type);
 
-void ctf__set_strings(struct ctf *ctf, struct strings *strings);
-int  ctf__encode(struct ctf *ctf, uint8_t flags);
+void ctf__set_strings(struct ctf *ctf, struct gobuffer *strings);
+int  ctf__encode(struct ctf *ctf, uint8_t flags, int nr_jobs);
 
 char *ctf__string(struct ctf *ctf, uint32_t ref);
 
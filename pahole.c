@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <dwarf.h>
 #include <elfutils/version.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <pthread.h>
@@ -19,6 +20,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <bpf/btf.h>
 #include "bpf/libbpf.h"
 
@@ -26,10 +29,13 @@
 #include "dwarves.h"
 #include "dwarves_emit.h"
 #include "dutil.h"
-//#include "ctf_encoder.h" FIXME: disabled, probably its better to move to Oracle's libctf
+#include "gobuffer.h"
+#include "hash.h"
+#include "ctf_encoder.h"
 #include "btf_encoder.h"
 
 static struct btf_encoder *btf_encoder;
+static struct ctf_encoder *ctf_encoder;
 static char *detached_btf_filename;
 static bool btf_encode;
 static bool btf_gen_floats;
@@ -42,7 +48,8 @@ static bool btf_encode_force;
 static const char *base_btf_file;
 
 static const char *prettify_input_filename;
-static FILE *prettify_input;
+static const char *prettify_columns_dir;
+static struct prettify_input *prettify_input;
 
 static uint8_t class__include_anonymous;
 static uint8_t class__include_nested_anonymous;
@@ -65,12 +72,17 @@ static uint16_t nr_bit_holes;
 static uint16_t hole_size_ge;
 static uint8_t show_packable;
 static bool show_with_flexible_array;
+static bool packable_report;
 static uint8_t global_verbose;
 static uint8_t recursive;
 static size_t cacheline_size;
 static uint8_t find_containers;
 static uint8_t find_pointers_in_structs;
 static int reorganize;
+static bool reorganize_optimal;
+static bool reorganize_greedy; // asked explicitly with --reorganize=greedy
+static unsigned int reorganize_time_budget = 1000;
+static const char *access_profile_filename;
 static bool show_private_classes;
 static bool defined_in;
 static bool just_unions;
@@ -92,6 +104,11 @@ static struct conf_load conf_load = {
 	.conf_fprintf = &conf,
 };
 
+/*
+ * @seq: the lowest cu->seq where this struct was found, i.e. the definition
+ *	 that gets printed when rendering CUs in parallel.
+ * @printed: set by the ordered writer, see cu_outputs__write()
+ */
 struct structure {
 	struct list_head  node;
 	struct rb_node	  rb_node;
@@ -100,6 +117,8 @@ struct structure {
 	uint32_t	  id;
 	uint32_t	  nr_files;
 	uint32_t	  nr_methods;
+	uint32_t	  seq;
+	bool		  printed;
 };
 
 static struct structure *structure__new(struct class *class, struct cu *cu, uint32_t id)
@@ -112,6 +131,8 @@ static struct structure *structure__new(struct class *class, struct cu *cu, uint
 		st->class      = class;
 		st->cu	       = cu;
 		st->id	       = id;
+		st->seq	       = cu->seq;
+		st->printed    = false;
 	}
 
 	return st;
@@ -214,13 +235,17 @@ static int type__compare_members_types(struct type *a, struct cu *cu_a, struct t
 	if (a->nr_members == 0)
 		return 0;
 
-	struct class_member *ma, *mb = type__first_member(b);
+	// The members were laid out by __structures__add()
+	if (a->nr_members_layout != b->nr_members_layout)
+		return a->nr_members_layout < b->nr_members_layout ? -1 : 1;
 
-	type__for_each_member(a, ma) {
-		struct tag *type_ma = cu__type(cu_a, ma->tag.type),
-			   *type_mb = cu__type(cu_b, mb->tag.type);
+	const struct class_member_layout *ma, *mb = b->members_layout;
 
-		if (type_ma && !type_mb && class_member__name(mb) == NULL) {
+	type__for_each_member_layout(a, ma) {
+		struct tag *type_ma = cu__type(cu_a, ma->type),
+			   *type_mb = cu__type(cu_b, mb->type);
+
+		if (type_ma && !type_mb && mb->name == NULL) {
 			/*
 			 * FIXME This is happening with a vmlinux built with
 			 * clang and thin-LTO, and since this is not
@@ -237,11 +262,8 @@ static int type__compare_members_types(struct type *a, struct cu *cu_a, struct t
 		if (!type_ma || !type_mb) // shuldn't happen
 			return type_ma ? 1 : -1; // best effort
 
-		const char *name_a = class_member__name(ma),
-			   *name_b = class_member__name(mb);
-
-		if (name_a && name_b) {
-			ret = strcmp(name_a, name_b);
+		if (ma->name && mb->name) {
+			ret = strcmp(ma->name, mb->name);
 			if (ret)
 				return ret;
 		}
@@ -261,7 +283,7 @@ static int type__compare_members_types(struct type *a, struct cu *cu_a, struct t
 		if (ret)
 			return ret;
 
-		mb = class_member__next(mb);
+		++mb;
 	}
 
 	return 0;
@@ -276,7 +298,11 @@ static int type__compare_members(struct type *a, struct type *b)
 	if (a->nr_members == 0)
 		return 0;
 
-	struct class_member *ma, *mb = type__first_member(b);
+	// The members were laid out by __structures__add()
+	if (a->nr_members_layout != b->nr_members_layout)
+		return a->nr_members_layout < b->nr_members_layout ? -1 : 1;
+
+	const struct class_member_layout *ma, *mb = b->members_layout;
 
 	// Don't look at the types, as we may be referring to a CU being loaded
 	// in another thread and since we're not locking the ptr_table's, we
@@ -284,12 +310,9 @@ static int type__compare_members(struct type *a, struct type *b)
 	// check that takes into account the types, since at that time all the
 	// ptr_tables/cus are quiescent.
 
-	type__for_each_member(a, ma) {
-		const char *name_a = class_member__name(ma),
-			   *name_b = class_member__name(mb);
-
-		if (name_a && name_b) {
-			ret = strcmp(name_a, name_b);
+	type__for_each_member_layout(a, ma) {
+		if (ma->name && mb->name) {
+			ret = strcmp(ma->name, mb->name);
 			if (ret)
 				return ret;
 		}
@@ -302,7 +325,7 @@ static int type__compare_members(struct type *a, struct type *b)
 		if (ret)
 			return ret;
 
-		mb = class_member__next(mb);
+		++mb;
 	}
 
 	/*
@@ -353,9 +376,11 @@ static int type__compare_members(struct type *a, struct type *b)
 	   happy and we can continue to depend on it for regression tests for
 	   the BTF and DWARF encoder and loader
 
+	   --packable_report only looks at the layout and doesn't resort, so
+	   there the layout is all that counts, even with --sort.
 	 */
 
-	if (sort_output) {
+	if (sort_output && !packable_report) {
 		need_resort = true;
 		return 1;
 	}
@@ -389,6 +414,13 @@ static struct structure *__structures__add(struct class *class, struct cu *cu, u
         struct rb_node *parent = NULL;
 	struct structure *str;
 
+	/*
+	 * Other threads will compare against it once it is in the tree, so
+	 * lay out its members now, while only this thread looks at it.
+	 */
+	if (type__layout_members(&class->type))
+		return NULL;
+
         while (*p != NULL) {
 		int rc;
 
@@ -443,6 +475,51 @@ static void __structures__delete(void)
 	}
 }
 
+/*
+ * Another definition of an already known struct was found, if it comes from a
+ * CU that appears earlier in the file than the one that first added it, then
+ * it is this one that should be printed, to get the same output as when
+ * processing the CUs sequentially.
+ */
+static bool structure__add_definition(struct structure *st, struct cu *cu)
+{
+	bool earlier;
+
+	pthread_mutex_lock(&structures_lock);
+	++st->nr_files;
+	earlier = cu->seq < st->seq;
+	if (earlier)
+		st->seq = cu->seq;
+	pthread_mutex_unlock(&structures_lock);
+
+	return earlier;
+}
+
+/*
+ * For --packable_report, that only needs one definition of each struct, the
+ * one in the first CU, as when loading the CUs sequentially.
+ */
+static int structures__add_packable(struct class *class, struct cu *cu, uint32_t id)
+{
+	struct structure *str;
+	bool existing_entry;
+
+	pthread_mutex_lock(&structures_lock);
+	str = __structures__add(class, cu, id, &existing_entry);
+	if (str && existing_entry) {
+		++str->nr_files;
+		if (cu->seq < str->seq) {
+			str->seq   = cu->seq;
+			str->class = class;
+			str->cu	   = cu;
+			str->id	   = id;
+		}
+	}
+	pthread_mutex_unlock(&structures_lock);
+
+	return str ? 0 : -ENOMEM;
+}
+
 void structures__delete(void)
 {
 	pthread_mutex_lock(&structures_lock);
@@ -455,9 +532,9 @@ static void nr_definitions_formatter(struct structure *st)
 	printf("%s%c%u\n", class__name(st->class), separator, st->nr_files);
 }
 
-static void nr_members_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused)
+static void nr_members_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused, FILE *fp)
 {
-	printf("%s%c%u\n", class__name(class), separator, class__nr_members(class));
+	fprintf(fp, "%s%c%u\n", class__name(class), separator, class__nr_members(class));
 }
 
 static void nr_methods_formatter(struct structure *st)
@@ -465,25 +542,27 @@ static void nr_methods_formatter(struct structure *st)
 	printf("%s%c%u\n", class__name(st->class), separator, st->nr_methods);
 }
 
-static void size_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused)
+static void size_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused, FILE *fp)
 {
-	printf("%s%c%d%c%u\n", class__name(class), separator,
+	fprintf(fp, "%s%c%d%c%u\n", class__name(class), separator,
 	       class__size(class), separator, tag__is_union(class__tag(class)) ? 0 : class->nr_holes);
 }
 
-static void class_name_len_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused)
+static void class_name_len_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused, FILE *fp)
 {
 	const char *name = class__name(class);
-	printf("%s%c%zd\n", name, separator, strlen(name));
+	fprintf(fp, "%s%c%zd\n", name, separator, strlen(name));
 }
 
-static void class_name_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused)
+static void class_name_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused, FILE *fp)
 {
-	puts(class__name(class));
+	fprintf(fp, "%s\n", class__name(class));
 }
 
-static void class_formatter(struct class *class, struct cu *cu, uint32_t id)
+static void class_formatter(struct class *class, struct cu *cu, uint32_t id, FILE *fp)
 {
+	// Local copy, as we may be running in multiple threads
+	struct conf_fprintf cconf = conf;
 	struct tag *typedef_alias = NULL;
 	struct tag *tag = class__tag(class);
 	const char *name = class__name(class);
@@ -509,22 +588,22 @@ static void class_formatter(struct class *class, struct cu *cu, uint32_t id)
 	if (typedef_alias != NULL) {
 		struct type *tdef = tag__type(typedef_alias);
 
-		conf.prefix = "typedef";
-		conf.suffix = type__name(tdef);
+		cconf.prefix = "typedef";
+		cconf.suffix = type__name(tdef);
 	} else
-		conf.prefix = conf.suffix = NULL;
+		cconf.prefix = cconf.suffix = NULL;
 
 	if (compilable) {
-		if (type__emit_definitions(tag, cu, &emissions, stdout))
-			type__emit(tag, cu, NULL, NULL, stdout);
+		if (type__emit_definitions(tag, cu, &emissions, fp))
+			type__emit(tag, cu, NULL, NULL, fp);
 	} else {
-		tag__fprintf(tag, cu, &conf, stdout);
+		tag__fprintf(tag, cu, &cconf, fp);
 	}
 
-	putchar('\n');
+	fputc('\n', fp);
 }
 
-static void print_packable_info(struct class *c, struct cu *cu, uint32_t id)
+static void print_packable_info(struct class *c, struct cu *cu, uint32_t id, FILE *fp)
 {
 	const struct tag *t = class__tag(c);
 	const size_t orig_size = class__size(c);
@@ -541,19 +620,19 @@ static void print_packable_info(struct class *c, struct cu *cu, uint32_t id)
 			name = class__name(tag__class(tdef));
 	}
 	if (name != NULL)
-		printf("%s%c%zd%c%zd%c%zd\n",
-		       name, separator,
-		       orig_size, separator,
-		       new_size, separator,
-		       savings);
+		fprintf(fp, "%s%c%zd%c%zd%c%zd\n",
+			name, separator,
+			orig_size, separator,
+			new_size, separator,
+			savings);
 	else
-		printf("%s(%d)%c%zd%c%zd%c%zd\n",
-		       tag__decl_file(t, cu),
-		       tag__decl_line(t, cu),
-		       separator,
-		       orig_size, separator,
-		       new_size, separator,
-		       savings);
+		fprintf(fp, "%s(%d)%c%zd%c%zd%c%zd\n",
+			tag__decl_file(t, cu),
+			tag__decl_line(t, cu),
+			separator,
+			orig_size, separator,
+			new_size, separator,
+			savings);
 }
 
 static void (*stats_formatter)(struct structure *st);
@@ -570,16 +649,224 @@ static struct class *class__filter(struct class *class, struct cu *cu,
 				   uint32_t tag_id);
 
 static void (*formatter)(struct class *class,
-			 struct cu *cu, uint32_t id) = class_formatter;
+			 struct cu *cu, uint32_t id, FILE *fp) = class_formatter;
+
+/*
+ * When loading with multiple threads (-j) each CU is rendered into its own
+ * in-memory stream, split in chunks, one per struct, and then written to
+ * stdout in the order the CUs appear in the file, so that the output is the
+ * same as when processing the CUs sequentially.
+ *
+ * Since CUs can finish in any order, a struct may be rendered by more than one
+ * CU, the writer uses structure->printed to print just the first in CU order.
+ */
+struct cu_output_chunk {
+	struct structure *st;
+	size_t		 end;
+};
+
+struct cu_output {
+	struct list_head       node;
+	FILE		       *fp;
+	char		       *bf;
+	size_t		       size;
+	uint32_t	       seq;
+	uint32_t	       nr_chunks;
+	uint32_t	       allocated_chunks;
+	struct cu_output_chunk *chunks;
+};
+
+static struct cu_output *cu_output__new(uint32_t seq)
+{
+	struct cu_output *output = zalloc(sizeof(*output));
+
+	if (output != NULL) {
+		output->seq = seq;
+		output->fp  = open_memstream(&output->bf, &output->size);
+		if (output->fp == NULL) {
+			free(output);
+			output = NULL;
+		}
+	}
+
+	return output;
+}
+
+static void cu_output__delete(struct cu_output *output)
+{
+	if (output == NULL)
+		return;
+
+	if (output->fp)
+		fclose(output->fp);
+	free(output->bf);
+	free(output->chunks);
+	free(output);
+}
+
+static int cu_output__add_chunk(struct cu_output *output, struct structure *st)
+{
+	if (output->nr_chunks == output->allocated_chunks) {
+		uint32_t allocated_chunks = output->allocated_chunks ? output->allocated_chunks * 2 : 64;
+		struct cu_output_chunk *chunks = realloc(output->chunks, allocated_chunks * sizeof(*chunks));
+
+		if (chunks == NULL)
+			return -ENOMEM;
+
+		output->chunks		 = chunks;
+		output->allocated_chunks = allocated_chunks;
+	}
+
+	output->chunks[output->nr_chunks].st  = st;
+	output->chunks[output->nr_chunks].end = ftell(output->fp);
+	++output->nr_chunks;
+	return 0;
+}
+
+static void cu_output__write(struct cu_output *output, FILE *fp)
+{
+	size_t start = 0;
+	uint32_t i;
+
+	for (i = 0; i < output->nr_chunks; ++i) {
+		struct cu_output_chunk *chunk = &output->chunks[i];
+
+		if (chunk->st == NULL || !chunk->st->printed) {
+			fwrite(output->bf + start, chunk->end - start, 1, fp);
+			if (chunk->st)
+				chunk->st->printed = true;
+		}
 
-static void print_classes(struct cu *cu)
+		start = chunk->end;
+	}
+
+	if (output->size > start)
+		fwrite(output->bf + start, output->size - start, 1, fp);
+}
+
+static struct {
+	pthread_mutex_t	 lock;
+	struct list_head pending;
+	uint32_t	 next_seq;
+} cu_outputs = {
+	.lock	 = PTHREAD_MUTEX_INITIALIZER,
+	.pending = LIST_HEAD_INIT(cu_outputs.pending),
+};
+
+// Writes all the pending outputs that are next in CU order, must hold cu_outputs.lock
+static void __cu_outputs__write(FILE *fp)
+{
+	struct cu_output *output, *n;
+
+	list_for_each_entry_safe(output, n, &cu_outputs.pending, node) {
+		if (output->seq != cu_outputs.next_seq)
+			break;
+
+		list_del(&output->node);
+		cu_output__write(output, fp);
+		cu_output__delete(output);
+		++cu_outputs.next_seq;
+	}
+}
+
+static void cu_outputs__add(struct cu_output *output, FILE *fp)
+{
+	struct cu_output *pos;
+
+	if (output->fp)
+		fflush(output->fp);
+
+	pthread_mutex_lock(&cu_outputs.lock);
+
+	list_for_each_entry(pos, &cu_outputs.pending, node) {
+		if (pos->seq > output->seq)
+			break;
+	}
+	// Add it before 'pos', keeping the list sorted by seq
+	list_add_tail(&output->node, &pos->node);
+
+	__cu_outputs__write(fp);
+
+	pthread_mutex_unlock(&cu_outputs.lock);
+}
+
+/*
+ * CUs that don't render anything, say the ones dropped by cu__filter(), still
+ * have to take their turn, or all the ones after it would be held in memory
+ * till cu_outputs__flush(), so add an empty output for them.
+ */
+static void cu_outputs__skip(uint32_t seq, FILE *fp)
+{
+	struct cu_output *output = zalloc(sizeof(*output));
+
+	// No memory? Then the gap will only be closed by cu_outputs__flush()
+	if (output == NULL)
+		return;
+
+	output->seq = seq;
+	cu_outputs__add(output, fp);
+}
+
+/*
+ * Write whatever is left, in order, even with gaps in the sequence, i.e. CUs that
+ * didn't reach pahole_stealer(), and get ready for the next file.
+ */
+static void cu_outputs__flush(FILE *fp)
+{
+	struct cu_output *output, *n;
+
+	pthread_mutex_lock(&cu_outputs.lock);
+
+	list_for_each_entry_safe(output, n, &cu_outputs.pending, node) {
+		list_del(&output->node);
+		cu_output__write(output, fp);
+		cu_output__delete(output);
+	}
+
+	cu_outputs.next_seq = 0;
+	fflush(fp);
+
+	pthread_mutex_unlock(&cu_outputs.lock);
+}
+
+/*
+ * With --compile, when just printing the named structs and unions, emit all
+ * of them and what they need in one go, see cu__emit_definitions().
+ */
+static bool print_classes__can_emit_in_bulk(struct cu_output *output)
+{
+	return compilable && formatter == class_formatter && output == NULL &&
+	       !sort_output && !show_packable &&
+	       !class__include_anonymous && !class__include_nested_anonymous;
+}
+
+static int print_classes__add_bulk_id(uint32_t **ids, uint32_t *nr_ids, uint32_t *allocated_ids, uint32_t id)
+{
+	if (*nr_ids == *allocated_ids) {
+		uint32_t allocated = *allocated_ids ? *allocated_ids * 2 : 1024;
+		uint32_t *new_ids = realloc(*ids, allocated * sizeof(*new_ids));
+
+		if (new_ids == NULL)
+			return -ENOMEM;
+
+		*ids = new_ids;
+		*allocated_ids = allocated;
+	}
+
+	(*ids)[(*nr_ids)++] = id;
+	return 0;
+}
+
+static void print_classes(struct cu *cu, FILE *fp, struct cu_output *output)
 {
+	const bool bulk = print_classes__can_emit_in_bulk(output);
+	uint32_t *bulk_ids = NULL, nr_bulk_ids = 0, allocated_bulk_ids = 0;
 	uint32_t id;
 	struct class *pos;
 
 	cu__for_each_struct_or_union(cu, id, pos) {
 		bool existing_entry;
-		struct structure *str;
+		struct structure *str = NULL;
 
 		if (pos->type.namespace.name == 0 &&
 		    !(class__include_anonymous ||
@@ -588,6 +875,16 @@ static void print_classes(struct cu *cu)
 
 		if (!class__filter(pos, cu, id))
 			continue;
+
+		if (packable_report) {
+			if (tag__is_struct(class__tag(pos)) && pos->type.namespace.name != 0 &&
+			    structures__add_packable(pos, cu, id)) {
+				fprintf(stderr, "pahole: insufficient memory for "
+					"processing %s, skipping it...\n", cu->name);
+				goto out;
+			}
+			continue;
+		}
 		/*
 		 * FIXME: No sense in adding an anonymous struct to the list of
 		 * structs already printed, as we look for the name... The
@@ -601,23 +898,54 @@ static void print_classes(struct cu *cu)
 			if (str == NULL) {
 				fprintf(stderr, "pahole: insufficient memory for "
 					"processing %s, skipping it...\n", cu->name);
-				return;
+				goto out;
 			}
 
 			/* Already printed... */
-			if (existing_entry) {
-				str->nr_files++;
+			if (existing_entry && !structure__add_definition(str, cu))
 				continue;
-			}
 		}
 
 		if (show_packable && !global_verbose)
-			print_packable_info(pos, cu, id);
+			print_packable_info(pos, cu, id, fp);
 		else if (sort_output && formatter == class_formatter)
 			continue; // we'll print it at the end, in order, out of structures__tree
+		else if (bulk && print_classes__add_bulk_id(&bulk_ids, &nr_bulk_ids, &allocated_bulk_ids, id) == 0)
+			continue; // will be emitted after all the others were collected
 		else if (formatter != NULL)
-			formatter(pos, cu, id);
+			formatter(pos, cu, id, fp);
+		else
+			continue;
+
+		if (output && cu_output__add_chunk(output, str)) {
+			fprintf(stderr, "pahole: insufficient memory for "
+				"processing %s, skipping it...\n", cu->name);
+			goto out;
+		}
+	}
+
+	if (nr_bulk_ids != 0 && cu__emit_definitions(cu, bulk_ids, nr_bulk_ids, &emissions, fp)) {
+		// Not enough memory for the bulk emitter state, do it one by one
+		for (uint32_t i = 0; i < nr_bulk_ids; ++i)
+			class_formatter(tag__class(cu__type(cu, bulk_ids[i])), cu, bulk_ids[i], fp);
+	}
+out:
+	free(bulk_ids);
+}
+
+static void print_classes_ordered(struct cu *cu)
+{
+	struct cu_output *output = cu_output__new(cu->seq);
+
+	if (output == NULL) {
+		fprintf(stderr, "pahole: insufficient memory for "
+			"processing %s, skipping it...\n", cu->name);
+		cu_outputs__skip(cu->seq, stdout);
+		return;
 	}
+
+	print_classes(cu, output->fp, output);
+	cu_outputs__add(output, stdout);
 }
 
 static void __print_ordered_classes(struct rb_root *root)
@@ -627,55 +955,267 @@ static void __print_ordered_classes(struct rb_root *root)
 	while (next) {
 		struct structure *st = rb_entry(next, struct structure, rb_node);
 
-		class_formatter(st->class, st->cu, st->id);
+		class_formatter(st->class, st->cu, st->id, stdout);
 
 		next = rb_next(&st->rb_node);
 	}
 
 }
 
-static void resort_add(struct rb_root *resorted, struct structure *str)
+/*
+ * When resorting we need to take the member types into account, and rendering
+ * the type names for every comparison done while inserting in a rbtree is what
+ * dominates 'pahole --sort' (and thus btfdiff) runtime, so render them just
+ * once per struct, hash it all and sort by name + hash, only doing the full
+ * type__compare_members_types() when there is a tie.
+ *
+ * @idx: position in structures__list, so that the first one found is the one
+ *       kept when there are duplicates, as when inserting in a rbtree.
+ * @fuzzy: some member has no name or no type, i.e. the thin-LTO case described
+ *         in type__compare_members_types(), so it may be a duplicate of
+ *         something with a different hash.
+ */
+struct structure_sort_key {
+	struct structure *st;
+	const char	 *name;
+	uint64_t	 hash;
+	uint32_t	 idx;
+	bool		 fuzzy;
+};
+
+static void structure_sort_key__init(struct structure_sort_key *key)
 {
-	struct rb_node **p = &resorted->rb_node;
-	struct rb_node *parent = NULL;
-	struct structure *node;
+	struct structure *st = key->st;
+	struct type *type = &st->class->type;
+	struct class_member *member;
+	uint64_t hash = HASH_BYTES__INIT;
 
-	while (*p != NULL) {
-		int rc;
+	key->name  = type__name(type);
+	key->fuzzy = false;
+
+	type__for_each_member(type, member) {
+		struct tag *member_type = cu__type(st->cu, member->tag.type);
+		const char *name = class_member__name(member);
+		char bf[1024];
 
-		parent = *p;
-		node = rb_entry(parent, struct structure, rb_node);
-		rc = type__compare_members_types(&node->class->type, node->cu, &str->class->type, str->cu);
+		if (name)
+			hash = hash_str(hash, name);
+		else
+			key->fuzzy = true;
 
-		if (rc > 0)
-			p = &(*p)->rb_left;
-		else if (rc < 0)
-			p = &(*p)->rb_right;
+		hash = hash_bytes(hash, &member->bit_offset, sizeof(member->bit_offset));
+		hash = hash_bytes(hash, &member->bitfield_size, sizeof(member->bitfield_size));
+
+		if (member_type)
+			hash = hash_str(hash, tag__name(member_type, st->cu, bf, sizeof(bf), NULL));
+		else
+			key->fuzzy = true;
+	}
+
+	key->hash = hash;
+}
+
+static int structure_sort_key__cmp(const void *a, const void *b)
+{
+	const struct structure_sort_key *ka = a, *kb = b;
+	int ret = strcmp(ka->name, kb->name);
+
+	if (ret)
+		return ret;
+
+	if (ka->hash != kb->hash)
+		return ka->hash < kb->hash ? -1 : 1;
+
+	ret = type__compare_members_types(&ka->st->class->type, ka->st->cu, &kb->st->class->type, kb->st->cu);
+	if (ret)
+		return ret;
+
+	return ka->idx < kb->idx ? -1 : ka->idx > kb->idx;
+}
+
+static bool structure_sort_key__is_dup(const struct structure_sort_key *key, const struct structure_sort_key *prev)
+{
+	if (key->hash != prev->hash && !key->fuzzy && !prev->fuzzy)
+		return false;
+
+	return type__compare_members_types(&prev->st->class->type, prev->st->cu, &key->st->class->type, key->st->cu) == 0;
+}
+
+/*
+ * struct structure_sort_run - keys sorted by one of the resort_classes() threads
+ *
+ * The tag__name() cache is per CU and not locked, so all the structs from a CU
+ * go to the same run, the keys for each run are then built and sorted in
+ * parallel and finally merged by the main thread.
+ */
+struct structure_sort_run {
+	pthread_t		  thread;
+	bool			  threaded;
+	struct structure_sort_key *keys;
+	uint32_t		  nr_keys;
+};
+
+static void *structure_sort_run__sort(void *arg)
+{
+	struct structure_sort_run *run = arg;
+
+	for (uint32_t i = 0; i < run->nr_keys; ++i)
+		structure_sort_key__init(&run->keys[i]);
+
+	qsort(run->keys, run->nr_keys, sizeof(run->keys[0]), structure_sort_key__cmp);
+	return NULL;
+}
+
+static void structure_sort_keys__merge(const struct structure_sort_key *a, uint32_t nr_a,
+				       const struct structure_sort_key *b, uint32_t nr_b,
+				       struct structure_sort_key *merged)
+{
+	uint32_t i = 0, j = 0;
+
+	while (i < nr_a && j < nr_b) {
+		if (structure_sort_key__cmp(&a[i], &b[j]) <= 0)
+			*merged++ = a[i++];
 		else
-			return; // Duplicate, ignore it
+			*merged++ = b[j++];
+	}
+
+	memcpy(merged, a + i, (nr_a - i) * sizeof(*merged));
+	merged += nr_a - i;
+	memcpy(merged, b + j, (nr_b - j) * sizeof(*merged));
+}
+
+/*
+ * Merges the adjacent sorted @runs in pairs until just one is left, returns
+ * either @keys or @tmp, whichever has the result.
+ */
+static struct structure_sort_key *structure_sort_runs__merge(struct structure_sort_run *runs, int nr_runs,
+							     struct structure_sort_key *keys,
+							     struct structure_sort_key *tmp)
+{
+	while (nr_runs > 1) {
+		int i, nr_merged = 0;
+
+		for (i = 0; i < nr_runs; i += 2) {
+			struct structure_sort_run *run = &runs[i], *merged = &runs[nr_merged++];
+			struct structure_sort_key *dest = tmp + (run->keys - keys);
+			uint32_t nr_keys = run->nr_keys;
+
+			if (i + 1 < nr_runs) {
+				structure_sort_keys__merge(run->keys, run->nr_keys, runs[i + 1].keys, runs[i + 1].nr_keys, dest);
+				nr_keys += runs[i + 1].nr_keys;
+			} else {
+				memcpy(dest, run->keys, nr_keys * sizeof(*dest));
+			}
+
+			merged->keys	= dest;
+			merged->nr_keys = nr_keys;
+		}
+
+		struct structure_sort_key *swap = keys;
+
+		keys = tmp;
+		tmp  = swap;
+		nr_runs = nr_merged;
 	}
 
-	rb_link_node(&str->rb_node, parent, p);
-	rb_insert_color(&str->rb_node, resorted);
+	return keys;
 }
 
-static void resort_classes(struct rb_root *resorted, struct list_head *head)
+static int resort_classes(struct list_head *head, int nr_jobs)
 {
+	struct structure_sort_key *keys, *tmp = NULL, *sorted;
+	struct structure_sort_run *runs;
 	struct structure *str;
+	uint32_t nr_keys = 0, i, name_start = 0, *run_idx;
+	int j, err = -ENOMEM;
 
 	list_for_each_entry(str, head, node)
-		resort_add(resorted, str);
+		++nr_keys;
+
+	// Not worth the threads for just a few structs
+	if ((uint32_t)nr_jobs > nr_keys / 1024 + 1)
+		nr_jobs = nr_keys / 1024 + 1;
+	if (nr_jobs < 1)
+		nr_jobs = 1;
+
+	keys = malloc(nr_keys * sizeof(*keys));
+	runs = calloc(nr_jobs, sizeof(*runs));
+	run_idx = calloc(nr_jobs, sizeof(*run_idx));
+	if (nr_jobs > 1)
+		tmp = malloc(nr_keys * sizeof(*tmp));
+	if ((keys == NULL && nr_keys != 0) || runs == NULL || run_idx == NULL || (nr_jobs > 1 && tmp == NULL))
+		goto out_free;
+
+	// Partition the structs by CU, keeping the order in the list in each run
+	list_for_each_entry(str, head, node)
+		++runs[hash_64((uintptr_t)str->cu, 32) % nr_jobs].nr_keys;
+
+	for (j = 0, i = 0; j < nr_jobs; ++j) {
+		runs[j].keys = keys + i;
+		i += runs[j].nr_keys;
+	}
+
+	i = 0;
+	list_for_each_entry(str, head, node) {
+		int r = hash_64((uintptr_t)str->cu, 32) % nr_jobs;
+		struct structure_sort_key *key = &runs[r].keys[run_idx[r]++];
+
+		key->st	 = str;
+		key->idx = i++;
+	}
+
+	// The first run is done by this thread, after starting the others
+	for (j = 1; j < nr_jobs; ++j) {
+		runs[j].threaded = pthread_create(&runs[j].thread, NULL, structure_sort_run__sort, &runs[j]) == 0;
+		// Couldn't create a thread? Do it in this one then
+		if (!runs[j].threaded)
+			structure_sort_run__sort(&runs[j]);
+	}
+
+	structure_sort_run__sort(&runs[0]);
+
+	for (j = 1; j < nr_jobs; ++j) {
+		if (runs[j].threaded)
+			pthread_join(runs[j].thread, NULL);
+	}
+
+	sorted = structure_sort_runs__merge(runs, nr_jobs, keys, tmp);
+
+	for (i = 0; i < nr_keys; ++i) {
+		uint32_t k;
+
+		if (i == 0 || strcmp(sorted[i].name, sorted[name_start].name))
+			name_start = i;
+
+		// Ignore duplicates, the ones with the same name are adjacent
+		for (k = name_start; k < i; ++k) {
+			if (sorted[k].st && structure_sort_key__is_dup(&sorted[i], &sorted[k]))
+				break;
+		}
+
+		if (k < i) {
+			sorted[i].st = NULL;
+			continue;
+		}
+
+		class_formatter(sorted[i].st->class, sorted[i].st->cu, sorted[i].st->id, stdout);
+	}
+
+	err = 0;
+out_free:
+	free(run_idx);
+	free(runs);
+	free(tmp);
+	free(keys);
+	return err;
 }
 
-static void print_ordered_classes(void)
+static void print_ordered_classes(int nr_jobs)
 {
 	if (!need_resort) {
 		__print_ordered_classes(&structures__tree);
-	} else {
-		struct rb_root resorted = RB_ROOT;
-
-		resort_classes(&resorted, &structures__list);
-		__print_ordered_classes(&resorted);
+	} else if (resort_classes(&structures__list, nr_jobs)) {
+		fputs("pahole: insufficient memory for sorting classes\n", stderr);
 	}
 }
 
@@ -824,8 +1364,11 @@ static struct class *class__filter(struct class *class, struct cu *cu,
 	if (!tag__is_struct(tag))
 		return (just_structs || show_packable || nr_holes || nr_bit_holes || hole_size_ge) ? NULL : class;
 
-	if (tag->top_level)
-		class__find_holes(class);
+	if (tag->top_level && class__find_holes(class)) {
+		fprintf(stderr, "pahole: insufficient memory for finding the holes in %s, skipping it...\n",
+			class__name(class) ?: "<anonymous>");
+		return NULL;
+	}
 
 	if (class->nr_holes < nr_holes ||
 	    class->nr_bit_holes < nr_bit_holes ||
@@ -1069,63 +1612,625 @@ static void cu__account_nr_methods(struct cu *cu)
 	}
 }
 
-static char tab[128];
+/*
+ * struct structure_stats - what the stats formatters show about a struct
+ *
+ * With -j each thread accumulates these for the CUs it processes, without
+ * taking structures_lock, and pahole_threads_collect() merges them. They are
+ * keyed by name and a fingerprint of the layout, as type__compare() does,
+ * and don't point to the class, as the CUs are deleted after being processed.
+ *
+ * @node - in the structures_stats buckets
+ * @order_node - in structures_stats__list, once merged, in the order first seen
+ * @name - NULL for anonymous structs, that are never merged
+ * @hash - class__fingerprint()
+ * @seq - cu->seq for the first definition, then @id and @order, to sort as when processing the CUs sequentially
+ * @id - of the struct or, for nr_methods, of the function
+ * @order - in the thread, for the ones with the same @seq and @id
+ */
+struct structure_stats {
+	struct list_head node;
+	struct list_head order_node;
+	char		 *name;
+	uint64_t	 hash;
+	uint32_t	 size;
+	uint32_t	 nr_members;
+	uint32_t	 nr_files;
+	uint32_t	 nr_methods;
+	uint32_t	 seq;
+	uint32_t	 id;
+	uint32_t	 order;
+	uint16_t	 nr_holes;
+};
 
-static void print_structs_with_pointer_to(struct cu *cu, uint32_t type)
-{
-	struct class *pos;
-	struct class_member *pos_member;
-	uint32_t id;
+/*
+ * struct structures_stats - hash table of struct structure_stats
+ *
+ * @buckets - 1 << @bits lists, grown when @nr_entries gets to twice that
+ * @nr_accounted - for structure_stats->order
+ */
+struct structures_stats {
+	struct list_head *buckets;
+	uint32_t	 nr_entries;
+	uint32_t	 nr_accounted;
+	uint8_t		 bits;
+};
 
-	cu__for_each_struct_or_union(cu, id, pos) {
-		bool looked = false;
-		/*
-		 * Set it to NULL just to silence the compiler, as the printf
-		 * at the end of the type__for_each_member() loop is only reached
-		 * after str _is_ set, as looked starts as false, str is used with
-		 * structures_add and if it is NULL, we return.
-		 */
-		struct structure *str = NULL;
+static struct structures_stats structures_stats;
+static LIST_HEAD(structures_stats__list);
+
+// The stats formatters that can be accumulated per thread
+static bool structures_stats__per_thread(void)
+{
+	if (stats_formatter == nr_definitions_formatter || stats_formatter == nr_methods_formatter)
+		return true;
+
+	return (formatter == size_formatter || formatter == nr_members_formatter) && !show_packable;
+}
+
+static uint64_t class__fingerprint(struct class *class)
+{
+	struct type *type = &class->type;
+	struct class_member *member;
+	uint64_t hash = HASH_BYTES__INIT;
+
+	hash = hash_str(hash, type__name(type) ?: "");
+	hash = hash_bytes(hash, &type->size, sizeof(type->size));
+	hash = hash_bytes(hash, &type->nr_members, sizeof(type->nr_members));
+
+	type__for_each_member(type, member) {
+		const char *name = class_member__name(member);
+
+		if (name)
+			hash = hash_str(hash, name);
+		hash = hash_bytes(hash, &member->bit_offset, sizeof(member->bit_offset));
+		hash = hash_bytes(hash, &member->bitfield_size, sizeof(member->bitfield_size));
+	}
+
+	return hash;
+}
+
+static void structure_stats__delete(struct structure_stats *entry)
+{
+	free(entry->name);
+	free(entry);
+}
+
+static int structures_stats__resize(struct structures_stats *stats, uint8_t bits)
+{
+	struct list_head *buckets = malloc((1U << bits) * sizeof(*buckets));
+	uint32_t i;
+
+	if (buckets == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < (1U << bits); ++i)
+		INIT_LIST_HEAD(&buckets[i]);
+
+	if (stats->buckets) {
+		for (i = 0; i < (1U << stats->bits); ++i) {
+			struct structure_stats *pos, *n;
+
+			list_for_each_entry_safe(pos, n, &stats->buckets[i], node)
+				list_move_tail(&pos->node, &buckets[hash_64(pos->hash, bits)]);
+		}
+		free(stats->buckets);
+	}
+
+	stats->buckets = buckets;
+	stats->bits    = bits;
+	return 0;
+}
+
+static void structures_stats__exit(struct structures_stats *stats)
+{
+	if (stats->buckets == NULL)
+		return;
+
+	for (uint32_t i = 0; i < (1U << stats->bits); ++i) {
+		struct structure_stats *pos, *n;
+
+		list_for_each_entry_safe(pos, n, &stats->buckets[i], node) {
+			list_del(&pos->node);
+			structure_stats__delete(pos);
+		}
+	}
+
+	zfree(&stats->buckets);
+	stats->nr_entries = 0;
+}
+
+static struct structure_stats *structures_stats__find(const struct structures_stats *stats, const char *name, uint64_t hash)
+{
+	struct structure_stats *pos;
+
+	if (name == NULL || stats->buckets == NULL)
+		return NULL;
+
+	list_for_each_entry(pos, &stats->buckets[hash_64(hash, stats->bits)], node) {
+		if (pos->hash == hash && pos->name && strcmp(pos->name, name) == 0)
+			return pos;
+	}
+
+	return NULL;
+}
+
+static int structures_stats__insert(struct structures_stats *stats, struct structure_stats *entry)
+{
+	if (stats->buckets == NULL || stats->nr_entries >= 2U << stats->bits) {
+		if (structures_stats__resize(stats, stats->buckets ? stats->bits + 1 : 10))
+			return -ENOMEM;
+	}
+
+	list_add_tail(&entry->node, &stats->buckets[hash_64(entry->hash, stats->bits)]);
+	++stats->nr_entries;
+	return 0;
+}
+
+static bool structure_stats__is_earlier(const struct structure_stats *entry, uint32_t seq, uint32_t id, uint32_t order)
+{
+	if (seq != entry->seq)
+		return seq < entry->seq;
+	if (id != entry->id)
+		return id < entry->id;
+	return order < entry->order;
+}
 
-		if (pos->type.namespace.name == 0)
+static void structure_stats__set_definition(struct structure_stats *entry, struct class *class, struct cu *cu,
+					    uint32_t id, uint32_t order)
+{
+	entry->seq	  = cu->seq;
+	entry->id	  = id;
+	entry->order	  = order;
+	entry->size	  = class__size(class);
+	entry->nr_members = class__nr_members(class);
+	entry->nr_holes	  = tag__is_union(class__tag(class)) ? 0 : class->nr_holes;
+}
+
+static struct structure_stats *structures_stats__add(struct structures_stats *stats, struct class *class,
+						     struct cu *cu, uint32_t id, bool *existing_entry)
+{
+	const char *name = class__name(class);
+	uint64_t hash = class__fingerprint(class);
+	uint32_t order = stats->nr_accounted++;
+	struct structure_stats *entry = structures_stats__find(stats, name, hash);
+
+	*existing_entry = entry != NULL;
+
+	if (entry) {
+		if (structure_stats__is_earlier(entry, cu->seq, id, order))
+			structure_stats__set_definition(entry, class, cu, id, order);
+		return entry;
+	}
+
+	entry = zalloc(sizeof(*entry));
+	if (entry == NULL)
+		return NULL;
+
+	if (name) {
+		entry->name = strdup(name);
+		if (entry->name == NULL)
+			goto out_delete;
+	}
+
+	entry->hash	= hash;
+	entry->nr_files = 1;
+	structure_stats__set_definition(entry, class, cu, id, order);
+
+	if (structures_stats__insert(stats, entry))
+		goto out_delete;
+
+	return entry;
+out_delete:
+	structure_stats__delete(entry);
+	return NULL;
+}
+
+// The same as print_classes() and cu__account_nr_methods() do, but per thread
+static int structures_stats__account_cu(struct structures_stats *stats, struct cu *cu)
+{
+	struct structure_stats *entry;
+	bool existing_entry;
+	uint32_t id;
+
+	if (stats_formatter == nr_methods_formatter) {
+		struct function *pos_function;
+
+		cu__for_each_function(cu, id, pos_function) {
+			struct class_member *pos;
+
+			function__for_each_parameter(pos_function, cu, pos) {
+				struct tag *type = cu__type(cu, pos->tag.type);
+
+				if (type == NULL || !tag__is_pointer(type))
+					continue;
+
+				type = cu__type(cu, type->type);
+				if (type == NULL || !tag__is_struct(type) || tag__type(type)->namespace.name == 0)
+					continue;
+
+				if (!class__filter(tag__class(type), cu, 0))
+					continue;
+
+				entry = structures_stats__add(stats, tag__class(type), cu, id, &existing_entry);
+				if (entry == NULL)
+					return -ENOMEM;
+				++entry->nr_methods;
+			}
+		}
+
+		return 0;
+	}
+
+	struct class *pos;
+
+	cu__for_each_struct_or_union(cu, id, pos) {
+		if (pos->type.namespace.name == 0 &&
+		    (stats_formatter != NULL || !(class__include_anonymous || class__include_nested_anonymous)))
 			continue;
 
 		if (!class__filter(pos, cu, id))
 			continue;
 
-		type__for_each_member(&pos->type, pos_member) {
-			struct tag *ctype = cu__type(cu, pos_member->tag.type);
+		entry = structures_stats__add(stats, pos, cu, id, &existing_entry);
+		if (entry == NULL)
+			return -ENOMEM;
+		if (existing_entry)
+			++entry->nr_files;
+	}
+
+	return 0;
+}
+
+static void structure_stats__fprintf(const struct structure_stats *entry, FILE *fp)
+{
+	if (stats_formatter == nr_definitions_formatter)
+		fprintf(fp, "%s%c%u\n", entry->name, separator, entry->nr_files);
+	else if (stats_formatter == nr_methods_formatter)
+		fprintf(fp, "%s%c%u\n", entry->name, separator, entry->nr_methods);
+	else if (formatter == size_formatter)
+		fprintf(fp, "%s%c%d%c%u\n", entry->name, separator, entry->size, separator, entry->nr_holes);
+	else
+		fprintf(fp, "%s%c%u\n", entry->name, separator, entry->nr_members);
+}
+
+static int structure_stats__cmp(const void *a, const void *b)
+{
+	const struct structure_stats *ea = *(const struct structure_stats **)a,
+				     *eb = *(const struct structure_stats **)b;
+
+	if (structure_stats__is_earlier(ea, eb->seq, eb->id, eb->order))
+		return 1;
+	if (structure_stats__is_earlier(eb, ea->seq, ea->id, ea->order))
+		return -1;
+	return 0;
+}
+
+/*
+ * Merges the structs accounted by a thread into structures_stats, the ones not
+ * seen before are moved, and added to @new_entries.
+ */
+static int structures_stats__merge(struct structures_stats *stats, struct list_head *new_entries)
+{
+	int err = 0;
+
+	if (stats->buckets == NULL)
+		return 0;
+
+	for (uint32_t i = 0; i < (1U << stats->bits); ++i) {
+		struct structure_stats *pos, *n;
+
+		list_for_each_entry_safe(pos, n, &stats->buckets[i], node) {
+			struct structure_stats *entry = structures_stats__find(&structures_stats, pos->name, pos->hash);
+
+			if (entry) {
+				entry->nr_files	  += pos->nr_files;
+				entry->nr_methods += pos->nr_methods;
+				if (structure_stats__is_earlier(entry, pos->seq, pos->id, pos->order)) {
+					entry->seq	  = pos->seq;
+					entry->id	  = pos->id;
+					entry->order	  = pos->order;
+					entry->size	  = pos->size;
+					entry->nr_members = pos->nr_members;
+					entry->nr_holes	  = pos->nr_holes;
+				}
+				continue;
+			}
 
-			tag__assert_search_result(ctype);
-			if (!tag__is_pointer_to(ctype, type))
+			list_del(&pos->node);
+			--stats->nr_entries;
+			if (structures_stats__insert(&structures_stats, pos)) {
+				structure_stats__delete(pos);
+				err = -ENOMEM;
 				continue;
+			}
+			list_add_tail(&pos->order_node, new_entries);
+		}
+	}
+
+	structures_stats__exit(stats);
+	return err;
+}
+
+/*
+ * Sorts the structs first seen in the file just loaded as if the CUs were
+ * processed sequentially and, for --sizes and --nr_members, prints them now,
+ * as they would have been printed as the CUs were processed.
+ */
+static int structures_stats__add_new_entries(struct list_head *new_entries, FILE *fp)
+{
+	struct structure_stats **entries, *pos;
+	uint32_t nr_entries = 0, i = 0;
+
+	list_for_each_entry(pos, new_entries, order_node)
+		++nr_entries;
+
+	if (nr_entries == 0)
+		return 0;
+
+	entries = malloc(nr_entries * sizeof(*entries));
+	if (entries == NULL) {
+		struct structure_stats *n;
+
+		// Keep them, even if not in order
+		list_for_each_entry_safe(pos, n, new_entries, order_node)
+			list_move_tail(&pos->order_node, &structures_stats__list);
+		return -ENOMEM;
+	}
+
+	list_for_each_entry(pos, new_entries, order_node)
+		entries[i++] = pos;
+
+	qsort(entries, nr_entries, sizeof(*entries), structure_stats__cmp);
+
+	for (i = 0; i < nr_entries; ++i) {
+		list_move_tail(&entries[i]->order_node, &structures_stats__list);
+		if (stats_formatter == NULL)
+			structure_stats__fprintf(entries[i], fp);
+	}
+
+	free(entries);
+	return 0;
+}
+
+// For -T/--nr_definitions and -m/--nr_methods, that need all the files loaded
+static void structures_stats__fprintf(FILE *fp)
+{
+	struct structure_stats *pos;
+
+	if (stats_formatter == NULL)
+		return;
+
+	list_for_each_entry(pos, &structures_stats__list, order_node)
+		structure_stats__fprintf(pos, fp);
+}
+
+/*
+ * struct type_referrer - a struct or union using a type
+ *
+ * @member - the first member of that type or pointing to it
+ * @id - of the struct or union
+ * @nr_members - of that type, 1 for pointers, as there is one entry per member
+ */
+struct type_referrer {
+	struct class_member *member;
+	uint32_t	    id;
+	uint32_t	    nr_members;
+};
+
+/*
+ * struct type_referrers - from a type to the structs and unions using it
+ *
+ * Built once per CU, on first use, so that --contains and --find_pointers_to
+ * don't go thru all the members of all the structs in the CU for each type
+ * looked up and for each level with --recursive. Single allocation.
+ *
+ * @nr_types - cu->types_table.nr_entries when it was built
+ * @containers - for type N the containers are @entries[@containers[N]] up to @entries[@containers[N + 1]]
+ * @pointers - same, for the ones with members pointing to type N
+ * @entries - per type, ordered by struct or union id
+ */
+struct type_referrers {
+	uint32_t	     nr_types;
+	uint32_t	     *containers;
+	uint32_t	     *pointers;
+	struct type_referrer entries[];
+};
+
+static int type_referrers__pointee(const struct cu *cu, const struct class_member *member, uint32_t nr_types)
+{
+	struct tag *type = cu__type(cu, member->tag.type);
+
+	if (type == NULL || !tag__is_pointer(type) || type->type >= nr_types)
+		return -1;
+
+	return type->type;
+}
+
+static struct type_referrers *type_referrers__new(struct cu *cu)
+{
+	const uint32_t nr_types = cu->types_table.nr_entries;
+	uint32_t *containers = calloc(nr_types + 1, sizeof(*containers)),
+		 *pointers = calloc(nr_types + 1, sizeof(*pointers)),
+		 *last_container = calloc(nr_types, sizeof(*last_container));
+	struct type_referrers *referrers = NULL;
+	uint32_t id, nr_containers = 0, nr_pointers = 0;
+	struct class_member *member;
+	struct class *pos;
+
+	if (containers == NULL || pointers == NULL || last_container == NULL)
+		goto out;
+
+	// First count the entries for each type, one per container, one per pointer member
+	cu__for_each_struct_or_union(cu, id, pos) {
+		type__for_each_member(&pos->type, member) {
+			uint32_t type_id = member->tag.type;
+			int pointee = type_referrers__pointee(cu, member, nr_types);
+
+			if (type_id < nr_types && last_container[type_id] != id) {
+				last_container[type_id] = id;
+				++containers[type_id];
+				++nr_containers;
+			}
+
+			if (pointee >= 0) {
+				++pointers[pointee];
+				++nr_pointers;
+			}
+		}
+	}
+
+	referrers = malloc(sizeof(*referrers) + (nr_containers + nr_pointers) * sizeof(referrers->entries[0]) +
+			   2 * (nr_types + 1) * sizeof(uint32_t));
+	if (referrers == NULL)
+		goto out;
+
+	referrers->nr_types   = nr_types;
+	referrers->containers = (void *)&referrers->entries[nr_containers + nr_pointers];
+	referrers->pointers   = referrers->containers + nr_types + 1;
+
+	// Where the entries for each type start, then use @containers and @pointers as cursors
+	uint32_t containers_start = 0, pointers_start = nr_containers;
+
+	for (id = 0; id <= nr_types; ++id) {
+		uint32_t nr = containers[id];
+
+		referrers->containers[id] = containers[id] = containers_start;
+		containers_start += nr;
+
+		nr = pointers[id];
+		referrers->pointers[id] = pointers[id] = pointers_start;
+		pointers_start += nr;
+	}
 
-			if (!looked) {
-				bool existing_entry;
+	memset(last_container, 0, nr_types * sizeof(*last_container));
 
-				str = structures__add(pos, cu, id, &existing_entry);
-				if (str == NULL) {
-					fprintf(stderr, "pahole: insufficient memory for "
-						"processing %s, skipping it...\n",
-						cu->name);
-					return;
+	cu__for_each_struct_or_union(cu, id, pos) {
+		type__for_each_member(&pos->type, member) {
+			uint32_t type_id = member->tag.type;
+			int pointee = type_referrers__pointee(cu, member, nr_types);
+
+			if (type_id < nr_types) {
+				if (last_container[type_id] != id) {
+					last_container[type_id] = id;
+					referrers->entries[containers[type_id]++] = (struct type_referrer){
+						.member	    = member,
+						.id	    = id,
+						.nr_members = 1,
+					};
+				} else {
+					++referrers->entries[containers[type_id] - 1].nr_members;
 				}
-				/*
-				 * We already printed this struct in another CU
-				 */
-				if (existing_entry)
-					break;
-				looked = true;
 			}
-			printf("%s: %s\n", class__name(str->class),
-			       class_member__name(pos_member));
+
+			if (pointee >= 0) {
+				referrers->entries[pointers[pointee]++] = (struct type_referrer){
+					.member	    = member,
+					.id	    = id,
+					.nr_members = 1,
+				};
+			}
+		}
+	}
+out:
+	free(containers);
+	free(pointers);
+	free(last_container);
+	return referrers;
+}
+
+static const struct type_referrers *cu__type_referrers(struct cu *cu)
+{
+	if (cu->type_referrers == NULL)
+		cu->type_referrers = type_referrers__new(cu);
+
+	return cu->type_referrers;
+}
+
+#define type_referrers__for_each_container(referrers, type_id, pos)					  \
+	for (pos = (type_id) < (referrers)->nr_types ? &(referrers)->entries[(referrers)->containers[type_id]] : NULL; \
+	     pos && pos < &(referrers)->entries[(referrers)->containers[(type_id) + 1]]; ++pos)
+
+#define type_referrers__for_each_pointer(referrers, type_id, pos)					  \
+	for (pos = (type_id) < (referrers)->nr_types ? &(referrers)->entries[(referrers)->pointers[type_id]] : NULL; \
+	     pos && pos < &(referrers)->entries[(referrers)->pointers[(type_id) + 1]]; ++pos)
+
+// Number of members of type @type_id in the struct or union @container_id
+static uint32_t type_referrers__nr_members_of_type(const struct type_referrers *referrers,
+						   uint32_t container_id, uint32_t type_id)
+{
+	uint32_t first, last;
+
+	if (type_id >= referrers->nr_types)
+		return 0;
+
+	first = referrers->containers[type_id];
+	last  = referrers->containers[type_id + 1];
+
+	while (first < last) {
+		uint32_t middle = first + (last - first) / 2;
+		const struct type_referrer *entry = &referrers->entries[middle];
+
+		if (entry->id == container_id)
+			return entry->nr_members;
+
+		if (entry->id < container_id)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	return 0;
+}
+
+static char tab[128];
+
+static void print_structs_with_pointer_to(struct cu *cu, uint32_t type)
+{
+	const struct type_referrers *referrers = cu__type_referrers(cu);
+	const struct type_referrer *pos;
+	struct structure *str = NULL;
+	uint32_t prev_id = 0;
+	bool skip = true;
+
+	if (referrers == NULL) {
+		fprintf(stderr, "pahole: insufficient memory for processing %s, skipping it...\n", cu->name);
+		return;
+	}
+
+	// The entries for a struct are together, with the members in order
+	type_referrers__for_each_pointer(referrers, type, pos) {
+		if (pos->id != prev_id) {
+			struct class *class = tag__class(cu__type(cu, pos->id));
+			bool existing_entry;
+
+			prev_id = pos->id;
+			skip = class->type.namespace.name == 0 || !class__filter(class, cu, pos->id);
+			if (skip)
+				continue;
+
+			str = structures__add(class, cu, pos->id, &existing_entry);
+			if (str == NULL) {
+				fprintf(stderr, "pahole: insufficient memory for "
+					"processing %s, skipping it...\n",
+					cu->name);
+				return;
+			}
+			/*
+			 * We already printed this struct in another CU
+			 */
+			skip = existing_entry;
 		}
+
+		if (!skip)
+			printf("%s: %s\n", class__name(str->class), class_member__name(pos->member));
 	}
 }
 
-static int type__print_containers(struct type *type, struct cu *cu, uint32_t contained_type_id, int ident)
+static int type__print_containers(struct type *type, uint32_t type_id, struct cu *cu,
+				  const struct type_referrers *referrers, uint32_t contained_type_id, int ident)
 {
-	const uint32_t n = type__nr_members_of_type(type, contained_type_id);
+	const uint32_t n = type_referrers__nr_members_of_type(referrers, type_id, contained_type_id);
 	if (n == 0)
 		return 0;
 
@@ -1156,7 +2261,8 @@ static int type__print_containers(struct type *type, struct cu *cu, uint32_t con
 			struct tag *member_type = cu__type(cu, member->tag.type);
 
 			if (tag__is_struct(member_type) || tag__is_union(member_type))
-				type__print_containers(tag__type(member_type), cu, contained_type_id, ident + 1);
+				type__print_containers(tag__type(member_type), member->tag.type, cu, referrers,
+						       contained_type_id, ident + 1);
 		}
 	}
 
@@ -1165,17 +2271,24 @@ static int type__print_containers(struct type *type, struct cu *cu, uint32_t con
 
 static void print_containers(struct cu *cu, uint32_t type, int ident)
 {
-	struct class *pos;
-	uint32_t id;
+	const struct type_referrers *referrers = cu__type_referrers(cu);
+	const struct type_referrer *pos;
 
-	cu__for_each_struct_or_union(cu, id, pos) {
-		if (pos->type.namespace.name == 0)
+	if (referrers == NULL) {
+		fprintf(stderr, "pahole: insufficient memory for processing %s, skipping it...\n", cu->name);
+		return;
+	}
+
+	type_referrers__for_each_container(referrers, type, pos) {
+		struct class *class = tag__class(cu__type(cu, pos->id));
+
+		if (class->type.namespace.name == 0)
 			continue;
 
-		if (!class__filter(pos, cu, id))
+		if (!class__filter(class, cu, pos->id))
 			continue;
 
-		if (type__print_containers(&pos->type, cu, type, ident))
+		if (type__print_containers(&class->type, pos->id, cu, referrers, type, ident))
 			break;
 	}
 }
@@ -1220,6 +2333,10 @@ ARGP_PROGRAM_VERSION_HOOK_DEF = dwarves_print_version;
 #define ARGP_compile		   334
 #define ARGP_languages		   335
 #define ARGP_languages_exclude	   336
+#define ARGP_prettify_columns	   337
+#define ARGP_reorganize_time_budget 338
+#define ARGP_access_profile	   339
+#define ARGP_packable_report	   340
 
 static const struct argp_option pahole__options[] = {
 	{
@@ -1343,12 +2460,31 @@ static const struct argp_option pahole__options[] = {
 		.doc  = "recursive mode, affects several other flags",
 	},
 	{
-		.name = "reorganize",
-		.key  = 'R',
-		.doc  = "reorg struct trying to kill holes",
+		.name  = "reorganize",
+		.key   = 'R',
+		.arg   = "ALGORITHM",
+		.flags = OPTION_ARG_OPTIONAL,
+		.doc   = "reorg struct trying to kill holes, ALGORITHM: 'greedy', the default, or 'optimal'",
 	},
 	{
-		.name = "show_reorg_steps",
+		.name = "reorganize_time_budget",
+		.key  = ARGP_reorganize_time_budget,
+		.arg  = "MSECS",
+		.doc  = "Time budget for each struct with --reorganize=optimal, default: 1000ms",
+	},
+	{
+		.name = "access_profile",
+		.key  = ARGP_access_profile,
+		.arg  = "FILE",
+		.doc  = "Member access counts for --reorganize to group hot members, implies --reorganize=optimal",
+	},
+	{
+		.name = "packable_report",
+		.key  = ARGP_packable_report,
+		.doc  = "Reorganize each distinct struct once, using --jobs threads, and list the packable ones, ranked by bytes saved",
+	},
+	{
+		.name = "show_reorg_steps",
 		.key  = 'S',
 		.doc  = "show the struct layout at each reorganization step",
 	},
@@ -1451,7 +2587,7 @@ static const struct argp_option pahole__options[] = {
 	{
 		.name = "ctf_encode",
 		.key  = 'Z',
-		.doc  = "Encode as CTF: DISABLED, consider helping porting to libctf",
+		.doc  = "Encode as CTF, deduplicating types across all CUs",
 	},
 	{
 		.name = "flat_arrays",
@@ -1584,6 +2720,12 @@ static const struct argp_option pahole__options[] = {
 		.arg  = "PATH",
 		.doc  = "Path to the raw data to pretty print",
 	},
+	{
+		.name = "prettify_columns",
+		.key  = ARGP_prettify_columns,
+		.arg  = "DIR",
+		.doc  = "Instead of pretty printing --prettify records, write each member to a column file in DIR",
+	},
 	{
 		.name = "hashbits",
 		.key  = ARGP_hashbits,
@@ -1683,7 +2825,16 @@ static error_t pahole__options_parser(int key, char *arg,
 	case 'q': conf.emit_stats = 0;
 		  conf.suppress_comments = 1;
 		  conf.suppress_offset_comment = 1;	break;
-	case 'R': reorganize = 1;			break;
+	case 'R': reorganize = 1;
+		  if (arg && strcmp(arg, "optimal") == 0) {
+			reorganize_optimal = true;
+		  } else if (arg && strcmp(arg, "greedy") == 0) {
+			reorganize_greedy = true;
+		  } else if (arg) {
+			fprintf(stderr, "pahole: unknown --reorganize algorithm '%s', use 'greedy' or 'optimal'\n", arg);
+			return EINVAL;
+		  }
+		  break;
 	case 'r': conf.rel_offset = 1;			break;
 	case 'S': show_reorg_steps = 1;			break;
 	case 's': formatter = size_formatter;		break;
@@ -1707,7 +2858,8 @@ static error_t pahole__options_parser(int key, char *arg,
 		if (!global_verbose)
 			formatter = class_name_formatter;
 		break;
-	// case 'Z': ctf_encode = 1;			break; // FIXME: Disabled
+	case 'Z': ctf_encode = 1;
+		  conf_load.get_addr_info = true;	break;
 	case ARGP_compile:
 		  compilable = true;
                   type_emissions__init(&emissions);
@@ -1770,6 +2922,28 @@ static error_t pahole__options_parser(int key, char *arg,
 		show_with_flexible_array = true;	break;
 	case ARGP_prettify_input_filename:
 		prettify_input_filename = arg;		break;
+	case ARGP_prettify_columns:
+		prettify_columns_dir = arg;		break;
+	case ARGP_reorganize_time_budget: {
+		char *end;
+		unsigned long budget;
+
+		errno = 0;
+		budget = strtoul(arg, &end, 0);
+		if (!isdigit((unsigned char)*arg) || *end != '\0' || errno || budget > UINT_MAX) {
+			fprintf(stderr, "pahole: invalid --reorganize_time_budget '%s', use a number of milliseconds\n", arg);
+			return EINVAL;
+		}
+		reorganize_time_budget = budget;
+	}
+		break;
+	case ARGP_access_profile:
+		access_profile_filename = arg;
+		reorganize = 1;
+		reorganize_optimal = true;		break;
+	case ARGP_packable_report:
+		packable_report = true;
+		conf_load.extra_dbg_info = 1;		break;
 	case ARGP_sort_output:
 		sort_output = true;			break;
 	case ARGP_hashbits:
@@ -1801,17 +2975,264 @@ static struct argp pahole__argp = {
 	.args_doc = pahole__args_doc,
 };
 
+/*
+ * struct access_profile_entry - how many times a struct member was accessed
+ *
+ * Read with --access_profile from lines with "struct_name.member_name COUNT"
+ * or, for data address samples already mapped to an offset in the struct,
+ * from "struct_name+OFFSET COUNT". Offsets are resolved to the member in the
+ * original layout each time, see access_profile__init(), as structs with the
+ * same name may have different layouts.
+ *
+ * @node - in the access_profile bucket for hash_str(@struct_name)
+ * @hash - hash_str(@struct_name)
+ * @struct_name - as in the profile
+ * @member_name - as in the profile, NULL for the @offset ones
+ * @offset - when @member_name is NULL
+ * @count - number of accesses
+ */
+struct access_profile_entry {
+	struct list_head node;
+	uint64_t	 hash;
+	char		 *struct_name;
+	char		 *member_name;
+	uint32_t	 offset;
+	uint64_t	 count;
+};
+
+#define ACCESS_PROFILE__BITS 8
+static struct list_head access_profile_buckets[1 << ACCESS_PROFILE__BITS];
+
+static void access_profile_entry__delete(struct access_profile_entry *entry)
+{
+	zfree(&entry->struct_name);
+	zfree(&entry->member_name);
+	free(entry);
+}
+
+static struct access_profile_entry *access_profile_entry__new(char *line)
+{
+	char *token = strtok(line, " \t\n"), *count = strtok(NULL, " \t\n"), *end, *sep;
+	struct access_profile_entry *entry;
+
+	if (token == NULL || count == NULL || strtok(NULL, " \t\n") != NULL)
+		return NULL;
+
+	entry = zalloc(sizeof(*entry));
+	if (entry == NULL)
+		return NULL;
+
+	entry->count = strtoull(count, &end, 0);
+	if (*end != '\0')
+		goto out_delete;
+
+	sep = strpbrk(token, ".+");
+	if (sep == NULL || sep == token || sep[1] == '\0')
+		goto out_delete;
+
+	if (*sep == '+') {
+		unsigned long long offset = strtoull(sep + 1, &end, 0);
+
+		if (*end != '\0' || offset > UINT32_MAX)
+			goto out_delete;
+		entry->offset = offset;
+	} else {
+		entry->member_name = strdup(sep + 1);
+		if (entry->member_name == NULL)
+			goto out_delete;
+	}
+
+	*sep = '\0';
+	entry->struct_name = strdup(token);
+	if (entry->struct_name == NULL)
+		goto out_delete;
+	entry->hash = hash_str(HASH_BYTES__INIT, entry->struct_name);
+
+	return entry;
+out_delete:
+	access_profile_entry__delete(entry);
+	return NULL;
+}
+
+static int access_profile__load(const char *filename)
+{
+	FILE *fp = fopen(filename, "r");
+	size_t line_size = 0;
+	char *line = NULL;
+	int lineno = 0, err = 0;
+
+	if (fp == NULL) {
+		err = -errno;
+		fprintf(stderr, "pahole: couldn't open access profile '%s': %s\n", filename, strerror(-err));
+		return err;
+	}
+
+	for (int i = 0; i < (1 << ACCESS_PROFILE__BITS); ++i)
+		INIT_LIST_HEAD(&access_profile_buckets[i]);
+
+	while (getline(&line, &line_size, fp) != -1) {
+		char *comment = strchr(line, '#'), *s = line;
+		struct access_profile_entry *entry;
+
+		++lineno;
+
+		if (comment)
+			*comment = '\0';
+		while (isspace(*s))
+			++s;
+		if (*s == '\0')
+			continue;
+
+		entry = access_profile_entry__new(s);
+		if (entry == NULL) {
+			fprintf(stderr, "pahole: %s:%d: expected 'struct.member COUNT' or 'struct+OFFSET COUNT'\n",
+				filename, lineno);
+			err = -EINVAL;
+			break;
+		}
+
+		list_add_tail(&entry->node, &access_profile_buckets[hash_64(entry->hash, ACCESS_PROFILE__BITS)]);
+	}
+
+	free(line);
+	fclose(fp);
+	return err;
+}
+
+static void access_profile__delete(void)
+{
+	if (access_profile_filename == NULL)
+		return;
+
+	for (int i = 0; i < (1 << ACCESS_PROFILE__BITS); ++i) {
+		struct access_profile_entry *pos, *n;
+
+		if (access_profile_buckets[i].next == NULL)
+			continue;
+
+		list_for_each_entry_safe(pos, n, &access_profile_buckets[i], node) {
+			list_del(&pos->node);
+			access_profile_entry__delete(pos);
+		}
+	}
+}
+
+// The first data member at @offset in @cls, NULL if there is none
+static const struct class_member *class__member_at(const struct class *cls, uint32_t offset)
+{
+	struct class_member *pos;
+
+	type__for_each_data_member(&cls->type, pos) {
+		if (offset >= pos->byte_offset && offset < pos->byte_offset + pos->byte_size)
+			return pos;
+	}
+
+	return NULL;
+}
+
+/*
+ * @profile->priv is the class in its original layout, where the offsets in
+ * the profile are looked up, @cls may be a reorganized clone of it, so the
+ * members are matched by name.
+ */
+static uint64_t access_profile__member_weight(const struct reorganize_profile *profile,
+					      const struct class *cls, const struct class_member *member)
+{
+	const struct class *original = profile->priv;
+	const char *struct_name = class__name((struct class *)cls),
+		   *member_name = class_member__name(member);
+	struct access_profile_entry *pos;
+	uint64_t hash, weight = 0;
+
+	if (struct_name == NULL || member_name == NULL)
+		return 0;
+
+	hash = hash_str(HASH_BYTES__INIT, struct_name);
+
+	list_for_each_entry(pos, &access_profile_buckets[hash_64(hash, ACCESS_PROFILE__BITS)], node) {
+		const char *name = pos->member_name;
+
+		if (pos->hash != hash || strcmp(pos->struct_name, struct_name) != 0)
+			continue;
+
+		if (name == NULL) {
+			const struct class_member *at = class__member_at(original, pos->offset);
+
+			name = at ? class_member__name(at) : NULL;
+		}
+
+		if (name && strcmp(name, member_name) == 0)
+			weight += pos->count;
+	}
+
+	return weight;
+}
+
+/*
+ * Only reads the profile, so can be used from multiple threads, each with its
+ * own @profile, returns NULL when there is no --access_profile.
+ */
+static const struct reorganize_profile *access_profile__init(struct reorganize_profile *profile,
+							     const struct class *original)
+{
+	if (access_profile_filename == NULL)
+		return NULL;
+
+	profile->member_weight = access_profile__member_weight;
+	profile->priv	       = (void *)original;
+	return profile;
+}
+
+static void class__fprintf_access_profile(struct class *cls, const struct reorganize_profile *profile,
+					  uint32_t hot_cachelines_before, FILE *fp)
+{
+	uint32_t hot_cachelines = class__hot_cachelines(cls, conf.cacheline_size, profile);
+	struct class_member *pos;
+	int nr_cold = 0;
+
+	fprintf(fp, "   /* hot members in %u cacheline%s, was %u", hot_cachelines,
+		hot_cachelines != 1 ? "s" : "", hot_cachelines_before);
+
+	type__for_each_data_member(&cls->type, pos) {
+		const char *name = class_member__name(pos);
+
+		if (name == NULL || pos->byte_size == 0 ||
+		    profile->member_weight(profile, cls, pos) != 0)
+			continue;
+
+		fprintf(fp, "%s %s", nr_cold++ == 0 ? ", cold members, could go to a separate struct:" : ",", name);
+	}
+
+	fputs(" */\n", fp);
+}
+
 static void do_reorg(struct tag *class, struct cu *cu)
 {
 	int savings;
 	const uint8_t reorg_verbose =
 			show_reorg_steps ? 2 : global_verbose;
+	struct reorganize_profile access_profile;
+	const struct reorganize_profile *profile = access_profile__init(&access_profile, tag__class(class));
+	const uint32_t hot_cachelines = profile ? class__hot_cachelines(tag__class(class), conf.cacheline_size, profile) : 0;
 	struct class *clone = class__clone(tag__class(class), NULL);
 	if (clone == NULL) {
 		fprintf(stderr, "pahole: out of memory!\n");
 		exit(EXIT_FAILURE);
 	}
-	class__reorganize(clone, cu, reorg_verbose, stdout);
+	if (reorganize_optimal) {
+		int err = class__reorganize_optimal(clone, cu, conf.cacheline_size, reorganize_time_budget,
+						    profile, reorg_verbose, stdout);
+		if (err < 0) {
+			if (reorg_verbose)
+				puts("/* Couldn't search for the optimal layout, using the greedy algorithm */");
+			class__reorganize(clone, cu, reorg_verbose, stdout);
+		} else if (err > 0) {
+			printf("/* --reorganize_time_budget=%u ran out, this may not be the optimal layout */\n",
+			       reorganize_time_budget);
+		}
+	} else {
+		class__reorganize(clone, cu, reorg_verbose, stdout);
+	}
 	savings = class__size(tag__class(class)) - class__size(clone);
 	if (savings != 0 && reorg_verbose) {
 		putchar('\n');
@@ -1835,9 +3256,178 @@ static void do_reorg(struct tag *class, struct cu *cu)
 	} else
 		putchar('\n');
 
+	if (profile)
+		class__fprintf_access_profile(clone, profile, hot_cachelines, stdout);
+
 	 class__delete(clone);
 }
 
+/*
+ * struct packable_report_entry - what --reorganize would do to a struct
+ *
+ * @st - the struct, already deduplicated, one entry per name and layout
+ * @new_size - after reorganizing, same as the original size if it couldn't be packed
+ * @cachelines - used by the original layout
+ * @new_cachelines - used after reorganizing
+ */
+struct packable_report_entry {
+	struct structure *st;
+	uint32_t	 new_size;
+	uint32_t	 cachelines;
+	uint32_t	 new_cachelines;
+};
+
+/*
+ * struct packable_report - the structs to reorganize
+ *
+ * The workers take the next entry to reorganize from @next, as the time spent
+ * in each struct varies a lot, specially with --reorganize=optimal.
+ *
+ * @lock - protects @next
+ * @next - next entry to reorganize
+ */
+struct packable_report {
+	pthread_mutex_t		     lock;
+	uint32_t		     next;
+	uint32_t		     nr_entries;
+	struct packable_report_entry *entries;
+};
+
+static void packable_report_entry__reorganize(struct packable_report_entry *entry)
+{
+	struct class *class = entry->st->class;
+	struct cu *cu = entry->st->cu;
+	struct reorganize_profile access_profile;
+	struct class *clone;
+
+	entry->new_size = class__size(class);
+	entry->cachelines = entry->new_cachelines = tag__nr_cachelines(&conf, class__tag(class), cu);
+
+	if (class->nr_holes == 0 && class->nr_bit_holes == 0)
+		return;
+
+	clone = class__clone(class, NULL);
+	if (clone == NULL)
+		return;
+
+	if (reorganize_optimal) {
+		if (class__reorganize_optimal(clone, cu, conf.cacheline_size, reorganize_time_budget,
+					      access_profile__init(&access_profile, class), 0, stdout) < 0)
+			class__reorganize(clone, cu, 0, stdout);
+	} else {
+		class__reorganize(clone, cu, 0, stdout);
+	}
+
+	if (class__size(clone) < entry->new_size) {
+		entry->new_size = class__size(clone);
+		entry->new_cachelines = tag__nr_cachelines(&conf, class__tag(clone), cu);
+	}
+
+	class__delete(clone);
+}
+
+static void *packable_report__worker(void *arg)
+{
+	struct packable_report *report = arg;
+
+	while (1) {
+		uint32_t i;
+
+		pthread_mutex_lock(&report->lock);
+		i = report->next++;
+		pthread_mutex_unlock(&report->lock);
+
+		if (i >= report->nr_entries)
+			break;
+
+		packable_report_entry__reorganize(&report->entries[i]);
+	}
+
+	return NULL;
+}
+
+// Most bytes saved first, then the most widely used, i.e. defined in more CUs
+static int packable_report_entry__cmp(const void *a, const void *b)
+{
+	const struct packable_report_entry *ea = a, *eb = b;
+	uint32_t saved_a = class__size(ea->st->class) - ea->new_size,
+		 saved_b = class__size(eb->st->class) - eb->new_size;
+
+	if (saved_a != saved_b)
+		return saved_a > saved_b ? -1 : 1;
+
+	if (ea->st->nr_files != eb->st->nr_files)
+		return ea->st->nr_files > eb->st->nr_files ? -1 : 1;
+
+	return strcmp(class__name(ea->st->class), class__name(eb->st->class));
+}
+
+/*
+ * The structs were deduplicated while loading, by name and layout, so each is
+ * reorganized just once, no matter in how many CUs it is defined, and from
+ * here on the CUs are not changed, so the reorganizing can be done in parallel.
+ */
+static int structures__fprintf_packable_report(int nr_jobs, FILE *fp)
+{
+	struct packable_report report = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	struct structure *st;
+	uint32_t i;
+
+	list_for_each_entry(st, &structures__list, node)
+		++report.nr_entries;
+
+	report.entries = calloc(report.nr_entries, sizeof(report.entries[0]));
+	if (report.entries == NULL && report.nr_entries != 0)
+		return -ENOMEM;
+
+	i = 0;
+	list_for_each_entry(st, &structures__list, node)
+		report.entries[i++].st = st;
+
+	if (nr_jobs < 1)
+		nr_jobs = 1;
+
+	pthread_t *threads = calloc(nr_jobs, sizeof(*threads));
+	bool *threaded = calloc(nr_jobs, sizeof(*threaded));
+
+	if (threads == NULL || threaded == NULL)
+		nr_jobs = 1;
+
+	// This thread is a worker too
+	for (int j = 1; j < nr_jobs; ++j)
+		threaded[j] = pthread_create(&threads[j], NULL, packable_report__worker, &report) == 0;
+
+	packable_report__worker(&report);
+
+	for (int j = 1; j < nr_jobs; ++j) {
+		if (threaded[j])
+			pthread_join(threads[j], NULL);
+	}
+
+	free(threads);
+	free(threaded);
+
+	qsort(report.entries, report.nr_entries, sizeof(report.entries[0]), packable_report_entry__cmp);
+
+	for (i = 0; i < report.nr_entries; ++i) {
+		const struct packable_report_entry *entry = &report.entries[i];
+		uint32_t size = class__size(entry->st->class);
+
+		if (entry->new_size == size)
+			break;
+
+		fprintf(fp, "%s%c%u%c%u%c%u%c%u%c%u%c%u\n", class__name(entry->st->class),
+			separator, size, separator, entry->new_size, separator, size - entry->new_size,
+			separator, entry->cachelines, separator, entry->new_cachelines,
+			separator, entry->st->nr_files);
+	}
+
+	free(report.entries);
+	return 0;
+}
+
 static int instance__fprintf_hexdump_value(void *instance, int _sizeof, FILE *fp)
 {
 	uint8_t *contents = instance;
@@ -1855,18 +3445,25 @@ static int instance__fprintf_hexdump_value(void *instance, int _sizeof, FILE *fp
 	return printed;
 }
 
+/*
+ * Records may be decoded in place from a mmap'ed --prettify input, at any
+ * offset, so don't assume the values are aligned.
+ */
+#define __base_type__value(ctype, instance) \
+	({ ctype __value; memcpy(&__value, instance, sizeof(__value)); __value; })
+
 static uint64_t base_type__value(void *instance, int _sizeof)
 {
 	if (_sizeof == sizeof(int))
-		return *(int *)instance;
+		return __base_type__value(int, instance);
 	else if (_sizeof == sizeof(long))
-		return *(long *)instance;
+		return __base_type__value(long, instance);
 	else if (_sizeof == sizeof(long long))
-		return *(long long *)instance;
+		return __base_type__value(long long, instance);
 	else if (_sizeof == sizeof(char))
-		return *(char *)instance;
+		return __base_type__value(char, instance);
 	else if (_sizeof == sizeof(short))
-		return *(short *)instance;
+		return __base_type__value(short, instance);
 
 	return 0;
 }
@@ -1884,84 +3481,289 @@ static int base_type__fprintf_value(void *instance, int _sizeof, FILE *fp)
 	return fprintf__value(fp, value);
 }
 
-static uint64_t class_member__bitfield_value(struct class_member *member, void *instance)
-{
-	int byte_size = member->byte_size;
-	uint64_t value = base_type__value(instance, byte_size);
-	uint64_t mask = 0;
-	int bits = member->bitfield_size;
+struct record_decoder;
+struct enumerator_index;
 
-	while (bits) {
-		mask |= 1;
-		if (--bits)
-			mask <<= 1;
-	}
+/*
+ * struct type_cache - what --prettify builds for a type on first use
+ *
+ * Kept here and not in struct type as it is only about pretty printing, the
+ * entries are all added before going parallel in prettify_records__fprintf(),
+ * so the threads only look them up.
+ *
+ * @type - the key
+ * @decoder - flattened plan to pretty print instances of @type
+ * @enumerator_index - for enums, value to enumerator lookup table
+ * @enumerator_index_tried - don't try building @enumerator_index again, it failed
+ */
+struct type_cache {
+	struct list_head	node;
+	const struct type	*type;
+	struct record_decoder	*decoder;
+	struct enumerator_index *enumerator_index;
+	bool			enumerator_index_tried;
+};
 
-	mask <<= member->bitfield_offset;
+/*
+ * struct type_caches - hash table of struct type_cache, keyed by type address
+ *
+ * @buckets - 1 << @bits lists, grown when @nr_entries gets to twice that
+ */
+struct type_caches {
+	struct list_head *buckets;
+	uint32_t	 nr_entries;
+	uint8_t		 bits;
+};
 
-	return (value & mask) >> member->bitfield_offset;
-}
+static struct type_caches type_caches;
 
-static int class_member__fprintf_bitfield_value(struct class_member *member, void *instance, FILE *fp)
+static int type_caches__resize(struct type_caches *caches, uint8_t bits)
 {
-	const char *format = conf.hex_fmt ? "%#" PRIx64 : "%" PRIi64;
-	return fprintf(fp, format, class_member__bitfield_value(member, instance));
+	struct list_head *buckets = malloc((1U << bits) * sizeof(*buckets));
+	uint32_t i;
+
+	if (buckets == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < (1U << bits); ++i)
+		INIT_LIST_HEAD(&buckets[i]);
+
+	if (caches->buckets) {
+		for (i = 0; i < (1U << caches->bits); ++i) {
+			struct type_cache *pos, *n;
+
+			list_for_each_entry_safe(pos, n, &caches->buckets[i], node)
+				list_move_tail(&pos->node, &buckets[hash_64((uintptr_t)pos->type, bits)]);
+		}
+		free(caches->buckets);
+	}
+
+	caches->buckets = buckets;
+	caches->bits	= bits;
+	return 0;
 }
 
-static const char *enumeration__lookup_value(struct type *enumeration, uint64_t value)
+static struct type_cache *type_caches__find(const struct type_caches *caches, const struct type *type)
 {
-	struct enumerator *entry;
+	struct type_cache *pos;
 
-	type__for_each_enumerator(enumeration, entry) {
-		if (entry->value == value)
-			return enumerator__name(entry);
+	if (caches->buckets == NULL)
+		return NULL;
+
+	list_for_each_entry(pos, &caches->buckets[hash_64((uintptr_t)type, caches->bits)], node) {
+		if (pos->type == type)
+			return pos;
 	}
 
 	return NULL;
 }
 
-static const char *enumerations__lookup_value(struct list_head *enumerations, uint64_t value)
+static struct type_cache *type_caches__findnew(struct type_caches *caches, const struct type *type)
 {
-	struct tag_cu_node *pos;
+	struct type_cache *entry = type_caches__find(caches, type);
 
-	list_for_each_entry(pos, enumerations, node) {
-		const char *s = enumeration__lookup_value(tag__type(pos->tc.tag), value);
-		if (s)
-			return s;
+	if (entry)
+		return entry;
+
+	if (caches->buckets == NULL || caches->nr_entries >= 2U << caches->bits) {
+		if (type_caches__resize(caches, caches->buckets ? caches->bits + 1 : 8))
+			return NULL;
 	}
 
-	return NULL;
+	entry = zalloc(sizeof(*entry));
+	if (entry == NULL)
+		return NULL;
+
+	entry->type = type;
+	list_add_tail(&entry->node, &caches->buckets[hash_64((uintptr_t)type, caches->bits)]);
+	++caches->nr_entries;
+	return entry;
 }
 
-static struct enumerator *enumeration__lookup_entry_from_value(struct type *enumeration, uint64_t value)
+/*
+ * struct enumerator_index - value to enumerator lookup table
+ *
+ * Used when pretty printing records, to find the type for each record with
+ * 'type_enum=' and to print enum members, instead of walking the enumerators.
+ *
+ * @min - smallest value, @entries[0] when it is a dense array
+ * @nr_slots - number of @entries
+ * @bits - for hash_64(), zero if @entries is a dense array indexed by value - @min
+ * @entries - enumerators, the first one with a given value, as in the enumeration
+ */
+struct enumerator_index {
+	uint32_t	  min;
+	uint32_t	  nr_slots;
+	uint8_t		  bits;
+	struct enumerator *entries[];
+};
+
+static uint32_t enumeration__value_range(struct type *enumeration, uint32_t *min, uint32_t *max)
 {
 	struct enumerator *entry;
+	uint32_t nr_entries = 0;
+
+	*min = UINT32_MAX;
+	*max = 0;
 
 	type__for_each_enumerator(enumeration, entry) {
-		if (entry->value == value)
-			return entry;
+		if (entry->value < *min)
+			*min = entry->value;
+		if (entry->value > *max)
+			*max = entry->value;
+		++nr_entries;
 	}
 
-	return NULL;
+	if (nr_entries == 0)
+		*min = *max = 0;
+
+	return nr_entries;
 }
 
-static struct enumerator *enumerations__lookup_entry_from_value(struct list_head *enumerations, uint64_t value)
+static struct enumerator_index *enumeration__new_enumerator_index(struct type *enumeration)
 {
-	struct tag_cu_node *pos;
+	uint32_t min, max, nr_slots;
+	uint32_t nr_entries = enumeration__value_range(enumeration, &min, &max);
+	struct enumerator_index *index;
+	struct enumerator *entry;
+	uint8_t bits = 0;
 
-	list_for_each_entry(pos, enumerations, node) {
-		struct enumerator *enumerator = enumeration__lookup_entry_from_value(tag__type(pos->tc.tag), value);
-		if (enumerator) {
-			return enumerator;
-		}
+	// Most enums are compact, with values close together, use a dense array for those
+	if ((uint64_t)max - min + 1 <= 2ULL * nr_entries + 16) {
+		nr_slots = (uint64_t)max - min + 1;
+	} else {
+		while ((1U << bits) < 2 * nr_entries)
+			++bits;
+		nr_slots = 1U << bits;
 	}
 
-	return NULL;
-}
+	index = zalloc(sizeof(*index) + nr_slots * sizeof(index->entries[0]));
+	if (index == NULL)
+		return NULL;
 
-static int64_t enumeration__lookup_enumerator(struct type *enumeration, const char *enumerator)
-{
-	struct enumerator *entry;
+	index->min	= min;
+	index->nr_slots = nr_slots;
+	index->bits	= bits;
+
+	type__for_each_enumerator(enumeration, entry) {
+		uint32_t slot;
+
+		if (bits == 0) {
+			slot = entry->value - min;
+		} else {
+			slot = hash_64(entry->value, bits);
+			while (index->entries[slot] && index->entries[slot]->value != entry->value)
+				slot = (slot + 1) & (nr_slots - 1);
+		}
+
+		if (index->entries[slot] == NULL)
+			index->entries[slot] = entry;
+	}
+
+	return index;
+}
+
+static struct enumerator *enumerator_index__find(const struct enumerator_index *index, uint64_t value)
+{
+	if (value > UINT32_MAX)
+		return NULL;
+
+	if (index->bits == 0) {
+		if (value < index->min || value - index->min >= index->nr_slots)
+			return NULL;
+		return index->entries[value - index->min];
+	}
+
+	uint32_t slot = hash_64(value, index->bits);
+
+	while (index->entries[slot]) {
+		if (index->entries[slot]->value == value)
+			return index->entries[slot];
+		slot = (slot + 1) & (index->nr_slots - 1);
+	}
+
+	return NULL;
+}
+
+/*
+ * Built on first use, or by enumerations__prepare_lookups() before going
+ * parallel, when this only finds it, be it the index or the failure to
+ * build it.
+ */
+static struct enumerator_index *enumeration__enumerator_index(struct type *enumeration)
+{
+	struct type_cache *cache = type_caches__findnew(&type_caches, enumeration);
+
+	if (cache == NULL)
+		return NULL;
+
+	if (cache->enumerator_index == NULL && !cache->enumerator_index_tried) {
+		cache->enumerator_index = enumeration__new_enumerator_index(enumeration);
+		cache->enumerator_index_tried = true;
+	}
+
+	return cache->enumerator_index;
+}
+
+static struct enumerator *enumeration__lookup_entry_from_value(struct type *enumeration, uint64_t value)
+{
+	struct enumerator_index *index = enumeration__enumerator_index(enumeration);
+	struct enumerator *entry;
+
+	if (index)
+		return enumerator_index__find(index, value);
+
+	// Couldn't allocate the index, do it the slow way
+	type__for_each_enumerator(enumeration, entry) {
+		if (entry->value == value)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static struct enumerator *enumerations__lookup_entry_from_value(struct list_head *enumerations, uint64_t value)
+{
+	struct tag_cu_node *pos;
+
+	list_for_each_entry(pos, enumerations, node) {
+		struct enumerator *enumerator = enumeration__lookup_entry_from_value(tag__type(pos->tc.tag), value);
+		if (enumerator) {
+			return enumerator;
+		}
+	}
+
+	return NULL;
+}
+
+// Build the indexes upfront, when the lookups may then be done from multiple threads
+static int enumerations__prepare_lookups(struct list_head *enumerations)
+{
+	struct tag_cu_node *pos;
+
+	list_for_each_entry(pos, enumerations, node) {
+		struct type *enumeration = tag__type(pos->tc.tag);
+
+		// Without its cache entry the threads would be adding it
+		if (type_caches__findnew(&type_caches, enumeration) == NULL)
+			return -ENOMEM;
+
+		enumeration__enumerator_index(enumeration);
+	}
+
+	return 0;
+}
+
+static const char *enumerations__lookup_value(struct list_head *enumerations, uint64_t value)
+{
+	struct enumerator *entry = enumerations__lookup_entry_from_value(enumerations, value);
+
+	return entry ? enumerator__name(entry) : NULL;
+}
+
+static int64_t enumeration__lookup_enumerator(struct type *enumeration, const char *enumerator)
+{
+	struct enumerator *entry;
 
 	type__for_each_enumerator(enumeration, entry) {
 		const char *entry_name = enumerator__name(entry);
@@ -2007,116 +3809,561 @@ static int string__fprintf_value(char *instance, int _sizeof, FILE *fp)
 	return fprintf(fp, "\"%-.*s\"", _sizeof, instance);
 }
 
-static int array__fprintf_base_type_value(struct tag *tag, struct cu *cu, void *instance, int _sizeof, FILE *fp)
+/*
+ * Pretty printing a record used to walk the type tree for each one, looking up
+ * member types, following typedefs, computing bitfield masks, formatting the
+ * member names, etc. Since we print millions of records from ring buffer dumps
+ * and the like, flatten a type into a linear list of operations, once, and
+ * then just run it for each record.
+ */
+enum record_op_kind {
+	RECORD_OP__TEXT,
+	RECORD_OP__VALUE,
+	RECORD_OP__ENUM,
+	RECORD_OP__BITFIELD,
+	RECORD_OP__STRING,
+	RECORD_OP__BASE_TYPE_ARRAY,
+	RECORD_OP__HEXDUMP,
+};
+
+/*
+ * struct record_op - one step in printing a record
+ *
+ * @kind - how to print the value, RECORD_OP__TEXT for just the text
+ * @flexible - the value goes to the end of the record, i.e. @size is not used
+ * @bitfield_offset - bits to shift right after applying @mask for RECORD_OP__BITFIELD
+ * @text - offset in record_decoder->text of what to print before the value
+ * @text_len - length of @text
+ * @offset - of the value, from the start of the record
+ * @size - of the value
+ * @entry_size - size of each entry for RECORD_OP__BASE_TYPE_ARRAY
+ * @nr_entries - number of entries for RECORD_OP__BASE_TYPE_ARRAY, zero for up to @size
+ * @mask - to apply to the value for RECORD_OP__BITFIELD
+ * @enumerations - to look up the value for RECORD_OP__ENUM
+ * @name - offset in record_decoder->names of the member path, e.g. "a.b.c", zero if unnamed
+ */
+struct record_op {
+	uint8_t		 kind;
+	bool		 flexible;
+	uint8_t		 bitfield_offset;
+	uint32_t	 text;
+	uint32_t	 text_len;
+	uint32_t	 name;
+	uint32_t	 offset;
+	int32_t		 size;
+	uint32_t	 entry_size;
+	uint32_t	 nr_entries;
+	uint64_t	 mask;
+	struct list_head *enumerations;
+};
+
+/*
+ * struct record_decoder - the flattened plan to print a type
+ *
+ * @text - all the text to print between values: brackets, member names, etc
+ * @names - NUL terminated member paths, for --prettify_columns
+ * @pending_text - start in @text of what wasn't yet associated to an op
+ * @ops - what to print, in order
+ * @columns - where to write the records with --prettify_columns
+ */
+struct record_columns;
+
+struct record_decoder {
+	struct gobuffer	 text;
+	struct gobuffer	 names;
+	uint32_t	 pending_text;
+	uint32_t	 nr_ops;
+	uint32_t	 allocated_ops;
+	struct record_op *ops;
+	struct record_columns *columns;
+};
+
+static struct record_decoder *record_decoder__new(void)
 {
-	struct array_type *array = tag__array_type(tag);
-	struct tag *array_type = cu__type(cu, tag->type);
-	void *contents = instance;
+	struct record_decoder *decoder = zalloc(sizeof(*decoder));
 
-	if (array->dimensions != 1) {
-		// Support multi dimensional arrays later
-		return instance__fprintf_hexdump_value(instance, _sizeof, fp);
+	if (decoder) {
+		gobuffer__init(&decoder->text);
+		gobuffer__init(&decoder->names);
+		decoder->pending_text = gobuffer__size(&decoder->text);
 	}
 
-	if (tag__is_typedef(array_type))
-		array_type = tag__follow_typedef(array_type, cu);
+	return decoder;
+}
 
-	int i, printed = 0, sizeof_entry = base_type__size(array_type);
+static void record_decoder__delete(struct record_decoder *decoder)
+{
+	if (decoder == NULL)
+		return;
 
-	printed += fprintf(fp, "{ ");
+	__gobuffer__delete(&decoder->text);
+	__gobuffer__delete(&decoder->names);
+	zfree(&decoder->ops);
+	free(decoder);
+}
 
-	int nr_entries = array->nr_entries[0];
+static void type_caches__exit(struct type_caches *caches)
+{
+	if (caches->buckets == NULL)
+		return;
 
-	// Look for zero sized arrays
-	if (nr_entries == 0)
-		nr_entries = _sizeof / sizeof_entry;
+	for (uint32_t i = 0; i < (1U << caches->bits); ++i) {
+		struct type_cache *pos, *n;
 
-	for (i = 0; i < nr_entries; ++i) {
-		if (i > 0)
-			printed += fprintf(fp, ", ");
-		printed += base_type__fprintf_value(contents, sizeof_entry, fp);
-		contents += sizeof_entry;
+		list_for_each_entry_safe(pos, n, &caches->buckets[i], node) {
+			list_del(&pos->node);
+			record_decoder__delete(pos->decoder);
+			free(pos->enumerator_index);
+			free(pos);
+		}
 	}
 
-	return printed + fprintf(fp, " }");
+	zfree(&caches->buckets);
+	caches->nr_entries = 0;
 }
 
-static int array__fprintf_value(struct tag *tag, struct cu *cu, void *instance, int _sizeof, FILE *fp)
+static int record_decoder__add_text(struct record_decoder *decoder, const char *fmt, ...)
+{
+	char *text;
+	va_list args;
+
+	va_start(args, fmt);
+	int len = vasprintf(&text, fmt, args);
+	va_end(args);
+
+	if (len < 0)
+		return -ENOMEM;
+
+	int err = gobuffer__add(&decoder->text, text, len);
+
+	free(text);
+	return err < 0 ? err : 0;
+}
+
+static struct record_op *record_decoder__add_op(struct record_decoder *decoder, enum record_op_kind kind,
+						uint32_t offset, int size, bool flexible, const char *path)
+{
+	int name = 0;
+
+	if (path) {
+		name = gobuffer__add(&decoder->names, path, strlen(path) + 1);
+		if (name < 0)
+			return NULL;
+	}
+
+	if (decoder->nr_ops == decoder->allocated_ops) {
+		uint32_t allocated_ops = decoder->allocated_ops ? decoder->allocated_ops * 2 : 16;
+		struct record_op *ops = realloc(decoder->ops, allocated_ops * sizeof(*ops));
+
+		if (ops == NULL)
+			return NULL;
+
+		decoder->ops = ops;
+		decoder->allocated_ops = allocated_ops;
+	}
+
+	struct record_op *op = &decoder->ops[decoder->nr_ops++];
+	uint32_t text_end = gobuffer__size(&decoder->text);
+
+	memset(op, 0, sizeof(*op));
+	op->kind     = kind;
+	op->offset   = offset;
+	op->size     = size;
+	op->flexible = flexible;
+	op->text     = decoder->pending_text;
+	op->text_len = text_end - decoder->pending_text;
+	op->name     = name;
+
+	decoder->pending_text = text_end;
+	return op;
+}
+
+static int record_decoder__compile_array(struct record_decoder *decoder, struct tag *tag, struct cu *cu,
+					 uint32_t offset, int _sizeof, bool flexible, const char *path)
 {
 	struct tag *array_type = cu__type(cu, tag->type);
 	char type_name[1024];
+	struct record_op *op;
 
 	if (strcmp(tag__name(array_type, cu, type_name, sizeof(type_name), NULL), "char") == 0)
-		return string__fprintf_value(instance, _sizeof, fp);
+		return record_decoder__add_op(decoder, RECORD_OP__STRING, offset, _sizeof, flexible, path) ? 0 : -ENOMEM;
 
-	if (tag__is_base_type(array_type, cu))
-		return array__fprintf_base_type_value(tag, cu, instance, _sizeof, fp);
+	// Support multi dimensional arrays later
+	if (!tag__is_base_type(array_type, cu) || tag__array_type(tag)->dimensions != 1)
+		return record_decoder__add_op(decoder, RECORD_OP__HEXDUMP, offset, _sizeof, flexible, path) ? 0 : -ENOMEM;
 
-	return instance__fprintf_hexdump_value(instance, _sizeof, fp);
+	if (tag__is_typedef(array_type))
+		array_type = tag__follow_typedef(array_type, cu);
+
+	op = record_decoder__add_op(decoder, RECORD_OP__BASE_TYPE_ARRAY, offset, _sizeof, flexible, path);
+	if (op == NULL)
+		return -ENOMEM;
+
+	op->entry_size = base_type__size(array_type);
+	// Zero sized arrays will use the record size
+	op->nr_entries = tag__array_type(tag)->nr_entries[0];
+	return 0;
 }
 
-static int __class__fprintf_value(struct tag *tag, struct cu *cu, void *instance, int _sizeof, int indent, bool brackets, FILE *fp)
+/*
+ * @offset is where this class starts in the record, @flexible is for the
+ * outermost class, where a zero sized array at the end goes to the end of
+ * the record being printed, whose size is only known when printing it.
+ * @path is the member path to this class, NULL for the outermost one.
+ */
+static int __record_decoder__compile_class(struct record_decoder *decoder, struct tag *tag, struct cu *cu,
+					   uint32_t offset, int _sizeof, bool flexible, int indent, bool brackets,
+					   const char *path)
 {
 	struct type *type = tag__type(tag);
 	struct class_member *member;
-	int printed = 0;
+	struct record_op *op;
+	int err;
 
-	if (brackets)
-		printed += fprintf(fp, "{");
+	if (brackets && record_decoder__add_text(decoder, "{"))
+		return -ENOMEM;
 
 	type__for_each_member(type, member) {
-		void *member_contents = instance + member->byte_offset;
+		uint32_t member_offset = offset + member->byte_offset;
 		struct tag *member_type = cu__type(cu, member->tag.type);
 		const char *name = class_member__name(member);
+		char member_path[1024];
+		int len;
+
+		if (name) {
+			if (record_decoder__add_text(decoder, "\n%.*s\t.%s = ", indent, tabs, name))
+				return -ENOMEM;
+			len = snprintf(member_path, sizeof(member_path), "%s%s%s", path ?: "", path ? "." : "", name);
+		} else if (member_type && (tag__is_struct(member_type) || tag__is_union(member_type))) {
+			// Members of unnamed structs and unions are accessed as members of the enclosing one
+			len = snprintf(member_path, sizeof(member_path), "%s", path ?: "");
+		} else {
+			// Padding, i.e. unnamed bitfields, printed but with no path, so no --prettify_columns column
+			member_path[0] = '\0';
+			len = 0;
+		}
 
-		if (name)
-			printed += fprintf(fp, "\n%.*s\t.%s = ", indent, tabs, name);
+		if (len >= (int)sizeof(member_path)) {
+			fprintf(stderr, "pahole: the path for '%s' in '%s' is too long\n", name ?: "<unnamed>", path ?: "");
+			return -ENAMETOOLONG;
+		}
+
+		const char *mpath = member_path[0] ? member_path : NULL;
 
 		if (member == type->type_member && !list_empty(&type->type_enum)) {
-			printed += base_type__fprintf_enum_value(member_contents, member->byte_size, &type->type_enum, fp);
+			op = record_decoder__add_op(decoder, RECORD_OP__ENUM, member_offset, member->byte_size, false, mpath);
+			if (op == NULL)
+				return -ENOMEM;
+			op->enumerations = &type->type_enum;
+			// So that running the decoder doesn't change anything, see prettify_records__fprintf()
+			if (enumerations__prepare_lookups(op->enumerations))
+				return -ENOMEM;
 		} else if (member->bitfield_size) {
-			printed += class_member__fprintf_bitfield_value(member, member_contents, fp);
+			int bits = member->bitfield_size;
+			uint64_t mask = 0;
+
+			while (bits) {
+				mask |= 1;
+				if (--bits)
+					mask <<= 1;
+			}
+
+			op = record_decoder__add_op(decoder, RECORD_OP__BITFIELD, member_offset, member->byte_size, false, mpath);
+			if (op == NULL)
+				return -ENOMEM;
+			op->mask = mask << member->bitfield_offset;
+			op->bitfield_offset = member->bitfield_offset;
 		} else if (tag__is_base_type(member_type, cu)) {
-			printed += base_type__fprintf_value(member_contents, member->byte_size, fp);
+			if (record_decoder__add_op(decoder, RECORD_OP__VALUE, member_offset, member->byte_size, false, mpath) == NULL)
+				return -ENOMEM;
 		} else if (tag__is_array(member_type, cu)) {
 			int sizeof_member = member->byte_size;
+			bool flexible_member = false;
 
 			// zero sized array, at the end of the struct?
-			if (sizeof_member == 0 && list_is_last(&member->tag.node, &type->namespace.tags))
+			if (sizeof_member == 0 && list_is_last(&member->tag.node, &type->namespace.tags)) {
 				sizeof_member = _sizeof - member->byte_offset;
-			printed += array__fprintf_value(member_type, cu, member_contents, sizeof_member, fp);
+				flexible_member = flexible;
+			}
+			err = record_decoder__compile_array(decoder, member_type, cu, member_offset, sizeof_member, flexible_member, mpath);
+			if (err)
+				return err;
 		} else if (tag__is_struct(member_type)) {
-			printed += __class__fprintf_value(member_type, cu, member_contents, member->byte_size, indent + 1, true, fp);
+			err = __record_decoder__compile_class(decoder, member_type, cu, member_offset, member->byte_size,
+							      false, indent + 1, true, mpath);
+			if (err)
+				return err;
 		} else if (tag__is_union(member_type)) {
-			printed += __class__fprintf_value(member_type, cu, member_contents, member->byte_size, indent + (name ? 1 : 0), !!name, fp);
+			err = __record_decoder__compile_class(decoder, member_type, cu, member_offset, member->byte_size,
+							      false, indent + (name ? 1 : 0), !!name, mpath);
+			if (err)
+				return err;
 			if (!name)
 				continue;
 		} else {
-			printed += instance__fprintf_hexdump_value(member_contents, member->byte_size, fp);
+			if (record_decoder__add_op(decoder, RECORD_OP__HEXDUMP, member_offset, member->byte_size, false, mpath) == NULL)
+				return -ENOMEM;
 		}
 
-		fputc(',', fp);
-		++printed;
+		if (record_decoder__add_text(decoder, ","))
+			return -ENOMEM;
+	}
+
+	if (brackets && record_decoder__add_text(decoder, "\n%.*s}", indent, tabs))
+		return -ENOMEM;
+
+	return 0;
+}
+
+static struct record_decoder *class__compile_record_decoder(struct tag *tag, struct cu *cu)
+{
+	struct record_decoder *decoder = record_decoder__new();
+
+	if (decoder == NULL)
+		return NULL;
+
+	if (__record_decoder__compile_class(decoder, tag, cu, 0, 0, true, 0, true, NULL) ||
+	    // Whatever text is left, closing brackets, etc
+	    record_decoder__add_op(decoder, RECORD_OP__TEXT, 0, 0, false, NULL) == NULL) {
+		record_decoder__delete(decoder);
+		return NULL;
+	}
+
+	return decoder;
+}
+
+static int record_decoder__fprintf_base_type_array(const struct record_op *op, void *contents, int _sizeof, FILE *fp)
+{
+	int i, printed = fprintf(fp, "{ ");
+	int nr_entries = op->nr_entries ?: _sizeof / (int)op->entry_size;
+
+	for (i = 0; i < nr_entries; ++i) {
+		if (i > 0)
+			printed += fprintf(fp, ", ");
+		printed += base_type__fprintf_value(contents, op->entry_size, fp);
+		contents += op->entry_size;
+	}
+
+	return printed + fprintf(fp, " }");
+}
+
+static int record_decoder__fprintf(const struct record_decoder *decoder, void *instance, int _sizeof, FILE *fp)
+{
+	const char *text = gobuffer__entries(&decoder->text);
+	int printed = 0;
+
+	for (uint32_t i = 0; i < decoder->nr_ops; ++i) {
+		const struct record_op *op = &decoder->ops[i];
+		void *contents = instance + op->offset;
+		int size = op->flexible ? _sizeof - (int)op->offset : op->size;
+
+		if (op->text_len)
+			printed += fwrite(text + op->text, 1, op->text_len, fp);
+
+		switch (op->kind) {
+		case RECORD_OP__TEXT:
+			break;
+		case RECORD_OP__VALUE:
+			printed += base_type__fprintf_value(contents, size, fp);
+			break;
+		case RECORD_OP__ENUM:
+			printed += base_type__fprintf_enum_value(contents, size, op->enumerations, fp);
+			break;
+		case RECORD_OP__BITFIELD:
+			printed += fprintf__value(fp, (base_type__value(contents, size) & op->mask) >> op->bitfield_offset);
+			break;
+		case RECORD_OP__STRING:
+			printed += string__fprintf_value(contents, size, fp);
+			break;
+		case RECORD_OP__BASE_TYPE_ARRAY:
+			printed += record_decoder__fprintf_base_type_array(op, contents, size, fp);
+			break;
+		case RECORD_OP__HEXDUMP:
+			printed += instance__fprintf_hexdump_value(contents, size, fp);
+			break;
+		}
 	}
 
-	if (brackets)
-		printed += fprintf(fp, "\n%.*s}", indent, tabs);
 	return printed;
 }
 
-static int class__fprintf_value(struct tag *tag, struct cu *cu, void *instance, int _sizeof, int indent, FILE *fp)
+// Compiled on first use, then reused for all the records of this type
+static struct record_decoder *type__record_decoder(struct tag *tag, struct cu *cu)
 {
-	return __class__fprintf_value(tag, cu, instance, _sizeof, indent, true, fp);
+	struct type_cache *cache = type_caches__findnew(&type_caches, tag__type(tag));
+
+	if (cache == NULL)
+		return NULL;
+
+	if (cache->decoder == NULL)
+		cache->decoder = class__compile_record_decoder(tag, cu);
+
+	return cache->decoder;
 }
 
 static int tag__fprintf_value(struct tag *type, struct cu *cu, void *instance, int _sizeof, FILE *fp)
 {
-	if (tag__is_struct(type))
-		return class__fprintf_value(type, cu, instance, _sizeof, 0, fp);
+	if (tag__is_struct(type)) {
+		struct record_decoder *decoder = type__record_decoder(type, cu);
+
+		if (decoder == NULL)
+			return -ENOMEM;
+
+		return record_decoder__fprintf(decoder, instance, _sizeof, fp);
+	}
 
 	return instance__fprintf_hexdump_value(instance, _sizeof, fp);
 }
 
+/*
+ * struct prettify_input - the --prettify input
+ *
+ * For regular files the whole file is mmap'ed and the records are decoded in
+ * place, seeking is just setting @offset, in any direction. Otherwise, such as
+ * for stdin, the records are read into a buffer and seeking is done with
+ * fseeko() when possible, say stdin redirected from a file, or by reading and
+ * discarding for pipes, so only forward.
+ *
+ * @fp - stdio stream, when not mmap'ed
+ * @map - the mmap'ed file contents
+ * @size - the size of @map
+ * @offset - current position, from the start of the input
+ * @seekable - @fp can be fseeko()'ed
+ */
+struct prettify_input {
+	FILE	 *fp;
+	uint8_t	 *map;
+	size_t	 size;
+	uint64_t offset;
+	bool	 seekable;
+};
+
+static struct prettify_input *prettify_input__new(const char *filename)
+{
+	struct prettify_input *input = zalloc(sizeof(*input));
+
+	if (input == NULL)
+		return NULL;
+
+	if (strcmp(filename, "-") == 0) {
+		input->fp = stdin;
+		input->seekable = fseeko(stdin, 0, SEEK_CUR) == 0;
+		return input;
+	}
+
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0)
+		goto out_free;
+
+	struct stat st;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			input->map  = map;
+			input->size = st.st_size;
+			close(fd);
+			return input;
+		}
+	}
+
+	// Not a regular file (a FIFO, say) or couldn't mmap it, use stdio
+	input->fp = fdopen(fd, "r");
+	if (input->fp == NULL) {
+		close(fd);
+		goto out_free;
+	}
+
+	input->seekable = fseeko(input->fp, 0, SEEK_CUR) == 0;
+
+	return input;
+out_free:
+	free(input);
+	return NULL;
+}
+
+static void prettify_input__delete(struct prettify_input *input)
+{
+	if (input == NULL)
+		return;
+
+	if (input->map)
+		munmap(input->map, input->size);
+	else if (input->fp && input->fp != stdin)
+		fclose(input->fp);
+
+	free(input);
+}
+
+static uint64_t prettify_input__offset(const struct prettify_input *input)
+{
+	return input->offset;
+}
+
+static bool prettify_input__is_mmaped(const struct prettify_input *input)
+{
+	return input->map != NULL;
+}
+
+static bool prettify_input__can_go_back(const struct prettify_input *input)
+{
+	return input->map != NULL || input->seekable;
+}
+
+/*
+ * Returns a pointer to the next @len bytes, in the mmap'ed area or, when using
+ * stdio, read into @bf, NULL if there isn't that many bytes left.
+ */
+static void *prettify_input__read(struct prettify_input *input, void *bf, size_t len)
+{
+	void *record;
+
+	if (input->map) {
+		if (input->offset + len > input->size)
+			return NULL;
+		record = input->map + input->offset;
+	} else {
+		if (fread(bf, len, 1, input->fp) != 1)
+			return NULL;
+		record = bf;
+	}
+
+	input->offset += len;
+	return record;
+}
+
+// Like prettify_input__read() but always copies to @bf
+static int prettify_input__read_into(struct prettify_input *input, void *bf, size_t len)
+{
+	void *record = prettify_input__read(input, bf, len);
+
+	if (record == NULL)
+		return -1;
+
+	if (record != bf)
+		memcpy(bf, record, len);
+
+	return 0;
+}
+
+// Tell the kernel we'll need the next @len bytes, i.e. exactly what --count will read
+static void prettify_input__will_need(struct prettify_input *input, uint64_t len)
+{
+	if (input->map == NULL || input->offset >= input->size)
+		return;
+
+	if (len > input->size - input->offset)
+		len = input->size - input->offset;
+
+	uint64_t page_size = sysconf(_SC_PAGESIZE);
+	uint64_t start = input->offset & ~(page_size - 1);
+
+	madvise(input->map + start, input->offset + len - start, MADV_WILLNEED);
+}
+
 static int pipe_seek(FILE *fp, off_t offset)
 {
 	char bf[4096];
@@ -2136,6 +4383,31 @@ static int pipe_seek(FILE *fp, off_t offset)
 	return offset == 0 ? 0 : -1;
 }
 
+// Go to @offset from the start of the input, only forward if it is a pipe
+static int prettify_input__seek(struct prettify_input *input, uint64_t offset)
+{
+	if (input->map) {
+		if (offset > input->size)
+			return -1;
+	} else if (input->seekable) {
+		if (fseeko(input->fp, (off_t)(offset - input->offset), SEEK_CUR) < 0)
+			return -1;
+	} else {
+		if (offset < input->offset)
+			return -1;
+		if (offset > input->offset && pipe_seek(input->fp, offset - input->offset) < 0)
+			return -1;
+	}
+
+	input->offset = offset;
+	return 0;
+}
+
+static bool tag__has_sizeof_member(struct tag *tag)
+{
+	return tag__is_struct(tag) && tag__type(tag)->sizeof_member != NULL;
+}
+
 static uint64_t tag__real_sizeof(struct tag *tag, int _sizeof, void *instance)
 {
 	if (tag__is_struct(tag)) {
@@ -2151,32 +4423,102 @@ static uint64_t tag__real_sizeof(struct tag *tag, int _sizeof, void *instance)
 }
 
 /*
- * Classes should start close to where they are needed, then moved elsewhere, remember:
- * "Premature optimization is the root of all evil" (Knuth till unproven).
+ * Filters are compiled into a flat list of instructions, each loading a member
+ * value from the record, masking, shifting it and comparing it with a constant
+ * or range, so that uninteresting records get discarded before any formatting
+ * work is done.
  *
- * So far just the '==' operator is supported, so just a struct member + a value are
- * needed, no, strings are not supported so far.
+ * The expression is a '||' of '&&' sequences of comparisons, i.e. '&&' binds
+ * tighter than '||', no parens, e.g.:
  *
- * If the class member is the 'type=' and we have a 'type_enum=' in place, then we will
- * resolve that at parse time and convert that to an uint64_t and it'll do the trick.
+ *   type==PERF_RECORD_MMAP2||type==PERF_RECORD_COMM&&size>=32
+ *
+ * The operators are ==, !=, <, <=, > and >=, a range is written as
+ * 'member==FIRST..LAST', inclusive, or with != for values outside it. The
+ * constants can be numbers or enumerator names, when the member is the 'type='
+ * one and a 'type_enum=' is in place or when the member is itself an enum.
+ */
+enum class_member_filter_op {
+	FILTER_OP__EQ,
+	FILTER_OP__NE,
+	FILTER_OP__LT,
+	FILTER_OP__LE,
+	FILTER_OP__GT,
+	FILTER_OP__GE,
+	FILTER_OP__IN_RANGE,
+	FILTER_OP__NOT_IN_RANGE,
+};
+
+/*
+ * struct class_member_filter_insn - compare a member value
  *
- * More to come, when needed.
+ * @offset - of the member in the record
+ * @size - of the member
+ * @op - enum class_member_filter_op
+ * @shift - right shift after applying @mask, for bitfields
+ * @last - ends a '&&' sequence
+ * @mask - to apply to the loaded value
+ * @bias - xor'ed to the value, to compare signed values as unsigned ones
+ * @right - the constant, already biased, first in the range
+ * @right_last - last in the range, already biased
  */
+struct class_member_filter_insn {
+	uint32_t offset;
+	uint8_t	 size;
+	uint8_t	 op;
+	uint8_t	 shift;
+	bool	 last;
+	uint64_t mask;
+	uint64_t bias;
+	uint64_t right;
+	uint64_t right_last;
+};
+
 struct class_member_filter {
-	struct class_member *left;
-	uint64_t	    right;
+	uint16_t			nr_insns;
+	struct class_member_filter_insn insns[];
 };
 
+static bool class_member_filter_insn__match(const struct class_member_filter_insn *insn, void *instance)
+{
+	uint64_t value = ((base_type__value(instance + insn->offset, insn->size) & insn->mask) >> insn->shift) ^ insn->bias;
+
+	switch (insn->op) {
+	case FILTER_OP__EQ:	      return value == insn->right;
+	case FILTER_OP__NE:	      return value != insn->right;
+	case FILTER_OP__LT:	      return value <  insn->right;
+	case FILTER_OP__LE:	      return value <= insn->right;
+	case FILTER_OP__GT:	      return value >  insn->right;
+	case FILTER_OP__GE:	      return value >= insn->right;
+	case FILTER_OP__IN_RANGE:     return value >= insn->right && value <= insn->right_last;
+	case FILTER_OP__NOT_IN_RANGE: return value <  insn->right || value >  insn->right_last;
+	}
+
+	return false;
+}
+
+// Returns true if the record should be filtered out
 static bool type__filter_value(struct tag *tag, void *instance)
 {
 	// this has to be a type, otherwise we'd not have a type->filter
-	struct type *type = tag__type(tag);
-	struct class_member_filter *filter = type->filter;
-	struct class_member *member = filter->left;
-	uint64_t value = base_type__value(instance + member->byte_offset, member->byte_size);
+	const struct class_member_filter *filter = tag__type(tag)->filter;
+	bool match = true;
+
+	for (int i = 0; i < filter->nr_insns; ++i) {
+		const struct class_member_filter_insn *insn = &filter->insns[i];
 
-	// Only operator supported so far is '=='
-	return value != filter->right;
+		// Once something in a '&&' sequence doesn't match, skip to the next '||'
+		if (match)
+			match = class_member_filter_insn__match(insn, instance);
+
+		if (insn->last) {
+			if (match)
+				return false;
+			match = true;
+		}
+	}
+
+	return true;
 }
 
 static struct tag *tag__real_type(struct tag *tag, struct cu **cup, void *instance)
@@ -2299,49 +4641,480 @@ out_free_member_name:
 
 	struct tag *member_type = cu__type(cu, member->tag.type);
 
-	if (!tag__is_base_type(member_type, cu))
-		return -1;
+	if (!tag__is_base_type(member_type, cu))
+		return -1;
+
+	return base_type__value(&instance->instance[byte_offset], member->byte_size);
+}
+
+static int64_t type__instance_read_once(struct type_instance *instance, struct prettify_input *input)
+{
+ 	if (!instance || instance->read_already)
+		return 0;
+
+ 	instance->read_already = true;
+
+	return prettify_input__read_into(input, instance->instance, instance->type->size) ? -1 : (int64_t)instance->type->size;
+}
+
+/*
+ * struct prototype - split arguments to a type
+ *
+ * @name - type name
+ * @type - name of the member containing a type id
+ * @type_enum - translate @type into a enum entry/string
+ * @type_enum_resolved - if this was already resolved, i.e. if the enums were find in some CU
+ * @size - the member with the size for variable sized records
+ * @filter - filter expression using record contents and values or enum entries
+ * @range - from where to get seek_bytes and size_bytes where to pretty print this specific class
+ */
+struct prototype {
+	struct list_head node;
+	struct tag	 *class;
+	struct cu	 *cu;
+	const char *type,
+		   *type_enum,
+		   *size,
+		   *range;
+	char	   *filter;
+	uint16_t   nr_args;
+	bool	   type_enum_resolved;
+	char name[0];
+
+};
+
+/*
+ * struct prettify_record - a record to pretty print
+ *
+ * @offset - in the input
+ * @size - the real size of the record, from the sizeof= member, if any
+ * @type - the type to print it as, from the type= member, if any
+ * @cu - where @type is
+ */
+struct prettify_record {
+	uint64_t   offset;
+	int	   size;
+	struct tag *type;
+	struct cu  *cu;
+};
+
+/*
+ * struct record_columns - --prettify_columns output for a type
+ *
+ * Instead of pretty printing, write each flattened member of the records of a
+ * type to its own file, named after the member path plus a ".col" suffix, e.g.
+ * "header.type.col", so that they never clash with the "schema" file, in a
+ * directory named after the type. Each has a fixed width value per record, in
+ * the byte order of the input, bitfields are extracted into 64-bit values. A
+ * "schema" text file describes the columns and the enumerations:
+ *
+ *   column PATH KIND WIDTH OFFSET [ENTRY_WIDTH]
+ *   enum PATH VALUE NAME
+ *   records NR_RECORDS
+ *
+ * Zero sized arrays at the end of the record, being variable sized, are not
+ * written.
+ *
+ * @decoder - whose ops are the columns
+ * @schema - the schema file
+ * @nr_records - written so far
+ * @columns - one per @decoder op, NULL for the ones not written
+ */
+struct record_columns {
+	struct list_head      node;
+	struct record_decoder *decoder;
+	FILE		      *schema;
+	uint64_t	      nr_records;
+	FILE		      *columns[];
+};
+
+static LIST_HEAD(record_columns__list);
+
+static const char *record_op_kind__column_names[] = {
+	[RECORD_OP__VALUE]	     = "int",
+	[RECORD_OP__ENUM]	     = "enum",
+	[RECORD_OP__BITFIELD]	     = "bitfield",
+	[RECORD_OP__STRING]	     = "string",
+	[RECORD_OP__BASE_TYPE_ARRAY] = "array",
+	[RECORD_OP__HEXDUMP]	     = "bytes",
+};
+
+static int record_op__column_width(const struct record_op *op)
+{
+	if (op->kind == RECORD_OP__TEXT || op->name == 0 || op->flexible)
+		return 0;
+
+	if (op->kind == RECORD_OP__BITFIELD)
+		return sizeof(uint64_t);
+
+	return op->size > 0 ? op->size : 0;
+}
+
+static int record_columns__close(struct record_columns *columns)
+{
+	int err = 0;
+
+	for (uint32_t i = 0; i < columns->decoder->nr_ops; ++i) {
+		if (columns->columns[i] && fclose(columns->columns[i]))
+			err = -errno;
+	}
+
+	if (columns->schema) {
+		fprintf(columns->schema, "records %" PRIu64 "\n", columns->nr_records);
+		if (fclose(columns->schema))
+			err = -errno;
+	}
+
+	columns->decoder->columns = NULL;
+	free(columns);
+	return err;
+}
+
+static int record_columns__close_all(void)
+{
+	struct record_columns *pos, *n;
+	int err = 0;
+
+	list_for_each_entry_safe(pos, n, &record_columns__list, node) {
+		list_del(&pos->node);
+		if (record_columns__close(pos))
+			err = -1;
+	}
+
+	if (err)
+		fprintf(stderr, "pahole: error writing the --prettify_columns=%s files\n", prettify_columns_dir);
+
+	return err;
+}
+
+static void record_columns__write_enumerations(struct record_columns *columns, const char *path,
+					       struct list_head *enumerations)
+{
+	struct tag_cu_node *pos;
+
+	list_for_each_entry(pos, enumerations, node) {
+		struct enumerator *entry;
+
+		type__for_each_enumerator(tag__type(pos->tc.tag), entry)
+			fprintf(columns->schema, "enum %s %u %s\n", path, entry->value, enumerator__name(entry));
+	}
+}
+
+/*
+ * Paths are unique in C, as members of unnamed structs and unions have to have
+ * different names than the ones in the enclosing type, but not in C++, where a
+ * member may have the same name as one in a base class.
+ */
+static const struct record_op *record_decoder__find_column(const struct record_decoder *decoder,
+							   uint32_t nr_ops, const char *path)
+{
+	for (uint32_t i = 0; i < nr_ops; ++i) {
+		const struct record_op *op = &decoder->ops[i];
+
+		if (record_op__column_width(op) != 0 && strcmp(gobuffer__ptr(&decoder->names, op->name), path) == 0)
+			return op;
+	}
+
+	return NULL;
+}
+
+static struct record_columns *record_columns__new(struct record_decoder *decoder, struct tag *type)
+{
+	const char *type_name = type__name(tag__type(type));
+	struct record_columns *columns;
+	char *dir = NULL, *filename;
+
+	if (type_name == NULL) {
+		fprintf(stderr, "pahole: --prettify_columns needs a named type\n");
+		return NULL;
+	}
+
+	columns = zalloc(sizeof(*columns) + decoder->nr_ops * sizeof(columns->columns[0]));
+	if (columns == NULL)
+		return NULL;
+
+	columns->decoder = decoder;
+
+	if ((mkdir(prettify_columns_dir, 0755) && errno != EEXIST) ||
+	    asprintf(&dir, "%s/%s", prettify_columns_dir, type_name) < 0 ||
+	    (mkdir(dir, 0755) && errno != EEXIST))
+		goto out_err;
+
+	if (asprintf(&filename, "%s/schema", dir) < 0)
+		goto out_err;
+
+	columns->schema = fopen(filename, "w");
+	free(filename);
+	if (columns->schema == NULL)
+		goto out_err;
+
+	for (uint32_t i = 0; i < decoder->nr_ops; ++i) {
+		const struct record_op *op = &decoder->ops[i];
+		int width = record_op__column_width(op);
+
+		if (width == 0)
+			continue;
+
+		const char *path = gobuffer__ptr(&decoder->names, op->name);
+
+		if (path == NULL)
+			goto out_err;
+
+		if (record_decoder__find_column(decoder, i, path)) {
+			fprintf(stderr, "pahole: more than one '%s' member in '%s'\n", path, type_name);
+			goto out_err;
+		}
+
+		if (asprintf(&filename, "%s/%s.col", dir, path) < 0)
+			goto out_err;
+
+		columns->columns[i] = fopen(filename, "w");
+		if (columns->columns[i] == NULL) {
+			fprintf(stderr, "pahole: couldn't create '%s': %s\n", filename, strerror(errno));
+			free(filename);
+			goto out_err;
+		}
+		free(filename);
+
+		fprintf(columns->schema, "column %s %s %d %u", path, record_op_kind__column_names[op->kind], width, op->offset);
+		if (op->kind == RECORD_OP__BASE_TYPE_ARRAY)
+			fprintf(columns->schema, " %u", op->entry_size);
+		fputc('\n', columns->schema);
+
+		if (op->kind == RECORD_OP__ENUM)
+			record_columns__write_enumerations(columns, path, op->enumerations);
+	}
+
+	free(dir);
+	list_add_tail(&columns->node, &record_columns__list);
+	decoder->columns = columns;
+	return columns;
+out_err:
+	fprintf(stderr, "pahole: couldn't create the --prettify_columns files for '%s' in '%s'\n",
+		type_name, dir ?: prettify_columns_dir);
+	free(dir);
+	record_columns__close(columns);
+	return NULL;
+}
+
+static int record_columns__write(struct record_columns *columns, void *instance)
+{
+	const struct record_decoder *decoder = columns->decoder;
+
+	for (uint32_t i = 0; i < decoder->nr_ops; ++i) {
+		const struct record_op *op = &decoder->ops[i];
+		FILE *fp = columns->columns[i];
+
+		if (fp == NULL)
+			continue;
+
+		if (op->kind == RECORD_OP__BITFIELD) {
+			uint64_t value = (base_type__value(instance + op->offset, op->size) & op->mask) >> op->bitfield_offset;
+
+			if (fwrite(&value, sizeof(value), 1, fp) != 1)
+				return -1;
+		} else if (fwrite(instance + op->offset, op->size, 1, fp) != 1) {
+			return -1;
+		}
+	}
+
+	++columns->nr_records;
+	return 0;
+}
+
+static int prettify_record__write_columns(const struct prettify_record *record, void *instance)
+{
+	if (!tag__is_struct(record->type)) {
+		fprintf(stderr, "pahole: --prettify_columns only supports struct and class types\n");
+		return -1;
+	}
+
+	struct record_decoder *decoder = type__record_decoder(record->type, record->cu);
+
+	if (decoder == NULL) {
+		fprintf(stderr, "pahole: not enough memory to pretty print '%s'\n", type__name(tag__type(record->type)));
+		return -1;
+	}
+
+	if (decoder->columns == NULL && record_columns__new(decoder, record->type) == NULL)
+		return -1;
+
+	if (record_columns__write(decoder->columns, instance)) {
+		fprintf(stderr, "pahole: error writing the --prettify_columns=%s files\n", prettify_columns_dir);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int prettify_record__fprintf(const struct prettify_record *record, void *instance,
+				    struct tag *type, int _sizeof, FILE *output)
+{
+	int printed = 0;
+
+	if (prettify_columns_dir)
+		return prettify_record__write_columns(record, instance);
+
+	if (global_verbose) {
+		printed += fprintf(output, "// type=%s, offset=%#" PRIx64 ", sizeof=%d", type__name(tag__type(type)), record->offset, _sizeof);
+		if (record->size != _sizeof)
+			printed += fprintf(output, ", real_sizeof=%d\n", record->size);
+		else
+			printed += fprintf(output, "\n");
+	}
+
+	int printed_value = tag__fprintf_value(record->type, record->cu, instance, record->size, output);
+
+	if (printed_value < 0) {
+		fprintf(stderr, "pahole: not enough memory to pretty print '%s'\n", type__name(tag__type(record->type)));
+		return -1;
+	}
+
+	return printed + printed_value + fprintf(output, ",\n");
+}
+
+/*
+ * Variable sized records, with sizeof=, can only be found one after the other,
+ * but once we know where they are, in a mmap'ed input, the expensive part, the
+ * formatting, can be done in parallel, writing the output in the original order.
+ *
+ * So first do a quick pass collecting the offsets, sizes and types of the
+ * records that pass the filter=, --skip and --count, then split those in
+ * --jobs chunks, each formatted to a buffer by a thread.
+ */
+struct prettify_records {
+	struct prettify_record *entries;
+	uint32_t	       nr_entries;
+	uint32_t	       allocated_entries;
+};
+
+static int prettify_records__add(struct prettify_records *records, uint64_t offset, int size,
+				 struct tag *type, struct cu *cu)
+{
+	if (records->nr_entries == records->allocated_entries) {
+		uint32_t allocated_entries = records->allocated_entries ? records->allocated_entries * 2 : 1024;
+		struct prettify_record *entries = realloc(records->entries, allocated_entries * sizeof(*entries));
+
+		if (entries == NULL)
+			return -ENOMEM;
+
+		records->entries = entries;
+		records->allocated_entries = allocated_entries;
+	}
+
+	struct prettify_record *record = &records->entries[records->nr_entries++];
 
-	return base_type__value(&instance->instance[byte_offset], member->byte_size);
+	record->offset = offset;
+	record->size   = size;
+	record->type   = type;
+	record->cu     = cu;
+	return 0;
 }
 
-static int64_t type__instance_read_once(struct type_instance *instance, FILE *fp)
+struct prettify_records_chunk {
+	pthread_t		     thread;
+	bool			     threaded;
+	const struct prettify_record *first;
+	uint32_t		     nr_entries;
+	const uint8_t		     *map;
+	struct tag		     *type;
+	int			     _sizeof;
+	int			     printed;
+	char			     *bf;
+	size_t			     size;
+};
+
+static void *prettify_records_chunk__fprintf(void *arg)
 {
- 	if (!instance || instance->read_already)
-		return 0;
+	struct prettify_records_chunk *chunk = arg;
+	FILE *fp = open_memstream(&chunk->bf, &chunk->size);
 
- 	instance->read_already = true;
+	if (fp == NULL) {
+		chunk->printed = -1;
+		return NULL;
+	}
+
+	for (uint32_t i = 0; i < chunk->nr_entries; ++i) {
+		const struct prettify_record *record = &chunk->first[i];
+		int printed = prettify_record__fprintf(record, (void *)chunk->map + record->offset, chunk->type, chunk->_sizeof, fp);
+
+		if (printed < 0) {
+			chunk->printed = -1;
+			break;
+		}
+		chunk->printed += printed;
+	}
 
-	return fread(instance->instance, instance->type->size, 1, fp) != 1 ? -1 : (int64_t)instance->type->size;
+	fclose(fp);
+	return NULL;
 }
 
 /*
- * struct prototype - split arguments to a type
- *
- * @name - type name
- * @type - name of the member containing a type id
- * @type_enum - translate @type into a enum entry/string
- * @type_enum_resolved - if this was already resolved, i.e. if the enums were find in some CU
- * @size - the member with the size for variable sized records
- * @filter - filter expression using record contents and values or enum entries
- * @range - from where to get seek_bytes and size_bytes where to pretty print this specific class
+ * The types to print each record as were resolved and had their decoders built
+ * while collecting the records, so from here on nothing gets changed and the
+ * chunks can be printed in parallel.
  */
-struct prototype {
-	struct list_head node;
-	struct tag	 *class;
-	struct cu	 *cu;
-	const char *type,
-		   *type_enum,
-		   *size,
-		   *range;
-	char	   *filter;
-	uint16_t   nr_args;
-	bool	   type_enum_resolved;
-	char name[0];
+static int prettify_records__fprintf(struct prettify_records *records, const struct prettify_input *input,
+				     struct tag *type, int _sizeof, int nr_jobs, FILE *output)
+{
+	// Not worth the threads for just a few records
+	if ((uint32_t)nr_jobs > records->nr_entries / 256 + 1)
+		nr_jobs = records->nr_entries / 256 + 1;
 
-};
+	struct prettify_records_chunk *chunks = calloc(nr_jobs, sizeof(*chunks));
+
+	if (chunks == NULL)
+		return -ENOMEM;
+
+	uint32_t per_chunk = records->nr_entries / nr_jobs, first = 0;
+	int i, printed = 0;
+
+	for (i = 0; i < nr_jobs; ++i) {
+		struct prettify_records_chunk *chunk = &chunks[i];
+
+		chunk->first	  = &records->entries[first];
+		chunk->nr_entries = i == nr_jobs - 1 ? records->nr_entries - first : per_chunk;
+		chunk->map	  = input->map;
+		chunk->type	  = type;
+		chunk->_sizeof	  = _sizeof;
+		first += chunk->nr_entries;
+
+		// The first chunk is done by this thread, after starting the others
+		if (i == 0)
+			continue;
+
+		chunk->threaded = pthread_create(&chunk->thread, NULL, prettify_records_chunk__fprintf, chunk) == 0;
+		// Couldn't create a thread? Do it in this one then
+		if (!chunk->threaded)
+			prettify_records_chunk__fprintf(chunk);
+	}
+
+	prettify_records_chunk__fprintf(&chunks[0]);
+
+	for (i = 0; i < nr_jobs; ++i) {
+		struct prettify_records_chunk *chunk = &chunks[i];
+
+		if (chunk->threaded)
+			pthread_join(chunk->thread, NULL);
+
+		if (printed >= 0) {
+			if (chunk->printed < 0) {
+				printed = -1;
+			} else {
+				fwrite(chunk->bf, 1, chunk->size, output);
+				printed += chunk->printed;
+			}
+		}
+
+		free(chunk->bf);
+	}
+
+	free(chunks);
+	return printed;
+}
 
-static int prototype__stdio_fprintf_value(struct prototype *prototype, struct type_instance *header, FILE *input, FILE *output)
+static int prototype__stdio_fprintf_value(struct prototype *prototype, struct type_instance *header,
+					  struct prettify_input *input, FILE *output)
 {
 	struct tag *type = prototype->class;
 	struct cu *cu = prototype->cu;
@@ -2351,6 +5124,7 @@ static int prototype__stdio_fprintf_value(struct prototype *prototype, struct ty
 	uint64_t size_bytes = ULLONG_MAX;
 	uint32_t count = 0;
 	uint32_t skip = conf.skip;
+	struct prettify_records records = { .nr_entries = 0, };
 
 	if (instance == NULL)
 		return -ENOMEM;
@@ -2393,11 +5167,10 @@ static int prototype__stdio_fprintf_value(struct prototype *prototype, struct ty
 
 		free(member_name);
 
-		off_t total_read_bytes = ftell(input);
+		uint64_t total_read_bytes = prettify_input__offset(input);
 
-		// Since we're reading input, we need to account for what we already read
-		// FIXME: we now have a FILE pointer that _may_ be stdin, but not necessarily
-		if (seek_bytes < total_read_bytes) {
+		// When reading from a pipe we need to account for what we already read
+		if (seek_bytes < total_read_bytes && !prettify_input__can_go_back(input)) {
 			fprintf(stderr, "pahole: can't go back in input, already read %" PRIu64 " bytes, can't go to position %#" PRIx64 "\n",
 					total_read_bytes, seek_bytes);
 			return -ENOMEM;
@@ -2408,8 +5181,6 @@ static int prototype__stdio_fprintf_value(struct prototype *prototype, struct ty
 				range, seek_bytes);
 		}
 
-		seek_bytes -= total_read_bytes;
-
 		if (asprintf(&member_name, "%s.%s", range, "size") == -1) {
 			fprintf(stderr, "pahole: not enough memory for range=%s\n", range);
 			return -ENOMEM;
@@ -2432,7 +5203,7 @@ static int prototype__stdio_fprintf_value(struct prototype *prototype, struct ty
 
 		free(member_name);
 
-		if (pipe_seek(input, seek_bytes) < 0) {
+		if (prettify_input__seek(input, seek_bytes) < 0) {
 			int err = --errno;
 			fprintf(stderr, "Couldn't --seek_bytes %s (%" PRIu64 "\n", conf.seek_bytes, seek_bytes);
 			return err;
@@ -2474,13 +5245,8 @@ static int prototype__stdio_fprintf_value(struct prototype *prototype, struct ty
 			seek_bytes = strtol(conf.seek_bytes, NULL, 0);
 		}
 
-
-		if (header) {
-			// Since we're reading input, we need to account for already read header:
-			seek_bytes -= ftell(input);
-		}
-
-		if (pipe_seek(input, seek_bytes) < 0) {
+		// Offsets are from the start of the input, past the already read header, if any
+		if (prettify_input__seek(input, seek_bytes) < 0) {
 			int err = --errno;
 			fprintf(stderr, "Couldn't --seek_bytes %s (%" PRIu64 "\n", conf.seek_bytes, seek_bytes);
 			return err;
@@ -2515,24 +5281,60 @@ static int prototype__stdio_fprintf_value(struct prototype *prototype, struct ty
 do_read:
 {
 	uint64_t read_bytes = 0;
-	off_t record_offset = ftell(input);
+	uint64_t record_offset = prettify_input__offset(input);
+	void *record;
+	/*
+	 * With --jobs and a mmap'ed input just collect the records to print here,
+	 * then print them in parallel, see prettify_records__fprintf().
+	 */
+	bool parallel = conf_load.nr_jobs > 1 && prettify_input__is_mmaped(input) && !prettify_columns_dir;
+
+	// Fixed size records and no filter=? Then --skip and --count are just arithmetic
+	if (tag__type(type)->filter == NULL && !tag__has_sizeof_member(type)) {
+		if (skip) {
+			uint64_t skip_bytes = (uint64_t)skip * _sizeof;
+
+			// Past --size_bytes or past the end of the input? Nothing to print
+			if (skip_bytes >= size_bytes ||
+			    prettify_input__seek(input, prettify_input__offset(input) + skip_bytes) < 0)
+				goto out;
+
+			read_bytes    = skip_bytes;
+			record_offset = prettify_input__offset(input);
+			skip	      = 0;
+		}
+
+		if (conf.count) {
+			uint64_t count_bytes = (uint64_t)conf.count * _sizeof;
+
+			if (count_bytes > size_bytes - read_bytes)
+				count_bytes = size_bytes - read_bytes;
+
+			prettify_input__will_need(input, count_bytes);
+		}
+	}
 
-	while (fread(instance, _sizeof, 1, input) == 1) {
+	/*
+	 * When the input is mmap'ed 'record' points to it, no copying, otherwise
+	 * it is 'instance', where the record gets read into.
+	 */
+	while ((record = prettify_input__read(input, instance, _sizeof)) != NULL) {
 		// Read it from each record/instance
-		int real_sizeof = tag__real_sizeof(type, _sizeof, instance);
+		int real_sizeof = tag__real_sizeof(type, _sizeof, record);
 
 		if (real_sizeof > _sizeof) {
-			if (real_sizeof > max_sizeof) {
+			if (record == instance && real_sizeof > max_sizeof) {
 				void *new_instance = realloc(instance, real_sizeof);
 				if (!new_instance) {
 					fprintf(stderr, "Couldn't allocate space for a record, too big: %d bytes\n", real_sizeof);
 					printed = -1;
 					goto out;
 				}
-				instance = new_instance;
+				record = instance = new_instance;
 				max_sizeof = real_sizeof;
 			}
-			if (fread(instance + _sizeof, real_sizeof - _sizeof, 1, input) != 1) {
+			// Contiguous to the first part, be it in the mmap'ed area or in 'instance'
+			if (prettify_input__read(input, record + _sizeof, real_sizeof - _sizeof) == NULL) {
 				fprintf(stderr, "Couldn't read record: %d bytes\n", real_sizeof);
 				printed = -1;
 				goto out;
@@ -2541,7 +5343,7 @@ do_read:
 
 		read_bytes += real_sizeof;
 
-		if (tag__type(type)->filter && type__filter_value(type, instance))
+		if (tag__type(type)->filter && type__filter_value(type, record))
 			goto next_record;
 
 		if (skip) {
@@ -2593,20 +5395,34 @@ do_read:
 		 */
 
 		struct cu *real_type_cu = cu;
-		struct tag *real_type = tag__real_type(type, &real_type_cu, instance);
+		struct tag *real_type = tag__real_type(type, &real_type_cu, record);
 
 		if (real_type == NULL)
 			real_type = type;
 
-		if (global_verbose) {
-			printed += fprintf(output, "// type=%s, offset=%#" PRIx64 ", sizeof=%d", type__name(tag__type(type)), record_offset, _sizeof);
-			if (real_sizeof != _sizeof)
-				printed += fprintf(output, ", real_sizeof=%d\n", real_sizeof);
-			else
-				printed += fprintf(output, "\n");
+		if (parallel) {
+			// Build it now, so that the threads only use it
+			if ((tag__is_struct(real_type) && type__record_decoder(real_type, real_type_cu) == NULL) ||
+			    prettify_records__add(&records, record_offset, real_sizeof, real_type, real_type_cu)) {
+				fprintf(stderr, "pahole: not enough memory to index the records to pretty print\n");
+				printed = -1;
+				goto out;
+			}
+		} else {
+			struct prettify_record entry = {
+				.offset = record_offset,
+				.size	= real_sizeof,
+				.type	= real_type,
+				.cu	= real_type_cu,
+			};
+			int printed_record = prettify_record__fprintf(&entry, record, type, _sizeof, output);
+
+			if (printed_record < 0) {
+				printed = -1;
+				goto out;
+			}
+			printed += printed_record;
 		}
-		printed += tag__fprintf_value(real_type, real_type_cu, instance, real_sizeof, output);
-		printed += fprintf(output, ",\n");
 
 		if (conf.count && ++count == conf.count)
 			break;
@@ -2614,94 +5430,271 @@ next_record:
 		if (read_bytes >= size_bytes)
 			break;
 
-		record_offset = ftell(input);
+		record_offset = prettify_input__offset(input);
+	}
+
+	if (parallel) {
+		int printed_records = prettify_records__fprintf(&records, input, type, _sizeof, conf_load.nr_jobs, output);
+
+		printed = printed_records < 0 ? -1 : printed + printed_records;
 	}
 }
 out:
+	free(records.entries);
 	free(instance);
 	return printed;
 }
 
-static int class_member_filter__parse(struct class_member_filter *filter, struct type *type, char *sfilter)
+static char *filter__strim(char *s)
+{
+	while (isspace(*s))
+		++s;
+
+	char *end = s + strlen(s);
+
+	while (end > s && isspace(end[-1]))
+		*--end = '\0';
+
+	return s;
+}
+
+/*
+ * Constants have to fit in the @bits of the member, either as signed or, for
+ * the unsigned ones, also as unsigned, so that -1 can be used for all bits
+ * set, and are then masked to @bits, as the member value is, see
+ * class_member_filter_insn__parse(). For the signed ones it is left sign
+ * extended, as base_type__value() does with the member value.
+ */
+static int class_member_filter__fit_value(uint64_t *value, bool negative, int bits, bool is_signed)
+{
+	if (bits >= 64)
+		return is_signed && !negative && *value > INT64_MAX ? -ERANGE : 0;
+
+	const int64_t min = -(1LL << (bits - 1));
+	const uint64_t max = is_signed ? (1ULL << (bits - 1)) - 1 : (1ULL << bits) - 1;
+
+	if (negative ? (int64_t)*value < min : *value > max)
+		return -ERANGE;
+
+	if (!is_signed)
+		*value &= (1ULL << bits) - 1;
+
+	return 0;
+}
+
+static int class_member_filter__parse_value(struct type *type, struct class_member *member, struct tag *member_type,
+					    int bits, bool is_signed, const char *sfilter, const char *value,
+					    uint64_t *result)
 {
-	const char *member_name = sfilter;
-	char *sep = strstr(sfilter, "==");
+	bool negative = *value == '-';
+	char *endptr;
 
-	if (!sep) {
+	if (*value == '\0') {
 		if (global_verbose)
-			fprintf(stderr, "No supported operator ('==' so far) found in filter '%s'\n", sfilter);
-		return -1;
+			fprintf(stderr, "The '%s' member was asked without a value to filter '%s'\n", class_member__name(member), type__name(type));
+		return -1; // no value
 	}
 
-	char *value = sep + 2, *s = sep;
+	errno = 0;
+	*result = negative ? (uint64_t)strtoll(value, &endptr, 0) : strtoull(value, &endptr, 0);
 
-	while (isspace(*--s))
-		if (s == sfilter) {
+	if (endptr > value && *endptr == '\0') {
+		if (errno == ERANGE || class_member_filter__fit_value(result, negative, bits, is_signed)) {
 			if (global_verbose)
-				fprintf(stderr, "No left operand (struct field) found in filter '%s'\n", sfilter);
-			return -1; // nothing before ==
+				fprintf(stderr, "'%s' doesn't fit in the %d bits of the '%s' member in '%s'\n",
+					value, bits, class_member__name(member), sfilter);
+			return -1;
 		}
+		return 0;
+	}
 
-	char before = s[1];
-	s[1] = '\0';
+	int64_t enumerator_value = -1;
 
-	filter->left = type__find_member_by_name(type, member_name);
+	// If the filter member is the 'type=' one:
+	if (!list_empty(&type->type_enum) && type->type_member == member) {
+		enumerations__calc_prefix(&type->type_enum);
+		enumerator_value = enumerations__lookup_enumerator(&type->type_enum, value);
+	} else if (member_type && tag__is_enumeration(member_type)) {
+		enumerator_value = enumeration__lookup_enumerator(tag__type(member_type), value);
+	} else {
+		if (global_verbose)
+			fprintf(stderr, "Symbolic right operand in '%s' but no way to resolve it to a number (type= + type_enum= or an enum member so far)\n", sfilter);
+		return -1;
+	}
 
-	if (!filter->left) {
+	if (enumerator_value < 0) {
 		if (global_verbose)
-			fprintf(stderr, "The '%s' member wasn't found in '%s'\n", member_name, type__name(type));
-		s[1] = before;
+			fprintf(stderr, "Couldn't resolve right operand ('%s') in '%s' with the '%s' member enumerations\n",
+				value, sfilter, class_member__name(member));
 		return -1;
 	}
 
-	s[1] = before;
+	*result = enumerator_value;
 
-	while (isspace(*value))
-		if (*++value == '\0') {
-			if (global_verbose)
-				fprintf(stderr, "The '%s' member was asked without a value to filter '%s'\n", member_name, type__name(type));
-			return -1; // no value
-		}
+	if (class_member_filter__fit_value(result, false, bits, is_signed)) {
+		if (global_verbose)
+			fprintf(stderr, "'%s' (%" PRId64 ") doesn't fit in the %d bits of the '%s' member in '%s'\n",
+				value, enumerator_value, bits, class_member__name(member), sfilter);
+		return -1;
+	}
 
-	char *endptr;
-	filter->right = strtoll(value, &endptr, 0);
+	return 0;
+}
 
-	if (endptr > value && (*endptr == '\0' || isspace(*endptr)))
-		return 0;
+static int class_member_filter_insn__parse(struct class_member_filter_insn *insn, struct type *type,
+					   struct cu *cu, char *sfilter)
+{
+	char *member_name = sfilter, *op = strpbrk(sfilter, "=!<>");
 
-	// If t he filter member is the 'type=' one:
+	if (!op) {
+		if (global_verbose)
+			fprintf(stderr, "No supported operator (==, !=, <, <=, >, >=) found in filter '%s'\n", sfilter);
+		return -1;
+	}
 
-	if (list_empty(&type->type_enum) || type->type_member != filter->left) {
+	char *value = op + 1;
+
+	if (op[0] == '=' && op[1] == '=')
+		insn->op = FILTER_OP__EQ;
+	else if (op[0] == '!' && op[1] == '=')
+		insn->op = FILTER_OP__NE;
+	else if (op[0] == '<')
+		insn->op = op[1] == '=' ? FILTER_OP__LE : FILTER_OP__LT;
+	else if (op[0] == '>')
+		insn->op = op[1] == '=' ? FILTER_OP__GE : FILTER_OP__GT;
+	else {
 		if (global_verbose)
-			fprintf(stderr, "Symbolic right operand in '%s' but no way to resolve it to a number (type= + type_enum= so far)\n", sfilter);
+			fprintf(stderr, "Invalid operator in filter '%s'\n", sfilter);
 		return -1;
 	}
 
-	enumerations__calc_prefix(&type->type_enum);
+	if (op[1] == '=')
+		++value;
 
-	int64_t enumerator_value = enumerations__lookup_enumerator(&type->type_enum, value);
+	*op = '\0';
+	member_name = filter__strim(member_name);
+	value = filter__strim(value);
 
-	if (enumerator_value < 0) {
+	if (*member_name == '\0') {
+		if (global_verbose)
+			fprintf(stderr, "No left operand (struct field) found in filter '%s'\n", sfilter);
+		return -1; // nothing before the operator
+	}
+
+	struct class_member *member = type__find_member_by_name(type, member_name);
+
+	if (!member) {
+		if (global_verbose)
+			fprintf(stderr, "The '%s' member wasn't found in '%s'\n", member_name, type__name(type));
+		return -1;
+	}
+
+	struct tag *member_type = tag__strip_typedefs_and_modifiers(&member->tag, cu);
+
+	if (!member->bitfield_size &&
+	    (member_type == NULL || !(tag__is_base_type(member_type, cu) || tag__is_enumeration(member_type)) ||
+	     member->byte_size == 0 || member->byte_size > sizeof(uint64_t))) {
 		if (global_verbose)
-			fprintf(stderr, "Couldn't resolve right operand ('%s') in '%s' with the specified 'type=%s' and type_enum' \n",
-				value, sfilter, class_member__name(type->type_member));
+			fprintf(stderr, "The '%s' member in '%s' isn't an integer, can't be used in a filter\n", member_name, type__name(type));
 		return -1;
 	}
 
-	filter->right = enumerator_value;
+	insn->offset = member->byte_offset;
+	insn->size   = member->byte_size;
+
+	int bits = member->bitfield_size ?: insn->size * 8;
+	bool is_signed = false;
+
+	if (member->bitfield_size) {
+		insn->mask  = (member->bitfield_size < 64 ? (1ULL << member->bitfield_size) : 0) - 1;
+		insn->mask <<= member->bitfield_offset;
+		insn->shift = member->bitfield_offset;
+	} else {
+		insn->mask = insn->size < sizeof(uint64_t) ? (1ULL << (insn->size * 8)) - 1 : ~0ULL;
+		if (tag__is_base_type(member_type, cu) && tag__base_type(member_type)->is_signed) {
+			// base_type__value() sign extends it, flip the sign bit for unsigned comparisons
+			insn->mask = ~0ULL;
+			insn->bias = 1ULL << 63;
+			is_signed  = true;
+		}
+	}
+
+	char *range = strstr(value, "..");
+
+	if (range) {
+		if (insn->op != FILTER_OP__EQ && insn->op != FILTER_OP__NE) {
+			if (global_verbose)
+				fprintf(stderr, "Ranges can only be used with == and != in filter '%s'\n", sfilter);
+			return -1;
+		}
+
+		insn->op = insn->op == FILTER_OP__EQ ? FILTER_OP__IN_RANGE : FILTER_OP__NOT_IN_RANGE;
+		*range = '\0';
+		range = filter__strim(range + 2);
+		value = filter__strim(value);
+
+		if (class_member_filter__parse_value(type, member, member_type, bits, is_signed, sfilter, range,
+						     &insn->right_last))
+			return -1;
+		insn->right_last ^= insn->bias;
+	}
+
+	if (class_member_filter__parse_value(type, member, member_type, bits, is_signed, sfilter, value, &insn->right))
+		return -1;
 
+	insn->right ^= insn->bias;
 	return 0;
 }
 
-static struct class_member_filter *class_member_filter__new(struct type *type, char *sfilter)
+static struct class_member_filter *class_member_filter__new(struct type *type, struct cu *cu, const char *sfilter)
 {
-	struct class_member_filter *filter = malloc(sizeof(*filter));
+	char *expr = strdup(sfilter), *s;
+	int nr_insns = 1;
+
+	if (expr == NULL)
+		return NULL;
+
+	for (s = expr; (s = strpbrk(s, "&|")) != NULL; ++s) {
+		if (s[1] == s[0])
+			++nr_insns, ++s;
+	}
+
+	struct class_member_filter *filter = zalloc(sizeof(*filter) + nr_insns * sizeof(filter->insns[0]));
+
+	if (filter == NULL)
+		goto out_free_expr;
+
+	char *or = expr;
+
+	while (or) {
+		char *and = or;
+
+		or = strstr(or, "||");
+		if (or) {
+			*or = '\0';
+			or += 2;
+		}
+
+		while (and) {
+			char *cmp = and;
 
-	if (filter && class_member_filter__parse(filter, type, sfilter)) {
-		free(filter);
-		filter = NULL;
+			and = strstr(and, "&&");
+			if (and) {
+				*and = '\0';
+				and += 2;
+			}
+
+			if (class_member_filter_insn__parse(&filter->insns[filter->nr_insns++], type, cu, cmp)) {
+				zfree(&filter);
+				goto out_free_expr;
+			}
+		}
+
+		filter->insns[filter->nr_insns - 1].last = true;
 	}
 
+out_free_expr:
+	free(expr);
 	return filter;
 }
 
@@ -2922,6 +5915,7 @@ static struct type_instance *header;
 struct thread_data {
 	struct btf *btf;
 	struct btf_encoder *encoder;
+	struct structures_stats stats;
 };
 
 static int pahole_threads_prepare(struct conf_load *conf, int nr_threads, void **thr_data)
@@ -2954,12 +5948,27 @@ static int pahole_threads_collect(struct conf_load *conf, int nr_threads, void *
 				  int error)
 {
 	struct thread_data **threads = (struct thread_data **)thr_data;
+	LIST_HEAD(new_stats);
 	int i;
 	int err = 0;
 
+	// Write what was rendered by print_classes_ordered() for this file
+	cu_outputs__flush(stdout);
+
 	if (error)
 		goto out;
 
+	for (i = 0; i < nr_threads; i++) {
+		if (structures_stats__merge(&threads[i]->stats, &new_stats))
+			err = -ENOMEM;
+	}
+
+	if (structures_stats__add_new_entries(&new_stats, stdout) || err) {
+		fputs("pahole: insufficient memory for merging the per thread stats\n", stderr);
+		err = -ENOMEM;
+		goto out;
+	}
+
 	for (i = 0; i < nr_threads; i++) {
 		/*
 		 * Merge content of the btf instances of worker threads to the btf
@@ -2979,15 +5988,27 @@ out:
 	for (i = 0; i < nr_threads; i++) {
 		if (threads[i]->encoder && threads[i]->encoder != btf_encoder)
 			btf_encoder__delete(threads[i]->encoder);
+		structures_stats__exit(&threads[i]->stats);
 	}
 	free(threads[0]);
 
 	return err;
 }
 
-static enum load_steal_kind pahole_stealer(struct cu *cu,
-					   struct conf_load *conf_load,
-					   void *thr_data)
+/*
+ * Are the CUs being rendered with print_classes_ordered()? Then every CU has to
+ * go thru cu_outputs__add(), even the ones not printing anything.
+ */
+static bool pahole__ordered_output(void *thr_data)
+{
+	return thr_data && class_name == NULL && !btf_encode && !ctf_encode &&
+	       !structures_stats__per_thread() && stats_formatter != nr_methods_formatter &&
+	       !(sort_output && formatter == class_formatter) && !packable_report;
+}
+
+static enum load_steal_kind __pahole_stealer(struct cu *cu,
+					     struct conf_load *conf_load,
+					     void *thr_data)
 {
 	int ret = LSK__DELETE;
 
@@ -2996,8 +6017,11 @@ static enum load_steal_kind pahole_stealer(struct cu *cu,
 		return LSK__STOP_LOADING;
 	}
 
-	if (!cu__filter(cu))
+	if (!cu__filter(cu)) {
+		if (pahole__ordered_output(thr_data))
+			cu_outputs__skip(cu->seq, stdout);
 		goto filter_it;
+	}
 
 	if (conf_load->ptr_table_stats) {
 		static bool first = true;
@@ -3075,20 +6099,60 @@ static enum load_steal_kind pahole_stealer(struct cu *cu,
 out_btf:
 		return ret;
 	}
-#if 0
+
 	if (ctf_encode) {
-		cu__encode_ctf(cu, global_verbose);
+		static pthread_mutex_t ctf_lock = PTHREAD_MUTEX_INITIALIZER;
+
 		/*
-		 * We still have to get the type signature code merged to eliminate
-		 * dups, reference another CTF file, etc, so for now just encode the
-		 * first cu that is let thru by cu__filter.
-		 *
-		 * FIXME: Disabled, should use Oracle's libctf
+		 * All CUs in a file go to the same encoder, that deduplicates their
+		 * types as they come. The files are loaded one after the other, so
+		 * a CU from another file means the previous one is done, write its
+		 * CTF section, the last one is written at the end, in main().
 		 */
-		goto dump_and_stop;
+		pthread_mutex_lock(&ctf_lock);
+		if (ctf_encoder && strcmp(ctf_encoder__filename(ctf_encoder), cu->filename)) {
+			int err = ctf_encoder__encode(ctf_encoder);
+
+			ctf_encoder__delete(ctf_encoder);
+			ctf_encoder = NULL;
+			if (err) {
+				fputs("Failed to encode CTF\n", stderr);
+				exit(1);
+			}
+		}
+
+		if (!ctf_encoder)
+			ctf_encoder = ctf_encoder__new(cu->filename, global_verbose, conf_load->nr_jobs);
+
+		if (!ctf_encoder) {
+			pthread_mutex_unlock(&ctf_lock);
+			return LSK__STOP_LOADING;
+		}
+
+		if (ctf_encoder__encode_cu(ctf_encoder, cu)) {
+			fprintf(stderr, "Encountered error while encoding CTF.\n");
+			exit(1);
+		}
+		pthread_mutex_unlock(&ctf_lock);
+
+		return LSK__DELETE;
 	}
-#endif
+	// Each CU is processed by just one thread, and the same types get named over and over
+	cu__cache_tag_names(cu);
+
 	if (class_name == NULL) {
+		if (thr_data && structures_stats__per_thread()) {
+			struct thread_data *thread = thr_data;
+
+			if (word_size != 0 && stats_formatter != nr_methods_formatter)
+				cu_fixup_word_size_iterator(cu);
+
+			if (structures_stats__account_cu(&thread->stats, cu))
+				fprintf(stderr, "pahole: insufficient memory for "
+					"processing %s, skipping it...\n", cu->name);
+			goto dump_it;
+		}
+
 		if (stats_formatter == nr_methods_formatter) {
 			cu__account_nr_methods(cu);
 			goto dump_it;
@@ -3097,9 +6161,12 @@ out_btf:
 		if (word_size != 0)
 			cu_fixup_word_size_iterator(cu);
 
-		print_classes(cu);
+		if (pahole__ordered_output(thr_data))
+			print_classes_ordered(cu);
+		else
+			print_classes(cu, stdout, NULL);
 
-		if (sort_output && formatter == class_formatter)
+		if ((sort_output && formatter == class_formatter) || packable_report)
 			ret = LSK__KEEPIT;
 
 		goto dump_it;
@@ -3164,7 +6231,7 @@ out_btf:
 		}
 
 		if (prototype->filter) {
-			type->filter = class_member_filter__new(type, prototype->filter);
+			type->filter = class_member_filter__new(type, cu, prototype->filter);
 			if (type->filter == NULL) {
 				fprintf(stderr, "pahole: invalid filter '%s' for '%s'\n",
 					prototype->filter, prototype->name);
@@ -3195,8 +6262,10 @@ out_btf:
 			goto dump_it;
 		}
 
-		if (class)
-			class__find_holes(tag__class(class));
+		if (class && tag__is_struct(class) && class__find_holes(tag__class(class))) {
+			fprintf(stderr, "pahole: insufficient memory for finding the holes in %s\n", prototype->name);
+			goto dump_and_stop;
+		}
 		if (reorganize) {
 			if (class && tag__is_struct(class))
 				do_reorg(class, cu);
@@ -3250,6 +6319,28 @@ filter_it:
 	return ret;
 }
 
+static enum load_steal_kind pahole_stealer(struct cu *cu,
+					   struct conf_load *conf_load,
+					   void *thr_data)
+{
+	static pthread_mutex_t class_names_lock = PTHREAD_MUTEX_INITIALIZER;
+	enum load_steal_kind ret;
+
+	/*
+	 * Looking for --class_name types changes the class_names list and
+	 * prints as it finds them, so when CUs are being processed in multiple
+	 * threads do it one at a time.
+	 */
+	if (thr_data == NULL || class_name == NULL || btf_encode)
+		return __pahole_stealer(cu, conf_load, thr_data);
+
+	pthread_mutex_lock(&class_names_lock);
+	ret = __pahole_stealer(cu, conf_load, thr_data);
+	pthread_mutex_unlock(&class_names_lock);
+
+	return ret;
+}
+
 static int prototypes__add(struct list_head *prototypes, const char *entry)
 {
 	struct prototype *prototype = prototype__new(entry);
@@ -3383,6 +6474,11 @@ int main(int argc, char *argv[])
 	if (languages.str && parse_languages())
 		return rc;
 
+	if (access_profile_filename && reorganize_greedy) {
+		fputs("pahole: --access_profile is only used by --reorganize=optimal, not by greedy\n", stderr);
+		return rc;
+	}
+
 	if (class_name != NULL && stats_formatter == nr_methods_formatter) {
 		fputs("pahole: -m/nr_methods doesn't work with --class/-C, it shows all classes and the number of its methods\n", stderr);
 		return rc;
@@ -3405,16 +6501,15 @@ int main(int argc, char *argv[])
 
 	dwarves__resolve_cacheline_size(&conf_load, cacheline_size);
 
+	if (access_profile_filename && access_profile__load(access_profile_filename))
+		goto out_dwarves_exit;
+
 	if (prettify_input_filename) {
-		if (strcmp(prettify_input_filename, "-") == 0) {
-			prettify_input = stdin;
-		} else {
-			prettify_input = fopen(prettify_input_filename, "r");
-			if (prettify_input == NULL) {
-				fprintf(stderr, "Failed to read input '%s': %s\n",
-					prettify_input_filename, strerror(errno));
-				goto out_dwarves_exit;
-			}
+		prettify_input = prettify_input__new(prettify_input_filename);
+		if (prettify_input == NULL) {
+			fprintf(stderr, "Failed to read input '%s': %s\n",
+				prettify_input_filename, strerror(errno));
+			goto out_dwarves_exit;
 		}
 	}
 
@@ -3455,6 +6550,14 @@ try_sole_arg_as_class_names:
 	if (class_name && populate_class_names())
 		goto out_dwarves_exit;
 
+	/*
+	 * Looking for specific types? Then there is no need to load all of them
+	 * from BTF, just the ones looked up and what they use, the exceptions
+	 * being the modes that go thru all the types looking for users of them.
+	 */
+	conf_load.lazy_types = class_name != NULL && !find_containers && !find_pointers_in_structs &&
+			       !btf_encode && !ctf_encode;
+
 	if (base_btf_file == NULL) {
 		const char *filename = argv[remaining];
 
@@ -3487,8 +6590,16 @@ try_sole_arg_as_class_names:
 		goto out_cus_delete;
 	}
 
+	if (packable_report) {
+		if (structures__fprintf_packable_report(conf_load.nr_jobs, stdout)) {
+			fputs("pahole: insufficient memory for --packable_report\n", stderr);
+			goto out_cus_delete;
+		}
+		goto out_ok;
+	}
+
 	if (sort_output && formatter == class_formatter) {
-		print_ordered_classes();
+		print_ordered_classes(conf_load.nr_jobs);
 		goto out_ok;
 	}
 
@@ -3536,23 +6647,39 @@ try_sole_arg_as_class_names:
 			goto out_cus_delete;
 		}
 	}
+
+	if (ctf_encode && ctf_encoder) {
+		err = ctf_encoder__encode(ctf_encoder);
+		ctf_encoder__delete(ctf_encoder);
+		ctf_encoder = NULL;
+		if (err) {
+			fputs("Failed to encode CTF\n", stderr);
+			goto out_cus_delete;
+		}
+	}
 out_ok:
 	if (stats_formatter != NULL)
 		print_stats();
+	// The ones accumulated by the threads with -j
+	structures_stats__fprintf(stdout);
 
 	rc = EXIT_SUCCESS;
 out_cus_delete:
 #ifdef DEBUG_CHECK_LEAKS
 	cus__delete(cus);
 	structures__delete();
+	structures_stats__exit(&structures_stats);
+	type_emissions__exit(&emissions);
 	btf__free(conf_load.base_btf);
 	conf_load.base_btf = NULL;
 #endif
 out_dwarves_exit:
-	if (prettify_input && prettify_input != stdin) {
-		fclose(prettify_input);
-		prettify_input = NULL;
-	}
+	if (record_columns__close_all())
+		rc = EXIT_FAILURE;
+	prettify_input__delete(prettify_input);
+	prettify_input = NULL;
+	type_caches__exit(&type_caches);
+	access_profile__delete();
 #ifdef DEBUG_CHECK_LEAKS
 	dwarves__exit();
 #endif
@@ -0,0 +1,62 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0-only
+# Check that pahole --jobs produces the same output as when processing the CUs
+# sequentially when some of the CUs are dropped by --lang, --lang_exclude and
+# --cu_exclude, i.e. CUs that don't render anything shouldn't hold the output
+# of the ones after it.
+#
+# Builds an object with three CUs, each with a different DW_AT_language, so
+# that the filters leave gaps at the start, in the middle and at the end.
+
+pahole_bin=${1:-${PAHOLE-"pahole"}}
+cc=${CC-"gcc"}
+dir=$(mktemp -d /tmp/ordered_output.XXXXXX)
+
+trap "rm -rf $dir" EXIT
+
+cat > $dir/first.c <<EOF
+struct first { int a; char b; long c; };
+struct first first;
+int main(void) { return 0; }
+EOF
+cat > $dir/second.c <<EOF
+struct second { char a; long b; char c; };
+struct second second;
+EOF
+cat > $dir/third.c <<EOF
+struct third { short a; long b; short c; };
+struct third third;
+EOF
+
+if ! ( cd $dir && $cc -g -std=c89 -c first.c && $cc -g -std=c99 -c second.c &&
+       $cc -g -std=c11 -c third.c && $cc -g -o multi first.o second.o third.o ) ; then
+	echo "SKIP: couldn't build the test object with $cc"
+	exit 0
+fi
+
+errors=0
+
+check() {
+	${pahole_bin} -F dwarf "$@" $dir/multi > $dir/serial
+	${pahole_bin} -F dwarf --jobs "$@" $dir/multi > $dir/jobs
+
+	if [ ! -s $dir/serial ] ; then
+		echo "FAIL: pahole $@ produced no output"
+		errors=$((errors + 1))
+	elif ! cmp -s $dir/serial $dir/jobs ; then
+		echo "FAIL: pahole --jobs $@ differs from the sequential output:"
+		diff -u $dir/serial $dir/jobs | head -20
+		errors=$((errors + 1))
+	else
+		echo "ok: pahole --jobs $@"
+	fi
+}
+
+check --lang c89
+check --lang c11
+check --lang_exclude c99
+check --cu_exclude first.c
+check --cu_exclude second.c
+
+[ $errors -eq 0 ] || exit 1
+exit 0
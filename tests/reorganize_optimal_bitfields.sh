@@ -0,0 +1,49 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0-only
+# Check that --reorganize=optimal doesn't end up with a bigger struct than the
+# greedy algorithm when a bitfield run shares its storage unit with the member
+# that follows it, as in 'int a:1; char c;', where 'c' is at offset 1.
+
+pahole_bin=${1:-${PAHOLE-"pahole"}}
+cc=${CC-"gcc"}
+dir=$(mktemp -d /tmp/reorganize_optimal.XXXXXX)
+
+trap "rm -rf $dir" EXIT
+
+cat > $dir/bitfields.c <<EOF
+struct bitfield_then_char {
+	int  a:1;
+	char c;
+	long l;
+	char d;
+};
+struct bitfield_then_char bitfield_then_char;
+int main(void) { return 0; }
+EOF
+
+if ! $cc -g -o $dir/bitfields $dir/bitfields.c ; then
+	echo "SKIP: couldn't build the test object with $cc"
+	exit 0
+fi
+
+# The size of the last struct printed, i.e. the reorganized one
+reorganized_size() {
+	${pahole_bin} -F dwarf -C bitfield_then_char "$@" $dir/bitfields | grep -o 'size: [0-9]*' | tail -1 | cut -d' ' -f2
+}
+
+original=$(reorganized_size)
+greedy=$(reorganized_size --reorganize=greedy)
+optimal=$(reorganized_size --reorganize=optimal)
+
+if [ -z "$original" ] || [ -z "$greedy" ] || [ -z "$optimal" ] ; then
+	echo "FAIL: couldn't get the struct sizes: original=$original greedy=$greedy optimal=$optimal"
+	exit 1
+fi
+
+if [ $optimal -gt $greedy ] ; then
+	echo "FAIL: --reorganize=optimal got $optimal bytes, greedy got $greedy, original is $original"
+	exit 1
+fi
+
+echo "ok: original=$original greedy=$greedy optimal=$optimal"
+exit 0